@@ -0,0 +1,191 @@
+/*
+
+admission.c - GeoQuadTree admission control of GetMap requests
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "admission.h"
+
+extern int verbose_level;
+
+/******************************************************************************/
+
+admission *admission_new(unsigned long max_cost, int timeout)
+{
+  /* Creates a scheduler that serves at the same time requests costing up
+     to max_cost in total, and queues the rest for up to timeout seconds */
+
+  admission *a;
+
+  a=malloc(sizeof(admission));
+  if (a==NULL) { fprintf(stderr, "admission_new: malloc\n"); exit(1); }
+
+  a->max_cost=max_cost;
+  a->timeout=timeout;
+  a->cost=0;
+  a->first=NULL;
+  a->last=NULL;
+
+  pthread_mutex_init(&(a->mutex), NULL);
+  pthread_cond_init(&(a->cond), NULL);
+
+  return a;
+}
+
+/******************************************************************************/
+
+void admission_dequeue(admission *a, admission_waiter *w)
+{
+  admission_waiter *p;
+
+  if (a->first==w)
+  {
+    a->first=(admission_waiter *)w->next;
+    if (a->first==NULL) a->last=NULL;
+    return;
+  }
+
+  for (p=a->first; (p!=NULL); p=(admission_waiter *)p->next)
+  {
+    if ((admission_waiter *)p->next==w)
+    {
+      p->next=w->next;
+      if (a->last==w) a->last=p;
+      return;
+    }
+  }
+}
+
+/******************************************************************************/
+
+int admission_enter(admission *a, unsigned long cost)
+{
+  /* Waits until a request of the given cost can be served. The requests
+     are admitted in the order they arrive, so that a costly one is not
+     passed over forever by cheaper ones. Returns ADMISSION_ADMITTED, and
+     then admission_leave has to be called once it has been served */
+
+  admission_waiter w;
+  struct timespec deadline;
+
+  if (cost>a->max_cost) return ADMISSION_TOO_LARGE;
+
+  pthread_mutex_lock(&(a->mutex));
+
+  if ((a->first==NULL)&&(a->cost+cost<=a->max_cost))
+  {
+    a->cost+=cost;
+    pthread_mutex_unlock(&(a->mutex));
+    return ADMISSION_ADMITTED;
+  }
+
+  w.cost=cost;
+  w.next=NULL;
+
+  if (a->last==NULL) a->first=&w;
+  else a->last->next=(struct admission_waiter *)&w;
+  a->last=&w;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec+=a->timeout;
+
+  while ((a->first!=&w)||(a->cost+cost>a->max_cost))
+  {
+    if (pthread_cond_timedwait(&(a->cond), &(a->mutex), &deadline)==ETIMEDOUT)
+    {
+      admission_dequeue(a, &w);
+      pthread_cond_broadcast(&(a->cond));
+      pthread_mutex_unlock(&(a->mutex));
+
+      if (verbose_level>1) printf("admission_enter timeout %lu\n", cost);
+
+      return ADMISSION_TIMEOUT;
+    }
+  }
+
+  admission_dequeue(a, &w);
+  a->cost+=cost;
+
+  /* The next request in the queue may fit as well */
+
+  pthread_cond_broadcast(&(a->cond));
+  pthread_mutex_unlock(&(a->mutex));
+
+  return ADMISSION_ADMITTED;
+}
+
+/******************************************************************************/
+
+int admission_try(admission *a, unsigned long cost)
+{
+  /* Admits a request of the given cost only if it can be served at once,
+     without queueing. Returns 1 if it has been admitted, and then
+     admission_leave has to be called once it has been served */
+
+  int admitted;
+
+  pthread_mutex_lock(&(a->mutex));
+
+  admitted=((a->first==NULL)&&(a->cost+cost<=a->max_cost));
+  if (admitted==1) a->cost+=cost;
+
+  pthread_mutex_unlock(&(a->mutex));
+
+  return admitted;
+}
+
+/******************************************************************************/
+
+void admission_leave(admission *a, unsigned long cost)
+{
+  pthread_mutex_lock(&(a->mutex));
+
+  a->cost-=cost;
+  pthread_cond_broadcast(&(a->cond));
+
+  pthread_mutex_unlock(&(a->mutex));
+}
+
+/******************************************************************************/
+
+unsigned long admission_free(admission *a)
+{
+  /* Cost left under the limit by the requests being served. A request
+     costing more would wait even if nothing else did */
+
+  unsigned long free_cost;
+
+  pthread_mutex_lock(&(a->mutex));
+
+  free_cost=0;
+  if (a->cost<a->max_cost) free_cost=a->max_cost-a->cost;
+
+  pthread_mutex_unlock(&(a->mutex));
+
+  return free_cost;
+}
+
+/******************************************************************************/
@@ -0,0 +1,63 @@
+/*
+
+admission.h - GeoQuadTree admission control of GetMap requests
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__ADMISSION__)
+
+#define __ADMISSION__
+
+#include <pthread.h>
+
+#define ADMISSION_ADMITTED 0
+#define ADMISSION_TOO_LARGE 1  /* The request alone exceeds the limit */
+#define ADMISSION_TIMEOUT 2    /* The request waited too long in the queue */
+
+typedef struct
+{
+  unsigned long cost;
+  struct admission_waiter *next;
+} admission_waiter;
+
+typedef struct
+{
+  unsigned long max_cost;         /* Cost of the requests admitted at once */
+  int timeout;                    /* Seconds a request waits in the queue */
+  unsigned long cost;             /* Of the requests being served */
+  admission_waiter *first, *last; /* Queue, the oldest request first */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} admission;
+
+admission *admission_new(unsigned long, int);
+
+int admission_enter(admission *, unsigned long);
+
+int admission_try(admission *, unsigned long);
+
+void admission_leave(admission *, unsigned long);
+
+unsigned long admission_free(admission *);
+
+#endif
+
+/******************************************************************************/
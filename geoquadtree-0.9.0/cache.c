@@ -0,0 +1,576 @@
+/*
+
+cache.c - GeoQuadTree cache of rendered GetMap responses
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+extern int verbose_level;
+
+/******************************************************************************/
+
+void cache_file(response_cache *c, unsigned long id, char *suffix, char *path)
+{
+  /* Each process of the server has its own files in the cache directory */
+
+  snprintf(path, 1024, "%s/%i-%lu.%s", c->path, (int)getpid(), id, suffix);
+}
+
+/******************************************************************************/
+
+response_cache *cache_new(char *path, unsigned long max_bytes)
+{
+  /* Creates an empty cache in the directory path. The images left there
+     by processes that are no longer running are removed, as nobody
+     indexes them, and so are the shared images that no process has in
+     its cache any more */
+
+  response_cache *c;
+  DIR *dir;
+  struct dirent *d;
+  struct stat buf;
+  char file[1024];
+  int length, pid;
+
+  mkdir(path, S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+
+  dir=opendir(path);
+  if (dir==NULL)
+  { fprintf(stderr, "cache_new: opendir %s\n", path); return NULL; }
+
+  while ((d=readdir(dir))!=NULL)
+  {
+    length=strlen(d->d_name);
+    if (length<4) continue;
+
+    if ((strncmp(d->d_name, "shared-", 7)==0)&&(length>5)&&
+        (strcmp(&(d->d_name[length-5]), ".data")==0))
+    {
+      snprintf(file, 1024, "%s/%s", path, d->d_name);
+      if ((stat(file, &buf)==0)&&(buf.st_nlink==1)) unlink(file);
+      continue;
+    }
+
+    if ((strcmp(&(d->d_name[length-4]), ".img")!=0)&&
+        (strcmp(&(d->d_name[length-4]), ".tmp")!=0)) continue;
+
+    pid=atoi(d->d_name);
+
+    if ((pid<=0)||(pid==getpid())||((kill(pid, 0)!=0)&&(errno==ESRCH)))
+    {
+      snprintf(file, 1024, "%s/%s", path, d->d_name);
+      unlink(file);
+    }
+  }
+
+  closedir(dir);
+
+  c=malloc(sizeof(response_cache));
+  if (c==NULL) { fprintf(stderr, "cache_new: malloc\n"); exit(1); }
+
+  c->path=malloc(strlen(path)+1);
+  if (c->path==NULL) { fprintf(stderr, "cache_new: malloc\n"); exit(1); }
+  strcpy(c->path, path);
+
+  c->max_bytes=max_bytes;
+  c->bytes=0;
+  c->next_id=0;
+  c->index=hash_new(1024);
+  c->flights=hash_new(64);
+  c->first=NULL;
+  c->last=NULL;
+
+  pthread_mutex_init(&(c->mutex), NULL);
+
+  return c;
+}
+
+/******************************************************************************/
+
+void cache_unlink(response_cache *c, cache_entry *e)
+{
+  /* Takes e out of the least recently used list */
+
+  if (e->prev==NULL) c->first=(cache_entry *)e->next;
+  else ((cache_entry *)e->prev)->next=e->next;
+
+  if (e->next==NULL) c->last=(cache_entry *)e->prev;
+  else ((cache_entry *)e->next)->prev=e->prev;
+}
+
+/******************************************************************************/
+
+void cache_link(response_cache *c, cache_entry *e)
+{
+  /* Puts e at the head of the least recently used list */
+
+  e->prev=NULL;
+  e->next=(struct cache_entry *)c->first;
+
+  if (c->first==NULL) c->last=e;
+  else c->first->prev=(struct cache_entry *)e;
+
+  c->first=e;
+}
+
+/******************************************************************************/
+
+void cache_slot(response_cache *c, char *key, char *suffix, char *path)
+{
+  /* The processes of the server share CACHE_SLOTS images, the last one
+     rendered of the requests whose keys fall in each slot. The .key file
+     of a slot describes its .data file and is locked while it changes */
+
+  snprintf(path, 1024, "%s/shared-%03lx.%s", c->path,
+           hash_string(key)%CACHE_SLOTS, suffix);
+}
+
+/******************************************************************************/
+
+int cache_slot_open(response_cache *c, char *key, int operation)
+{
+  /* Opens the slot of key and locks it with flock operation. Returns its
+     descriptor, or -1 if it cannot be locked */
+
+  char file[1024];
+  int fd;
+
+  cache_slot(c, key, "key", file);
+
+  fd=open(file, O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+  if (fd<0) return -1;
+
+  if (flock(fd, operation)!=0) { close(fd); return -1; }
+
+  return fd;
+}
+
+/******************************************************************************/
+
+void cache_slot_drop(response_cache *c, char *key, char *file)
+{
+  /* Empties the slot of key if it still shares the image in file, which is
+     being evicted and no other process has it, so that the slots only
+     keep images counted in the size of the cache of some process. A slot
+     being written is left alone */
+
+  struct stat image, shared;
+  char data[1024];
+  int fd;
+
+  cache_slot(c, key, "data", data);
+
+  if ((stat(file, &image)!=0)||(stat(data, &shared)!=0)) return;
+  if ((image.st_dev!=shared.st_dev)||(image.st_ino!=shared.st_ino)||
+      (shared.st_nlink>2)) return;
+
+  fd=cache_slot_open(c, key, LOCK_EX|LOCK_NB);
+  if (fd<0) return;
+
+  if ((stat(data, &shared)==0)&&
+      (image.st_dev==shared.st_dev)&&(image.st_ino==shared.st_ino))
+  {
+    unlink(data);
+    if (ftruncate(fd, 0)!=0) fprintf(stderr, "cache_slot_drop: %s\n", key);
+  }
+
+  close(fd);
+}
+
+/******************************************************************************/
+
+void cache_remove(response_cache *c, cache_entry *e)
+{
+  char file[1024];
+
+  cache_unlink(c, e);
+  hash_remove(c->index, e->key);
+
+  cache_file(c, e->id, "img", file);
+  cache_slot_drop(c, e->key, file);
+  unlink(file);
+
+  c->bytes-=e->length;
+
+  free(e->key);
+  free(e);
+}
+
+/******************************************************************************/
+
+int cache_lookup(response_cache *c, char *key, time_t last_modified,
+                 unsigned long *length)
+{
+  /* Looks for the image of a request among the ones of this process.
+     Returns an open descriptor of its file, or -1 if the image is not
+     cached, has expired, or was rendered before the last change of its
+     trees */
+
+  cache_entry *e;
+  char file[1024];
+  int fd;
+
+  pthread_mutex_lock(&(c->mutex));
+
+  e=(cache_entry *)hash_get(c->index, key);
+
+  if (e==NULL) { pthread_mutex_unlock(&(c->mutex)); return -1; }
+
+  if ((e->last_modified!=last_modified)||(time(NULL)>=e->expires))
+  {
+    cache_remove(c, e);
+    pthread_mutex_unlock(&(c->mutex));
+    return -1;
+  }
+
+  /* The file is opened before unlocking, so that it cannot be evicted in
+     between; once open, it can be sent even if it is evicted */
+
+  cache_file(c, e->id, "img", file);
+
+  fd=open(file, O_RDONLY);
+  if (fd<0)
+  {
+    cache_remove(c, e);
+    pthread_mutex_unlock(&(c->mutex));
+    return -1;
+  }
+
+  cache_unlink(c, e);
+  cache_link(c, e);
+
+  *length=e->length;
+
+  pthread_mutex_unlock(&(c->mutex));
+
+  if (verbose_level>1) printf("cache_get hit %s\n", key);
+
+  return fd;
+}
+
+/******************************************************************************/
+
+void cache_add(response_cache *c, char *key, unsigned long id,
+               unsigned long length, time_t expires, time_t last_modified)
+{
+  /* Indexes the image already stored in the file of id, evicting the least
+     recently used images while the cache is over its size */
+
+  cache_entry *e;
+
+  e=malloc(sizeof(cache_entry));
+  if (e==NULL) { fprintf(stderr, "cache_add: malloc\n"); exit(1); }
+
+  e->key=malloc(strlen(key)+1);
+  if (e->key==NULL) { fprintf(stderr, "cache_add: malloc\n"); exit(1); }
+  strcpy(e->key, key);
+
+  e->id=id;
+  e->length=length;
+  e->expires=expires;
+  e->last_modified=last_modified;
+
+  pthread_mutex_lock(&(c->mutex));
+
+  /* Another thread may have rendered the same request meanwhile */
+
+  if (hash_get(c->index, key)!=NULL)
+    cache_remove(c, (cache_entry *)hash_get(c->index, key));
+
+  cache_link(c, e);
+  hash_put(c->index, key, e);
+  c->bytes+=length;
+
+  while ((c->bytes>c->max_bytes)&&(c->last!=NULL)) cache_remove(c, c->last);
+
+  pthread_mutex_unlock(&(c->mutex));
+}
+
+/******************************************************************************/
+
+int cache_slot_adopt(response_cache *c, int fd, char *key,
+                     time_t last_modified)
+{
+  /* Takes into this process the image of the locked slot fd, if it is the
+     current one of key. Returns 1 if it has been taken */
+
+  char buffer[2048], data[1024], file[1024];
+  long modified, expires;
+  unsigned long length, id;
+  ssize_t n;
+  int offset;
+
+  n=pread(fd, buffer, sizeof(buffer)-1, 0);
+  if (n<=0) return 0;
+  buffer[n]=0;
+
+  if (sscanf(buffer, "%ld %ld %lu\n%n", &modified, &expires, &length,
+             &offset)!=3) return 0;
+
+  if ((strcmp(buffer+offset, key)!=0)||(modified!=(long)last_modified)||
+      (time(NULL)>=expires)||(length>c->max_bytes)) return 0;
+
+  pthread_mutex_lock(&(c->mutex));
+  id=c->next_id++;
+  pthread_mutex_unlock(&(c->mutex));
+
+  /* The file is shared through a second link, not copied */
+
+  cache_slot(c, key, "data", data);
+  cache_file(c, id, "img", file);
+
+  if (link(data, file)!=0) return 0;
+
+  cache_add(c, key, id, length, (time_t)expires, last_modified);
+
+  if (verbose_level>1) printf("cache_slot_adopt %s\n", key);
+
+  return 1;
+}
+
+/******************************************************************************/
+
+void cache_slot_publish(response_cache *c, int fd, char *key,
+                        unsigned long id, unsigned long length,
+                        time_t expires, time_t last_modified)
+{
+  /* Makes the image in the file of id the one of the locked slot fd */
+
+  char buffer[2048], file[1024], tmp[1024], data[1024];
+  int n;
+
+  cache_file(c, id, "img", file);
+  cache_file(c, id, "tmp", tmp);
+  cache_slot(c, key, "data", data);
+
+  if (link(file, tmp)!=0) return;
+  if (rename(tmp, data)!=0) { unlink(tmp); return; }
+
+  n=snprintf(buffer, sizeof(buffer), "%ld %ld %lu\n%s", (long)last_modified,
+             (long)expires, length, key);
+  if (n>=(int)sizeof(buffer)) n=0;
+
+  if ((ftruncate(fd, 0)!=0)||(pwrite(fd, buffer, n, 0)!=n))
+    fprintf(stderr, "cache_slot_publish: write %s\n", key);
+}
+
+/******************************************************************************/
+
+int cache_get(response_cache *c, char *key, time_t last_modified,
+              unsigned long *length)
+{
+  /* Looks for the image of a request, in this process or in the slot
+     shared with the other ones. Returns an open descriptor of its file, or
+     -1 if the image is not cached. A slot being written is not waited for */
+
+  int fd, slot;
+
+  fd=cache_lookup(c, key, last_modified, length);
+  if (fd>=0) return fd;
+
+  slot=cache_slot_open(c, key, LOCK_SH|LOCK_NB);
+  if (slot<0) return -1;
+
+  if (cache_slot_adopt(c, slot, key, last_modified)==1)
+    fd=cache_lookup(c, key, last_modified, length);
+
+  close(slot);
+
+  return fd;
+}
+
+/******************************************************************************/
+
+void cache_put(response_cache *c, char *key, time_t last_modified, int ttl,
+               void *data, unsigned long length)
+{
+  /* Stores the image of a request for ttl seconds, and shares it with the
+     other processes */
+
+  cache_flight *f;
+  char file[1024], tmp[1024];
+  unsigned long id, written;
+  time_t expires;
+  ssize_t n;
+  int fd, slot;
+
+  if ((length==0)||(length>c->max_bytes)) return;
+
+  pthread_mutex_lock(&(c->mutex));
+  id=c->next_id++;
+  pthread_mutex_unlock(&(c->mutex));
+
+  /* The image is written to a temporary file and renamed once complete */
+
+  cache_file(c, id, "tmp", tmp);
+  cache_file(c, id, "img", file);
+
+  fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+  if (fd<0) { fprintf(stderr, "cache_put: open %s\n", tmp); return; }
+
+  for (written=0; (written<length); written+=n)
+  {
+    n=write(fd, (char *)data+written, length-written);
+    if (n<=0) break;
+  }
+
+  close(fd);
+
+  if ((written<length)||(rename(tmp, file)!=0))
+  { fprintf(stderr, "cache_put: write %s\n", tmp); unlink(tmp); return; }
+
+  expires=time(NULL)+ttl;
+
+  /* The slot is published before the image can be evicted. The render of
+     a flight already holds its slot, which is duplicated so that it stays
+     open and locked even if the flight ends meanwhile; other slots are
+     skipped if busy */
+
+  pthread_mutex_lock(&(c->mutex));
+  f=(cache_flight *)hash_get(c->flights, key);
+  slot=((f!=NULL)&&(f->lock>=0))?dup(f->lock):-1;
+  pthread_mutex_unlock(&(c->mutex));
+
+  if (slot<0) slot=cache_slot_open(c, key, LOCK_EX|LOCK_NB);
+
+  if (slot>=0)
+  {
+    cache_slot_publish(c, slot, key, id, length, expires, last_modified);
+    close(slot);
+  }
+
+  cache_add(c, key, id, length, expires, last_modified);
+}
+
+/******************************************************************************/
+
+cache_flight *cache_begin(response_cache *c, char *key, time_t last_modified)
+{
+  /* Coalesces concurrent renders of the same request. Returns NULL if
+     another thread or process has just rendered key, which is then looked
+     for again in the cache; otherwise the caller renders it and ends the
+     flight with cache_end, and identical requests wait for it meanwhile.
+     Other processes are excluded through the lock of the slot of key, so
+     requests whose keys share a slot are also rendered one at a time */
+
+  cache_flight *f;
+  int fd;
+
+  pthread_mutex_lock(&(c->mutex));
+
+  f=(cache_flight *)hash_get(c->flights, key);
+
+  if (f!=NULL)
+  {
+    f->waiters++;
+    while (f->done==0) pthread_cond_wait(&(f->cond), &(c->mutex));
+    f->waiters--;
+
+    if (f->waiters==0)
+    {
+      pthread_cond_destroy(&(f->cond));
+      free(f->key);
+      free(f);
+    }
+
+    pthread_mutex_unlock(&(c->mutex));
+
+    if (verbose_level>1) printf("cache_begin waited for %s\n", key);
+
+    return NULL;
+  }
+
+  f=malloc(sizeof(cache_flight));
+  if (f==NULL) { fprintf(stderr, "cache_begin: malloc\n"); exit(1); }
+
+  f->key=malloc(strlen(key)+1);
+  if (f->key==NULL) { fprintf(stderr, "cache_begin: malloc\n"); exit(1); }
+  strcpy(f->key, key);
+
+  f->lock=-1;
+  f->done=0;
+  f->waiters=0;
+  pthread_cond_init(&(f->cond), NULL);
+
+  hash_put(c->flights, key, f);
+
+  pthread_mutex_unlock(&(c->mutex));
+
+  /* The slot is held until the render ends. Once locked, it may hold the
+     image rendered by another process while this one was waiting */
+
+  fd=cache_slot_open(c, key, LOCK_EX);
+
+  if ((fd>=0)&&(cache_slot_adopt(c, fd, key, last_modified)==1))
+  {
+    close(fd);
+    cache_end(c, f);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&(c->mutex));
+  f->lock=fd;
+  pthread_mutex_unlock(&(c->mutex));
+
+  return f;
+}
+
+/******************************************************************************/
+
+void cache_end(response_cache *c, cache_flight *f)
+{
+  /* Ends a render started with cache_begin, releasing its slot and waking
+     up the threads waiting for it */
+
+  pthread_mutex_lock(&(c->mutex));
+
+  hash_remove(c->flights, f->key);
+
+  if (f->lock>=0) close(f->lock);
+
+  f->done=1;
+  pthread_cond_broadcast(&(f->cond));
+
+  if (f->waiters==0)
+  {
+    pthread_cond_destroy(&(f->cond));
+    free(f->key);
+    free(f);
+  }
+
+  pthread_mutex_unlock(&(c->mutex));
+}
+
+/******************************************************************************/
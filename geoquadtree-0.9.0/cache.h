@@ -0,0 +1,81 @@
+/*
+
+cache.h - GeoQuadTree cache of rendered GetMap responses
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__CACHE__)
+
+#define __CACHE__
+
+#include <time.h>
+#include <pthread.h>
+
+#include "hash.h"
+
+#define CACHE_SLOTS 4096         /* Images shared with other processes */
+
+typedef struct
+{
+  char *key;                     /* Normalised request parameters */
+  unsigned long id;              /* Number of the file of the entry */
+  unsigned long length;          /* Bytes of the encoded image */
+  time_t expires;
+  time_t last_modified;          /* Of the trees when it was rendered */
+  struct cache_entry *prev;      /* Least recently used order, */
+  struct cache_entry *next;      /* the most recent one first */
+} cache_entry;
+
+typedef struct
+{
+  char *path;                    /* Directory of the cached images */
+  unsigned long max_bytes;
+  unsigned long bytes;
+  unsigned long next_id;
+  hash_table *index;             /* Entries indexed by key */
+  hash_table *flights;           /* Renders in progress indexed by key */
+  cache_entry *first, *last;
+  pthread_mutex_t mutex;
+} response_cache;
+
+typedef struct
+{
+  char *key;                     /* Request being rendered */
+  int lock;                      /* Locked slot shared with the other
+                                    processes, or -1 */
+  int done;
+  int waiters;                   /* Threads waiting for the render */
+  pthread_cond_t cond;
+} cache_flight;
+
+response_cache *cache_new(char *, unsigned long);
+
+int cache_get(response_cache *, char *, time_t, unsigned long *);
+
+void cache_put(response_cache *, char *, time_t, int, void *, unsigned long);
+
+cache_flight *cache_begin(response_cache *, char *, time_t);
+
+void cache_end(response_cache *, cache_flight *);
+
+#endif
+
+/******************************************************************************/
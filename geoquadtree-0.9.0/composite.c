@@ -0,0 +1,211 @@
+/*
+
+composite.c - GeoQuadTree front-to-back compositing
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "composite.h"
+
+/*
+   Rasters are composited from the topmost to the bottommost one into an
+   accumulation buffer with premultiplied alpha. Once a pixel of the
+   accumulation buffer is opaque, the rasters underneath cannot change it, so
+   the coverage keeps, for every row, the span of pixels that are not opaque
+   yet. Rasters are only resampled inside these spans, and no more rasters
+   are rendered once every span is empty.
+*/
+
+/******************************************************************************/
+
+coverage *coverage_new(unsigned long width, unsigned long height)
+{
+  coverage *cov;
+  unsigned long row;
+
+  cov=malloc(sizeof(coverage));
+  if (cov==NULL) { fprintf(stderr, "coverage_new: malloc\n"); exit(1); }
+
+  cov->width=width;
+  cov->height=height;
+
+  cov->first=malloc(height*sizeof(long));
+  if (cov->first==NULL) { fprintf(stderr, "coverage_new: malloc\n"); exit(1); }
+
+  cov->last=malloc(height*sizeof(long));
+  if (cov->last==NULL) { fprintf(stderr, "coverage_new: malloc\n"); exit(1); }
+
+  for (row=0; (row<height); row++)
+  {
+    cov->first[row]=0;
+    cov->last[row]=width-1;
+  }
+
+  cov->open_rows=height;
+
+  return cov;
+}
+
+/******************************************************************************/
+
+void coverage_free(coverage *cov)
+{
+  if (cov==NULL) return;
+
+  free(cov->first);
+  free(cov->last);
+  free(cov);
+}
+
+/******************************************************************************/
+
+void coverage_copy(coverage *dst, coverage *src)
+{
+  /* Both coverages have the same size */
+
+  memcpy(dst->first, src->first, src->height*sizeof(long));
+  memcpy(dst->last, src->last, src->height*sizeof(long));
+
+  dst->open_rows=src->open_rows;
+}
+
+/******************************************************************************/
+
+int coverage_complete(coverage *cov)
+{
+  return (cov->open_rows==0);
+}
+
+/******************************************************************************/
+
+int coverage_window(coverage *cov, long *window)
+{
+  /* Smallest window (colmin, rowmin, colmax, rowmax) containing every pixel
+     not yet opaque. Returns 1 if there is no such pixel */
+
+  unsigned long row;
+  int found;
+
+  found=0;
+
+  for (row=0; (row<cov->height); row++)
+  {
+    if (cov->first[row]>cov->last[row]) continue;
+
+    if (found==0)
+    {
+      window[0]=cov->first[row]; window[1]=row;
+      window[2]=cov->last[row];  window[3]=row;
+      found=1;
+    }
+    else
+    {
+      if (cov->first[row]<window[0]) window[0]=cov->first[row];
+      if (cov->last[row]>window[2]) window[2]=cov->last[row];
+      window[3]=row;
+    }
+  }
+
+  return (found==0);
+}
+
+/******************************************************************************/
+
+void composite_under(unsigned char *acc, unsigned char *src, coverage *cov)
+{
+  /* Puts the image src (not premultiplied) under the accumulation buffer acc
+     (premultiplied), only inside the spans not yet opaque, and shrinks the
+     spans of the coverage */
+
+  unsigned long row;
+  long col;
+  unsigned char *a, *s;
+
+  for (row=0; (row<cov->height); row++)
+  {
+    if (cov->first[row]>cov->last[row]) continue;
+
+    a=acc+(row*cov->width+cov->first[row])*4;
+    s=src+(row*cov->width+cov->first[row])*4;
+
+    for (col=cov->first[row]; (col<=cov->last[row]); col++)
+    {
+      COMPOSITE_PIXEL(a, s);
+
+      a+=4;
+      s+=4;
+    }
+  }
+
+  coverage_shrink(cov, acc);
+}
+
+/******************************************************************************/
+
+void coverage_shrink(coverage *cov, unsigned char *acc)
+{
+  /* Shrinks the spans of the coverage after rasters were put directly under
+     the accumulation buffer acc. Only the ends of the spans are looked at */
+
+  unsigned long row;
+
+  for (row=0; (row<cov->height); row++)
+  {
+    if (cov->first[row]>cov->last[row]) continue;
+
+    while ((cov->first[row]<=cov->last[row])&&
+           (acc[(row*cov->width+cov->first[row])*4+3]==255))
+      cov->first[row]++;
+
+    while ((cov->last[row]>=cov->first[row])&&
+           (acc[(row*cov->width+cov->last[row])*4+3]==255))
+      cov->last[row]--;
+
+    if (cov->first[row]>cov->last[row]) cov->open_rows--;
+  }
+}
+
+/******************************************************************************/
+
+void composite_background(unsigned char *dst, unsigned char *acc,
+                          unsigned long length)
+{
+  /* Puts the accumulation buffer acc (premultiplied) over the image dst,
+     which holds the background. length is the number of pixels */
+
+  unsigned long i;
+  long remain;
+
+  for (i=0; (i<length*4); i+=4)
+  {
+    remain=255-acc[i+3];
+
+    dst[i+0]=acc[i+0]+((long)dst[i+0]*remain)/255;
+    dst[i+1]=acc[i+1]+((long)dst[i+1]*remain)/255;
+    dst[i+2]=acc[i+2]+((long)dst[i+2]*remain)/255;
+    dst[i+3]=acc[i+3]+((long)dst[i+3]*remain)/255;
+  }
+}
+
+/******************************************************************************/
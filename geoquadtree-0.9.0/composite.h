@@ -0,0 +1,72 @@
+/*
+
+composite.h - GeoQuadTree front-to-back compositing
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__COMPOSITE__)
+
+#define __COMPOSITE__
+
+typedef struct
+{
+  unsigned long width, height;
+  long *first, *last;        /* Span of each row not yet opaque (first>last
+                                when the whole row is opaque) */
+  unsigned long open_rows;   /* Number of rows with a non-empty span */
+} coverage;
+
+/* Puts the pixel s (not premultiplied) under the pixel a of an accumulation
+   buffer (premultiplied) */
+
+#define COMPOSITE_PIXEL(a, s) \
+{ \
+  long remain_, alpha_; \
+  remain_=255-(a)[3]; \
+  if (remain_>0) \
+  { \
+    alpha_=(long)(s)[3]*remain_; \
+    (a)[0]+=((long)(s)[0]*alpha_)/65025; \
+    (a)[1]+=((long)(s)[1]*alpha_)/65025; \
+    (a)[2]+=((long)(s)[2]*alpha_)/65025; \
+    (a)[3]+=alpha_/255; \
+  } \
+}
+
+coverage *coverage_new(unsigned long, unsigned long);
+
+void coverage_free(coverage *);
+
+void coverage_copy(coverage *, coverage *);
+
+int coverage_complete(coverage *);
+
+int coverage_window(coverage *, long *);
+
+void coverage_shrink(coverage *, unsigned char *);
+
+void composite_under(unsigned char *, unsigned char *, coverage *);
+
+void composite_background(unsigned char *, unsigned char *, unsigned long);
+
+#endif
+
+/******************************************************************************/
@@ -22,14 +22,250 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 /******************************************************************************/
 
-#include <fcgi_stdio.h>
+#define _GNU_SOURCE
+
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcgiapp.h>
+
+#include "fcgi.h"
+
+/******************************************************************************/
+
+void output_grow(output_stream *out, unsigned long length)
+{
+  /* Makes room in memory for length more bytes */
+
+  if (out->length+length>out->size)
+  {
+    out->size=(out->size==0)?65536:out->size;
+    while (out->length+length>out->size) out->size*=2;
+
+    out->buffer=realloc(out->buffer, out->size);
+    if (out->buffer==NULL) { fprintf(stderr, "output_grow: realloc\n"); exit(1); }
+  }
+}
+
+/******************************************************************************/
+
+void output_init(output_stream *out, FCGX_Stream *stream)
+{
+  out->buffer=NULL;
+  out->size=0;
+
+  output_reset(out, stream);
+}
+
+/******************************************************************************/
+
+void output_reset(output_stream *out, FCGX_Stream *stream)
+{
+  /* Starts a new response, keeping the memory of the previous one. A
+     response for a FastCGI stream is assembled in memory and sent by
+     output_finish, with room left before it for its Content-Length */
+
+  out->stream=stream;
+  out->direct=0;
+  out->reserved=(stream==NULL)?0:OUTPUT_RESERVED;
+  out->length=0;
+  out->fd=-1;
+  out->file_length=0;
+
+  output_grow(out, out->reserved);
+  out->length=out->reserved;
+}
+
+/******************************************************************************/
+
+void output_buffer(output_stream *out, void *buffer, unsigned length)
+{
+  if (out->direct==1)
+  {
+    FCGX_PutStr((const char *)buffer, length, out->stream);
+    return;
+  }
+
+  output_grow(out, length);
+
+  memcpy(out->buffer+out->length, buffer, length);
+  out->length+=length;
+}
+
+/******************************************************************************/
+
+void output_printf(output_stream *out, const char *format, ...)
+{
+  char str[4096];
+  va_list ap;
+  int length;
+
+  va_start(ap, format);
+  length=vsnprintf(str, sizeof(str), format, ap);
+  va_end(ap);
+
+  if (length<0) return;
+  if (length>=sizeof(str)) length=sizeof(str)-1;
+
+  output_buffer(out, str, length);
+}
+
+/******************************************************************************/
+
+void output_file(output_stream *out, int fd, unsigned long length)
+{
+  /* Sends length bytes of an open file. A FastCGI stream gets a copy of
+     them; in memory the file is kept open to be sent by the caller, with
+     sendfile */
+
+  char buffer[65536];
+  ssize_t n;
+
+  if (out->direct==0)
+  {
+    out->fd=fd;
+    out->file_length=length;
+    return;
+  }
+
+  while ((length>0)&&((n=read(fd, buffer, sizeof(buffer)))>0))
+  {
+    if (n>length) n=length;
+    FCGX_PutStr(buffer, n, out->stream);
+    length-=n;
+  }
+
+  close(fd);
+}
+
+/******************************************************************************/
+
+void output_flush(output_stream *out)
+{
+  /* Sends to the web server what has been written so far, so that the
+     client starts receiving a response still being produced. Small
+     responses are still sent whole, with their length */
+
+  if (out->stream==NULL) return;
+
+  if ((out->direct==0)&&(out->length-out->reserved>=OUTPUT_STREAMED))
+  {
+    FCGX_PutStr(out->buffer+out->reserved, out->length-out->reserved,
+                out->stream);
+    out->length=out->reserved;
+    out->direct=1;
+  }
+
+  if (out->direct==1) FCGX_FFlush(out->stream);
+}
+
+/******************************************************************************/
+
+void output_finish(output_stream *out)
+{
+  /* Sends a response assembled in memory to its FastCGI stream in a single
+     write, adding the Content-Length of its body to its headers */
+
+  char header[OUTPUT_RESERVED], *p, *end;
+  unsigned long body;
+  ssize_t n;
+  int length;
+
+  if ((out->stream==NULL)||(out->direct==1)) return;
+
+  /* A file is read after the response, so that it goes in the same write */
+
+  if (out->fd>=0)
+  {
+    output_grow(out, out->file_length);
+
+    for (body=0; (body<out->file_length); body+=n)
+    {
+      n=read(out->fd, out->buffer+out->length+body, out->file_length-body);
+      if (n<=0) break;
+    }
+
+    out->length+=body;
+    close(out->fd);
+    out->fd=-1;
+  }
+
+  p=out->buffer+out->reserved;
+  end=NULL;
+
+  if (out->length>out->reserved)
+    end=memmem(p, out->length-out->reserved, "\r\n\r\n", 4);
+
+  if (end!=NULL)
+  {
+    body=out->length-(end+4-out->buffer);
+
+    length=snprintf(header, sizeof(header), "Content-Length: %lu\r\n", body);
+    p-=length;
+    memcpy(p, header, length);
+  }
+
+  FCGX_PutStr(p, out->buffer+out->length-p, out->stream);
+}
 
 /******************************************************************************/
 
-void output_buffer(void *buffer, unsigned length)
+void http_date(time_t t, char *str)
 {
-  fwrite(buffer, length, 1, stdout); 
+  struct tm tp;
+
+  gmtime_r(&t, &tp);
+  strftime(str, 64, "%a, %d %b %Y %H:%M:%S GMT", &tp);
+}
+
+/******************************************************************************/
+
+int http_parse_date(char *str, time_t *t)
+{
+  /* Parses a date of an HTTP header in any of the formats of RFC 2616:
+     RFC 1123, RFC 850 or asctime. Returns 1 if it is not understood */
+
+  const char *months="JanFebMarAprMayJunJulAugSepOctNovDec";
+  char month[4];
+  const char *m;
+  struct tm tp;
+  int day, year, hour, minute, second;
+  char *p;
+
+  p=strchr(str, ',');
+
+  if (p!=NULL)
+  {
+    if (sscanf(p+1, " %d %3s %d %d:%d:%d", &day, month, &year,
+               &hour, &minute, &second)!=6)
+    {
+      if (sscanf(p+1, " %d-%3s-%d %d:%d:%d", &day, month, &year,
+                 &hour, &minute, &second)!=6) return 1;
+
+      if (year<70) year+=2000;
+      else if (year<100) year+=1900;
+    }
+  }
+  else if (sscanf(str, "%*s %3s %d %d:%d:%d %d", month, &day,
+                  &hour, &minute, &second, &year)!=6) return 1;
+
+  m=strstr(months, month);
+  if ((strlen(month)!=3)||(m==NULL)||(((m-months)%3)!=0)) return 1;
+
+  memset(&tp, 0, sizeof(tp));
+  tp.tm_year=year-1900;
+  tp.tm_mon=(m-months)/3;
+  tp.tm_mday=day;
+  tp.tm_hour=hour;
+  tp.tm_min=minute;
+  tp.tm_sec=second;
+
+  *t=timegm(&tp);
+
+  return (*t==(time_t)-1);
 }
 
 /******************************************************************************/
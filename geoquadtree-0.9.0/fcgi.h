@@ -22,6 +22,48 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 /******************************************************************************/
 
-void output_buffer(void *, unsigned);
+#if !defined(__FCGI__)
+
+#define __FCGI__
+
+#include <time.h>
+#include <fcgiapp.h>
+
+#define OUTPUT_RESERVED 64          /* Room for the Content-Length header */
+#define OUTPUT_STREAMED (256*1024)  /* Size from which a flushed response
+                                       is sent without waiting for the end */
+
+typedef struct
+{
+  FCGX_Stream *stream;  /* FastCGI output stream of the request, or NULL
+                           to keep the response in memory */
+  int direct;           /* 1 once the response goes to stream as written */
+  char *buffer;         /* Response not sent yet */
+  unsigned long reserved;    /* Bytes left free at the start of buffer */
+  unsigned long length;
+  unsigned long size;
+  int fd;                    /* File sent after the buffer, or -1 */
+  unsigned long file_length;
+} output_stream;
+
+void output_init(output_stream *, FCGX_Stream *);
+
+void output_reset(output_stream *, FCGX_Stream *);
+
+void output_finish(output_stream *);
+
+void output_buffer(output_stream *, void *, unsigned);
+
+void output_printf(output_stream *, const char *, ...);
+
+void output_file(output_stream *, int, unsigned long);
+
+void output_flush(output_stream *);
+
+void http_date(time_t, char *);
+
+int http_parse_date(char *, time_t *);
+
+#endif
 
 /******************************************************************************/
@@ -31,6 +31,8 @@
 #include "ogr_srs_api.h"
 #include "cpl_minixml.h"
 #include "cpl_string.h"
+#include "cpl_multiproc.h"
+#include "cpl_worker_thread_pool.h"
 #include "png.h"
 
 CPL_C_START
@@ -38,8 +40,28 @@ void	GDALRegister_GQT(void);
 CPL_C_END
 
 #define BICUBIC_TABLE 100000
+#define MAX_DECODE_THREADS 16  /* Threads decoding the tiles of a request */
+#define MIN_DECODE_TILES 4     /* Fewer tiles are decoded by the caller */
 
 double *r_buffer;
+
+class GQTRasterBand;
+
+/* Tiles of an IRasterIO() request, decoded by several threads that take
+   them in order */
+
+typedef struct
+{
+    GQTRasterBand *poBand;
+    unsigned char *tiles;
+    long numtilesx, numtilesy;
+    int num_tiles;
+    char (*filetile)[1024];
+    long *col, *row;
+    int next;              /* Next tile to decode */
+    int num_read_tiles;
+    void *hMutex;
+} GQTTileBatch;
 
 /************************************************************************/
 /* ==================================================================== */
@@ -61,9 +83,11 @@ class GQTDataset : public GDALPamDataset
     char path[1024];
     OGRSpatialReferenceH srs;
     char srs_wkt[4096];
+    CPLWorkerThreadPool *poPool;  /* Tile decoding threads, made on demand */
 
   public:
 
+    GQTDataset();
     ~GQTDataset();
            
     static GDALDataset *Open(GDALOpenInfo *);
@@ -101,6 +125,8 @@ class GQTRasterBand : public GDALPamRasterBand
     int readtile(char *, unsigned char *,
                                 unsigned, unsigned, unsigned, unsigned);
 
+    static void DecodeTiles( void * );
+
     CPLErr xy2filetile(double, double, unsigned, char *);
 
     CPLErr resample(
@@ -598,6 +624,38 @@ CPLErr GQTRasterBand::resample(unsigned char *image_src,
   return CE_None;
 }
 
+/************************************************************************/
+/*                            DecodeTiles()                             */
+/************************************************************************/
+
+void GQTRasterBand::DecodeTiles( void *pArg )
+{
+  GQTTileBatch *psBatch = (GQTTileBatch *) pArg;
+  int k, num_read_tiles;
+
+  num_read_tiles=0;
+
+  while (TRUE)
+  {
+    CPLAcquireMutex(psBatch->hMutex, 1000.0);
+    k=psBatch->next++;
+    CPLReleaseMutex(psBatch->hMutex);
+
+    if (k>=psBatch->num_tiles) break;
+
+    num_read_tiles+=psBatch->poBand->readtile(psBatch->filetile[k],
+                                              psBatch->tiles,
+                                              psBatch->numtilesx,
+                                              psBatch->numtilesy,
+                                              psBatch->col[k],
+                                              psBatch->row[k]);
+  }
+
+  CPLAcquireMutex(psBatch->hMutex, 1000.0);
+  psBatch->num_read_tiles+=num_read_tiles;
+  CPLReleaseMutex(psBatch->hMutex);
+}
+
 /************************************************************************/
 /*                             IRasterIO()                              */
 /************************************************************************/
@@ -625,6 +683,8 @@ CPLErr GQTRasterBand::IRasterIO( GDALRWFlag eRWFlag,
     double tile_width, tile_height;
     long tile_width_px, tile_height_px;
     int num_read_tiles;
+    GQTTileBatch sBatch;
+    int nThreads, nPoolThreads, t;
 
     /* pixel_width, pixel_height: size of the desired pixel in world units */
 
@@ -716,12 +776,30 @@ CPLErr GQTRasterBand::IRasterIO( GDALRWFlag eRWFlag,
     for (l=0; (l<(long)tile_width_px*(long)tile_height_px*4L); )
     { tiles[l++]=0; tiles[l++]=0; tiles[l++]=0; tiles[l++]=0; }
 
-    /* tiles loading */
+    /* tiles loading: the files are listed first, and then decoded by
+       several threads, each tile straight into its place */
+
+    sBatch.poBand=this;
+    sBatch.tiles=tiles;
+    sBatch.numtilesx=numtilesx;
+    sBatch.numtilesy=numtilesy;
+    sBatch.num_tiles=0;
+    sBatch.next=0;
+    sBatch.num_read_tiles=0;
+
+    sBatch.filetile=(char (*)[1024])malloc(numtilesx*numtilesy*1024);
+    sBatch.col=(long *)malloc(numtilesx*numtilesy*sizeof(long));
+    sBatch.row=(long *)malloc(numtilesx*numtilesy*sizeof(long));
+    if ((sBatch.filetile==NULL)||(sBatch.col==NULL)||(sBatch.row==NULL))
+    {
+           CPLError( CE_Failure, CPLE_AppDefined, "malloc" );
+           free(sBatch.filetile); free(sBatch.col); free(sBatch.row);
+           free(tiles);
+           return( CE_Failure );
+    }
 
     y=t_min_y+tile_height/2;
 
-    num_read_tiles=0;
-
     for (j=0; (j<numtilesy); j++)
     {
       x=t_min_x+tile_width/2;
@@ -735,7 +813,10 @@ CPLErr GQTRasterBand::IRasterIO( GDALRWFlag eRWFlag,
           strcat(filetile, "/");
           strcat(filetile, poGQTDS->name);
 
-          num_read_tiles+=readtile(filetile, tiles, numtilesx, numtilesy, i, j);
+          strcpy(sBatch.filetile[sBatch.num_tiles], filetile);
+          sBatch.col[sBatch.num_tiles]=i;
+          sBatch.row[sBatch.num_tiles]=j;
+          sBatch.num_tiles++;
         }
 
         x+=tile_width;
@@ -744,6 +825,49 @@ CPLErr GQTRasterBand::IRasterIO( GDALRWFlag eRWFlag,
       y+=tile_height;
     }
 
+    nThreads=CPLGetNumCPUs();
+    if (nThreads>MAX_DECODE_THREADS) nThreads=MAX_DECODE_THREADS;
+    if (sBatch.num_tiles<MIN_DECODE_TILES) nThreads=1;
+    if (nThreads>sBatch.num_tiles) nThreads=sBatch.num_tiles;
+
+    /* The threads are started by the first request that needs them, and
+       kept with the dataset for the following ones */
+
+    if ((nThreads>1)&&(poGQTDS->poPool==NULL))
+    {
+      nPoolThreads=CPLGetNumCPUs();
+      if (nPoolThreads>MAX_DECODE_THREADS) nPoolThreads=MAX_DECODE_THREADS;
+
+      poGQTDS->poPool=new CPLWorkerThreadPool();
+      if (!poGQTDS->poPool->Setup(nPoolThreads-1, NULL, NULL))
+      {
+        delete poGQTDS->poPool;
+        poGQTDS->poPool=NULL;
+      }
+    }
+
+    if (poGQTDS->poPool==NULL) nThreads=1;
+
+    sBatch.hMutex=CPLCreateMutex();
+    CPLReleaseMutex(sBatch.hMutex);
+
+    /* The calling thread decodes tiles as well */
+
+    for (t=1; (t<nThreads); t++)
+      poGQTDS->poPool->SubmitJob(DecodeTiles, &sBatch);
+
+    DecodeTiles(&sBatch);
+
+    if (nThreads>1) poGQTDS->poPool->WaitCompletion();
+
+    CPLDestroyMutex(sBatch.hMutex);
+
+    num_read_tiles=sBatch.num_read_tiles;
+
+    free(sBatch.filetile);
+    free(sBatch.col);
+    free(sBatch.row);
+
     if (num_read_tiles>0)
     {
       resample(tiles, tile_width_px, tile_height_px,
@@ -779,12 +903,22 @@ GDALColorInterp GQTRasterBand::GetColorInterpretation()
 /* ==================================================================== */
 /************************************************************************/
 
+/************************************************************************/
+/*                             GQTDataset()                             */
+/************************************************************************/
+
+GQTDataset::GQTDataset()
+{
+    poPool=NULL;
+}
+
 /************************************************************************/
 /*                            ~GQTDataset()                     	*/
 /************************************************************************/
 
 GQTDataset::~GQTDataset()
 {
+    delete poPool;
 }
 
 /************************************************************************/
@@ -27,7 +27,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <wand/magick-wand.h>
 #include <gdal.h>
 #include <gdal_version.h>
@@ -42,6 +44,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "tiff.h"
 #include "proj.h"
 #include "resample.h"
+#include "pool.h"
 
 /******************************************************************************/
 
@@ -53,6 +56,20 @@ struct string
 
 struct string *tiles;
 
+struct sample
+{
+  char *path;            /* Tile file */
+  unsigned char *data;   /* Its encoded content */
+  unsigned long length;
+  struct sample *next;
+};
+
+FILE *journal=NULL;                  /* Change journal of an import */
+unsigned long journal_generation;
+
+hash_table *journals=NULL;  /* gqt_journal opened, indexed by path */
+pthread_mutex_t journals_mutex=PTHREAD_MUTEX_INITIALIZER;
+
 extern int verbose_level;
 
 /******************************************************************************/
@@ -245,6 +262,60 @@ int xy2filetile(gqt *g, double x, double y, unsigned level, char *filetile)
 
 /******************************************************************************/
 
+int gqt_tile_path(gqt *g, int z, long x, long y, char *path)
+{
+  /* Writes the file of a tile of the native grid of a tree, as addressed
+     by WMTS. z goes from 0, the root tile, to levels, the finest one, and
+     y grows southwards from the top row. Returns 1 if the tile is out of
+     the grid */
+
+  int d;
+
+  if ((z<0)||(z>g->levels)) return 1;
+  if ((x<0)||(x>=(1L<<z))) return 1;
+  if ((y<0)||(y>=(1L<<z))) return 1;
+
+  strcpy(path, g->path);
+
+  for (d=z-1; (d>=0); d--)
+  {
+    if (((y>>d)&1)==0)
+      strcat(path, (((x>>d)&1)==0)?"/1":"/2");
+    else
+      strcat(path, (((x>>d)&1)==0)?"/4":"/3");
+  }
+
+  strcat(path, "/");
+  strcat(path, g->name);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void gqt_tile_bbox(gqt *g, int z, long x, long y, image *im)
+{
+  /* Sets the size and the extent of a tile of the native grid */
+
+  double xmax, ymax, sizex, sizey;
+
+  xmax=g->resx*g->tilesizex*(1<<(g->levels-1));
+  ymax=g->resy*g->tilesizey*(1<<(g->levels-1));
+
+  sizex=2*xmax/(1L<<z);
+  sizey=2*ymax/(1L<<z);
+
+  im->width=g->tilesizex;
+  im->height=g->tilesizey;
+
+  im->minx=-xmax+x*sizex;
+  im->maxx=im->minx+sizex;
+  im->maxy=ymax-y*sizey;
+  im->miny=im->maxy-sizey;
+}
+
+/******************************************************************************/
+
 void extract(image *im, image *tile)
 {
   long i, j;
@@ -428,9 +499,9 @@ void write_image(image *im, srs *p_srs, char *filename)
   while ((ext>=filename)&&(*ext!='.')) ext--;
 
   if       (strcasecmp(ext, ".png")==0)
-  { write_png(im, filename); return; }
+  { write_png(im, filename, NULL); return; }
   else if ((strcasecmp(ext, ".jpg")==0)||(strcasecmp(ext, ".jpeg")==0))
-  { write_jpg(im, filename); return; }
+  { write_jpg(im, filename, NULL); return; }
   else if ((strcasecmp(ext, ".tif")==0)||(strcasecmp(ext, ".tiff")==0))
   {
     write_tiff(im, filename); return;
@@ -487,6 +558,349 @@ void write_image(image *im, srs *p_srs, char *filename)
 
 /******************************************************************************/
 
+tile_cache *tile_cache_new(void)
+{
+  tile_cache *c;
+
+  c=malloc(sizeof(tile_cache));
+  if (c==NULL) { fprintf(stderr, "tile_cache_new: malloc\n"); exit(1); }
+
+  c->index=hash_new(256);
+  c->tile_list=NULL;
+  c->generation=0;
+
+  pthread_mutex_init(&(c->mutex), NULL);
+
+  return c;
+}
+
+/******************************************************************************/
+
+void tile_cache_next(tile_cache *c)
+{
+  /* Starts a new strip of the image. The tiles that the previous strip
+     did not use are dropped, since the strips go down the image */
+
+  cached_tile *t, **p;
+
+  c->generation++;
+
+  p=&(c->tile_list);
+  while (*p!=NULL)
+  {
+    t=*p;
+
+    if (t->generation+1<c->generation)
+    {
+      *p=(cached_tile *)t->next;
+      hash_remove(c->index, t->path);
+      free(t->path);
+      pool_free(t->buffer);
+      free(t);
+    }
+    else
+      p=(cached_tile **)&(t->next);
+  }
+}
+
+/******************************************************************************/
+
+void tile_cache_free(tile_cache *c)
+{
+  cached_tile *t, *next;
+
+  for (t=c->tile_list; (t!=NULL); t=next)
+  {
+    next=(cached_tile *)t->next;
+    free(t->path);
+    pool_free(t->buffer);
+    free(t);
+  }
+
+  hash_free(c->index);
+  pthread_mutex_destroy(&(c->mutex));
+  free(c);
+}
+
+/******************************************************************************/
+
+void mosaic_tile(gqt *g, unsigned char *tiles, unsigned numtilesx,
+                 unsigned numtilesy, unsigned col, unsigned row,
+                 unsigned char *tile, int to_mosaic)
+{
+  /* Copies a decoded tile into its place of a mosaic, or out of it */
+
+  unsigned y;
+  unsigned long stride, size;
+
+  stride=(unsigned long)numtilesx*g->tilesizex*4;
+  size=(unsigned long)g->tilesizex*4;
+
+  tiles+=stride*(numtilesy-row-1)*g->tilesizey+col*size;
+
+  for (y=0; (y<g->tilesizey); y++)
+  {
+    if (to_mosaic==1) memcpy(tiles+y*stride, tile+y*size, size);
+    else memcpy(tile+y*size, tiles+y*stride, size);
+  }
+}
+
+/******************************************************************************/
+
+void cache_tile(tile_cache *c, gqt *g, tile_read *read, unsigned char *tiles,
+                unsigned numtilesx, unsigned numtilesy)
+{
+  /* Keeps a copy of a tile just decoded into a mosaic, or remembers that
+     it has no file when tiles is NULL. Two layers may share a tree, so
+     a tile may have been cached meanwhile by another raster */
+
+  cached_tile *t;
+
+  if (hash_get(c->index, read->path)!=NULL) return;
+
+  t=malloc(sizeof(cached_tile));
+  if (t==NULL) { fprintf(stderr, "cache_tile: malloc\n"); exit(1); }
+
+  t->path=malloc(strlen(read->path)+1);
+  if (t->path==NULL) { fprintf(stderr, "cache_tile: malloc\n"); exit(1); }
+  strcpy(t->path, read->path);
+
+  t->buffer=NULL;
+
+  if (tiles!=NULL)
+  {
+    t->buffer=pool_alloc((unsigned long)g->tilesizex*g->tilesizey*4);
+
+    mosaic_tile(g, tiles, numtilesx, numtilesy, read->col, read->row,
+                t->buffer, 0);
+  }
+
+  t->generation=c->generation;
+  t->next=(struct cached_tile *)c->tile_list;
+  c->tile_list=t;
+
+  hash_put(c->index, t->path, t);
+}
+
+/******************************************************************************/
+
+void decode_tile(void *arg)
+{
+  /* Job decoding a tile into its place of the mosaic */
+
+  tile_read *read=(tile_read *)arg;
+  tile_mosaic *m=read->mosaic;
+
+  if (verbose_level>1)
+    fprintf(stderr, "readtile %s i=%u j=%u\n",
+            read->path, read->col, read->row);
+
+  read->decoded=readtile_fd(m->g, read->fd, m->tiles, m->numtilesx,
+                            m->numtilesy, read->col, read->row);
+}
+
+/******************************************************************************/
+
+int read_tiles(gqt *g, tile_read *reads, int num_reads, unsigned char *tiles,
+               unsigned numtilesx, unsigned numtilesy, tile_cache *c)
+{
+  /* Reads a batch of tiles into a mosaic in two phases. First all the
+     files are opened and the kernel is asked to start reading them, so that
+     the reads are in flight at the same time; then the tiles are decoded
+     by the pool of jobs, each one straight into its place of the mosaic.
+     With a cache, the tiles decoded for the previous strip of the image
+     are not read again */
+
+  int first, last, k, n, num_read_tiles;
+  cached_tile *t;
+  tile_mosaic m;
+  job_group group;
+
+  num_read_tiles=0;
+
+  m.g=g;
+  m.tiles=tiles;
+  m.numtilesx=numtilesx;
+  m.numtilesy=numtilesy;
+
+  if (c!=NULL)
+  {
+    pthread_mutex_lock(&(c->mutex));
+
+    for (k=0, n=0; (k<num_reads); k++)
+    {
+      t=(cached_tile *)hash_get(c->index, reads[k].path);
+
+      if (t==NULL) { reads[n++]=reads[k]; continue; }
+
+      t->generation=c->generation;
+
+      if (t->buffer!=NULL)
+      {
+        mosaic_tile(g, tiles, numtilesx, numtilesy, reads[k].col,
+                    reads[k].row, t->buffer, 1);
+        num_read_tiles++;
+      }
+    }
+
+    num_reads=n;
+
+    pthread_mutex_unlock(&(c->mutex));
+  }
+
+  for (first=0; (first<num_reads); first=last)
+  {
+    last=first+TILE_PREFETCH;
+    if (last>num_reads) last=num_reads;
+
+    for (k=first; (k<last); k++)
+    {
+      reads[k].fd=open(reads[k].path, O_RDONLY);
+      reads[k].mosaic=&m;
+      reads[k].decoded=0;
+
+      if (reads[k].fd>=0)
+        posix_fadvise(reads[k].fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+
+    job_group_init(&group);
+
+    for (k=first; (k<last); k++)
+      if (reads[k].fd>=0)
+        job_submit(&group, &(reads[k].task), decode_tile, &reads[k]);
+
+    job_group_wait(&group);
+
+    /* The cache is only updated by the thread rendering the raster, and
+       shared with the other rasters of the strip */
+
+    if (c!=NULL) pthread_mutex_lock(&(c->mutex));
+
+    for (k=first; (k<last); k++)
+    {
+      if (reads[k].fd<0)
+      {
+        if (c!=NULL) cache_tile(c, g, &reads[k], NULL, numtilesx, numtilesy);
+        continue;
+      }
+
+      if (reads[k].decoded==1)
+      {
+        num_read_tiles++;
+        if (c!=NULL) cache_tile(c, g, &reads[k], tiles, numtilesx, numtilesy);
+      }
+
+      close(reads[k].fd);
+    }
+
+    if (c!=NULL) pthread_mutex_unlock(&(c->mutex));
+  }
+
+  return num_read_tiles;
+}
+
+/******************************************************************************/
+
+void journal_path(gqt *g, char *path)
+{
+  /* The journal of a tree is next to its metadata file */
+
+  int i;
+
+  strncpy(path, (g->metadata==NULL)?"":g->metadata, 1014);
+  path[1014]=0;
+
+  for (i=strlen(path)-1; ((i>=0)&&(path[i]!='.')&&(path[i]!='/')); i--);
+  if ((i>=0)&&(path[i]=='.')) path[i]=0;
+
+  strcat(path, ".journal");
+}
+
+/******************************************************************************/
+
+unsigned long journal_last(char *path)
+{
+  /* Returns the generation of the last line of a journal, or 0 */
+
+  char buffer[JOURNAL_TAIL+1], *line;
+  unsigned long generation;
+  long length;
+  FILE *fp;
+  size_t n;
+
+  fp=fopen(path, "rb");
+  if (fp==NULL) return 0;
+
+  fseek(fp, 0, SEEK_END);
+  length=ftell(fp);
+  fseek(fp, (length>JOURNAL_TAIL)?length-JOURNAL_TAIL:0, SEEK_SET);
+
+  n=fread(buffer, 1, JOURNAL_TAIL, fp);
+  buffer[n]=0;
+  fclose(fp);
+
+  while ((n>0)&&(buffer[n-1]=='\n')) buffer[--n]=0;
+
+  line=strrchr(buffer, '\n');
+  line=(line==NULL)?buffer:line+1;
+
+  generation=0;
+  sscanf(line, "%lu", &generation);
+
+  return generation;
+}
+
+/******************************************************************************/
+
+void journal_begin(gqt *g)
+{
+  /* Starts the generation of the journal written by an import. Each tile
+     written is appended as a line with the generation and its quadkey,
+     the digits of its tile id or 0 for the root, and a last line marks
+     the generation complete with its time */
+
+  char path[1024];
+
+  journal_path(g, path);
+
+  journal_generation=journal_last(path)+1;
+
+  journal=fopen(path, "a");
+  if (journal==NULL) fprintf(stderr, "journal_begin: fopen %s\n", path);
+}
+
+/******************************************************************************/
+
+void journal_tile(char *tileid)
+{
+  char quadkey[512];
+  int i, n;
+
+  if (journal==NULL) return;
+
+  for (i=0, n=0; ((tileid[i]!=0)&&(n<511)); i++)
+    if (tileid[i]!='/') quadkey[n++]=tileid[i];
+
+  if (n==0) quadkey[n++]='0';
+  quadkey[n]=0;
+
+  fprintf(journal, "%lu %s\n", journal_generation, quadkey);
+}
+
+/******************************************************************************/
+
+void journal_end(void)
+{
+  if (journal==NULL) return;
+
+  fprintf(journal, "%lu done %ld\n", journal_generation, (long)time(NULL));
+  fclose(journal);
+
+  journal=NULL;
+}
+
+/******************************************************************************/
+
 void overview(gqt *g, char *tileid, unsigned char *image,
               int filter, float blur)
 {
@@ -494,6 +908,7 @@ void overview(gqt *g, char *tileid, unsigned char *image,
   MagickBooleanType status;  
   int num_read_tiles;
   char tilefile[1024];
+  tile_read reads[4];
   unsigned width, height;
   unsigned long l;
   
@@ -503,21 +918,29 @@ void overview(gqt *g, char *tileid, unsigned char *image,
   for (l=0; (l<(long)width*(long)height*16L); )
   { image[l++]=0; image[l++]=0; image[l++]=0; image[l++]=0; }
   
-  // Load the 4 children tile files into image
+  // Load the 4 children tile files into image, decoded at the same time
   
-  num_read_tiles=0;
-    
-  sprintf(tilefile, "%s%s/4/%s", g->path, tileid, g->name);
-  num_read_tiles+=readtile(g, tilefile, image, 2, 2, 0, 0);
+  sprintf(reads[0].path, "%s%s/4/%s", g->path, tileid, g->name);
+  reads[0].col=0; reads[0].row=0;
+
+  sprintf(reads[1].path, "%s%s/1/%s", g->path, tileid, g->name);
+  reads[1].col=0; reads[1].row=1;
+
+  sprintf(reads[2].path, "%s%s/3/%s", g->path, tileid, g->name);
+  reads[2].col=1; reads[2].row=0;
 
-  sprintf(tilefile, "%s%s/1/%s", g->path, tileid, g->name);
-  num_read_tiles+=readtile(g, tilefile, image, 2, 2, 0, 1);
+  sprintf(reads[3].path, "%s%s/2/%s", g->path, tileid, g->name);
+  reads[3].col=1; reads[3].row=1;
 
-  sprintf(tilefile, "%s%s/3/%s", g->path, tileid, g->name);
-  num_read_tiles+=readtile(g, tilefile, image, 2, 2, 1, 0);
+  num_read_tiles=read_tiles(g, reads, 4, image, 2, 2, NULL);
 
-  sprintf(tilefile, "%s%s/2/%s", g->path, tileid, g->name);
-  num_read_tiles+=readtile(g, tilefile, image, 2, 2, 1, 1);
+  /* Without any child there is nothing to show at this level */
+
+  if (num_read_tiles==0)
+  {
+    if (verbose_level>1) printf("overview: no tiles under %s\n", tileid);
+    return;
+  }
 
   magick_wand=NewMagickWand();
  
@@ -548,6 +971,8 @@ void overview(gqt *g, char *tileid, unsigned char *image,
   status=MagickWriteImage(magick_wand, tilefile);
   if (status==MagickFalse) ThrowWandException(magick_wand);
 
+  journal_tile(tileid);
+
   DestroyMagickWand(magick_wand);
 }
 
@@ -639,7 +1064,7 @@ void write_tile(image *tile, char *filename)
     }
   }
 
-  write_png(im, filename);
+  write_png(im, filename, NULL);
 }
 
 /******************************************************************************/
@@ -799,6 +1224,8 @@ int gqt_import_file(gqt *g, char *filename, int filter, float blur,
   for (l=0; (l<length); l++) tile->buffer[l++]=255;
 
   tiles=NULL;
+
+  journal_begin(g);
   
   y=maxy_tile-tile->height*tile->resy;
 
@@ -834,6 +1261,8 @@ int gqt_import_file(gqt *g, char *filename, int filter, float blur,
         if (verbose_level>1) printf("%3li %3li %s\n", i, j, tilefile);
 
         write_tile(tile, tilefile);
+
+        journal_tile(tileid);
       }
 
       x+=tile->width*tile->resx;
@@ -848,6 +1277,8 @@ int gqt_import_file(gqt *g, char *filename, int filter, float blur,
   printf("Generating overviews...\n");
 
   overviews(g, filter, blur);
+
+  journal_end();
   
   delstrings(tiles);
 
@@ -871,88 +1302,408 @@ int gqt_import_file(gqt *g, char *filename, int filter, float blur,
 
 /******************************************************************************/
 
-int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
+time_t gqt_mtime(gqt *g)
 {
-  double minx, miny, maxx, maxy;
-  int width, height;
-  double minx_g, miny_g, maxx_g, maxy_g;
-  double px[4], py[4];
-  int ret;
-  double pixel_width, pixel_height;
-  unsigned level;
-  double pixel_width_t, pixel_height_t;
-  long minx_t_px, miny_t_px, maxx_t_px, maxy_t_px;
-  double minx_t, miny_t, maxx_t, maxy_t;
-  int numtilesx, numtilesy;
-  double tile_width, tile_height;
-  long tile_width_px, tile_height_px;
-  long l;
-  int i, j;
-  unsigned char *tiles;
-  double x, y;
-  int num_read_tiles;
-  char filetile[1024];
+  /* Returns the time of the last change of the tree, which is the time its
+     metadata file was written, or 0 if it is not known */
 
-  if (g->p_srs==NULL) return 1;
-  if (p_srs==NULL) return 1;
-  
-  minx=im->minx;
-  miny=im->miny;
-  maxx=im->maxx;
-  maxy=im->maxy;
-  
-  if (verbose_level>1)
-    fprintf(stderr, "\tminx=%f miny=%f maxx=%f maxy=%f\n", minx, miny, maxx, maxy);
-  
-  width=im->width;
-  height=im->height;
-  
-  if (p_srs==g->p_srs)
-  {
-    minx_g=minx;
-    miny_g=miny;
-    maxx_g=maxx;
-    maxy_g=maxy;
-  }
-  else
-  {
-    px[0]=minx; py[0]=maxy;
-    px[1]=maxx; py[1]=maxy;
-    px[2]=maxx; py[2]=miny;
-    px[3]=minx; py[3]=miny;
+  struct stat buf;
 
-    ret=proj_transform(p_srs, 4, px, py, g->p_srs);
-	
-    minx_g=px[0]; miny_g=py[0];
-    maxx_g=px[0]; maxy_g=py[0];
+  if ((g->metadata==NULL)||(stat(g->metadata, &buf)!=0)) return 0;
 
-    for (i=1; (i<4); i++)
+  return buf.st_mtime;
+}
+
+/******************************************************************************/
+
+void journal_compact(gqt_journal *j)
+{
+  /* Forgets the times of the changed tiles. The newest one becomes the
+     time of the whole tree, so that the validators of the responses only
+     get newer, and no stale response is taken as valid */
+
+  hash_entry *e;
+  time_t *changed;
+  unsigned i;
+
+  for (i=0; (i<j->tiles->size); i++)
+  {
+    for (e=j->tiles->bucket[i]; (e!=NULL); e=(hash_entry *)e->next)
     {
-      if (px[i]<minx_g) minx_g=px[i];
-      if (py[i]<miny_g) miny_g=py[i];
-      if (px[i]>maxx_g) maxx_g=px[i];
-      if (py[i]>maxy_g) maxy_g=py[i];
+      changed=(time_t *)e->value;
+      if (*changed>j->mtime) j->mtime=*changed;
+      free(changed);
     }
   }
 
-  pixel_width=(maxx_g-minx_g)/width;
-  pixel_height=(maxy_g-miny_g)/height;
+  hash_free(j->tiles);
+  j->tiles=hash_new(1024);
 
   if (verbose_level>1)
-    printf("\tpixel_width=%f pixel_height=%f\n", pixel_width, pixel_height);
-  
-  pyramid_level(g, pixel_width, pixel_height, &level, &pixel_width_t, &pixel_height_t);
+    printf("journal_compact %s mtime %ld\n", j->path, (long)j->mtime);
+}
 
-  if (verbose_level>1)
-    printf("\tpixel_width_g=%f pixel_height_g=%f\n",
-           pixel_width_t, pixel_height_t);
+/******************************************************************************/
 
-  minx_t_px=(long)(minx_g/pixel_width_t);
-  miny_t_px=(long)(miny_g/pixel_height_t);
-  maxx_t_px=(long)(maxx_g/pixel_width_t);
-  maxy_t_px=(long)(maxy_g/pixel_height_t);
+int journal_read(gqt_journal *j, int record)
+{
+  /* Reads the generations completed since the last read, recording the
+     time of the tiles they changed if record is 1. Returns the number of
+     generations read */
 
-  if (verbose_level>1)
+  char *buffer, *line, *next, *first, quadkey[512], tileid[1024];
+  unsigned long generation, length, done;
+  long t;
+  struct stat buf;
+  time_t *changed;
+  ssize_t n;
+  int fd, num, i, k;
+
+  if ((stat(j->path, &buf)!=0)||(buf.st_size<=j->offset)) return 0;
+
+  fd=open(j->path, O_RDONLY);
+  if (fd<0) return 0;
+
+  j->exists=1;
+
+  length=buf.st_size-j->offset;
+  buffer=malloc(length+1);
+  if (buffer==NULL) { fprintf(stderr, "journal_read: malloc\n"); exit(1); }
+
+  for (done=0; (done<length); done+=n)
+  {
+    n=pread(fd, buffer+done, length-done, j->offset+done);
+    if (n<=0) break;
+  }
+
+  close(fd);
+
+  buffer[done]=0;
+  length=done;
+
+  /* The lines of a generation are applied once its last line is read */
+
+  num=0;
+  first=buffer;
+
+  for (line=buffer; ((next=strchr(line, '\n'))!=NULL); line=next+1)
+  {
+    if (sscanf(line, "%lu done %ld", &generation, &t)!=2) continue;
+
+    for (; (first<line); first=strchr(first, '\n')+1)
+    {
+      if ((record==0)||(sscanf(first, "%*u %511s", quadkey)!=1)) continue;
+
+      tileid[0]=0;
+
+      for (i=0, k=0; ((quadkey[i]!=0)&&(k<1020)); i++)
+      {
+        if (quadkey[i]=='0') continue;
+        tileid[k++]='/';
+        tileid[k++]=quadkey[i];
+      }
+
+      tileid[k]=0;
+
+      changed=(time_t *)hash_get(j->tiles, tileid);
+
+      if (changed==NULL)
+      {
+        changed=malloc(sizeof(time_t));
+        if (changed==NULL) { fprintf(stderr, "journal_read: malloc\n"); exit(1); }
+
+        hash_put(j->tiles, tileid, changed);
+      }
+
+      *changed=(time_t)t;
+    }
+
+    first=next+1;
+
+    j->generation=generation;
+    num++;
+  }
+
+  /* What follows the last complete generation is read again next time */
+
+  j->offset+=first-buffer;
+
+  free(buffer);
+
+  if (j->tiles->count>JOURNAL_TILES) journal_compact(j);
+
+  return num;
+}
+
+/******************************************************************************/
+
+gqt_journal *gqt_journal_open(gqt *g)
+{
+  /* Opens the change journal of a tree to follow the imports done from now
+     on. The changes already in it are skipped. A journal is opened once,
+     and shared by the configurations that are reloaded later, so that the
+     changes they follow start at the same time */
+
+  gqt_journal *j;
+  char path[1024];
+
+  journal_path(g, path);
+
+  pthread_mutex_lock(&journals_mutex);
+
+  if (journals==NULL) journals=hash_new(64);
+
+  j=(gqt_journal *)hash_get(journals, path);
+  if (j!=NULL) { pthread_mutex_unlock(&journals_mutex); return j; }
+
+  j=malloc(sizeof(gqt_journal));
+  if (j==NULL) { fprintf(stderr, "gqt_journal_open: malloc\n"); exit(1); }
+
+  j->path=malloc(strlen(path)+1);
+  if (j->path==NULL) { fprintf(stderr, "gqt_journal_open: malloc\n"); exit(1); }
+  strcpy(j->path, path);
+
+  j->exists=0;
+  j->offset=0;
+  j->generation=0;
+  j->tiles=hash_new(1024);
+  j->mtime=gqt_mtime(g);
+
+  pthread_mutex_init(&(j->mutex), NULL);
+
+  journal_read(j, 0);
+
+  hash_put(journals, path, j);
+
+  pthread_mutex_unlock(&journals_mutex);
+
+  return j;
+}
+
+/******************************************************************************/
+
+int gqt_journal_update(gqt_journal *j)
+{
+  /* Reads the imports completed since the last call. Returns 1 if there
+     were any */
+
+  int num;
+
+  pthread_mutex_lock(&(j->mutex));
+  num=journal_read(j, 1);
+  pthread_mutex_unlock(&(j->mutex));
+
+  if ((num>0)&&(verbose_level>1))
+    printf("gqt_journal_update %s generation %lu\n", j->path, j->generation);
+
+  return (num>0);
+}
+
+/******************************************************************************/
+
+time_t gqt_changed(gqt *g, gqt_journal *j, image *im, srs *p_srs)
+{
+  /* Returns the last time an import followed by j changed one of the
+     tiles exporting im would read, or 0 if none was changed */
+
+  double bbox[4], x, y, tile_width, tile_height;
+  char tileid[1024];
+  time_t *changed, last;
+  tile_window w;
+  int i, k;
+
+  last=0;
+
+  pthread_mutex_lock(&(j->mutex));
+
+  if ((j->tiles->count==0)||(gqt_request_bbox(g, im, p_srs, bbox)!=0))
+  { pthread_mutex_unlock(&(j->mutex)); return 0; }
+
+  gqt_window(g, (bbox[2]-bbox[0])/im->width, (bbox[3]-bbox[1])/im->height,
+             bbox, 0, &w);
+
+  tile_width=w.pixel_width*g->tilesizex;
+  tile_height=w.pixel_height*g->tilesizey;
+
+  y=w.miny+tile_height/2;
+
+  for (k=0; (k<w.numtilesy); k++)
+  {
+    x=w.minx+tile_width/2;
+
+    for (i=0; (i<w.numtilesx); i++)
+    {
+      tileid[0]=0;
+
+      if (xy2filetile(g, x, y, w.level, tileid)==1)
+      {
+        changed=(time_t *)hash_get(j->tiles, tileid);
+        if ((changed!=NULL)&&(*changed>last)) last=*changed;
+      }
+
+      x+=tile_width;
+    }
+
+    y+=tile_height;
+  }
+
+  pthread_mutex_unlock(&(j->mutex));
+
+  return last;
+}
+
+/******************************************************************************/
+
+int gqt_request_bbox(gqt *g, image *im, srs *p_srs, double *bbox)
+{
+  /* Bounding box of the requested image (bounding box given in p_srs),
+     expressed in the SRS of the GeoQuadTree image */
+
+  double px[4], py[4];
+  int i;
+
+  if (p_srs==g->p_srs)
+  {
+    bbox[0]=im->minx;
+    bbox[1]=im->miny;
+    bbox[2]=im->maxx;
+    bbox[3]=im->maxy;
+
+    return 0;
+  }
+
+  px[0]=im->minx; py[0]=im->maxy;
+  px[1]=im->maxx; py[1]=im->maxy;
+  px[2]=im->maxx; py[2]=im->miny;
+  px[3]=im->minx; py[3]=im->miny;
+
+  if (proj_transform(p_srs, 4, px, py, g->p_srs)!=0) return 1;
+
+  bbox[0]=px[0]; bbox[1]=py[0];
+  bbox[2]=px[0]; bbox[3]=py[0];
+
+  for (i=1; (i<4); i++)
+  {
+    if (px[i]<bbox[0]) bbox[0]=px[i];
+    if (py[i]<bbox[1]) bbox[1]=py[i];
+    if (px[i]>bbox[2]) bbox[2]=px[i];
+    if (py[i]>bbox[3]) bbox[3]=py[i];
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int gqt_footprint(gqt *g, srs *p_srs, double *bbox)
+{
+  /* Bounding box of the GeoQuadTree image expressed in p_srs. The edges are
+     densified, so that the curvature introduced by the transformation is
+     taken into account */
+
+  double px[FOOTPRINT_SAMPLES*4], py[FOOTPRINT_SAMPLES*4];
+  double dx, dy, mx, my;
+  int i;
+
+  if (g->bounding_box==0) return 1;
+
+  dx=(g->maxx-g->minx)/FOOTPRINT_SAMPLES;
+  dy=(g->maxy-g->miny)/FOOTPRINT_SAMPLES;
+
+  for (i=0; (i<FOOTPRINT_SAMPLES); i++)
+  {
+    px[i]=g->minx+i*dx;                        py[i]=g->maxy;
+    px[i+FOOTPRINT_SAMPLES]=g->maxx;           py[i+FOOTPRINT_SAMPLES]=g->maxy-i*dy;
+    px[i+FOOTPRINT_SAMPLES*2]=g->maxx-i*dx;    py[i+FOOTPRINT_SAMPLES*2]=g->miny;
+    px[i+FOOTPRINT_SAMPLES*3]=g->minx;         py[i+FOOTPRINT_SAMPLES*3]=g->miny+i*dy;
+  }
+
+  if (p_srs!=g->p_srs)
+    if (proj_transform(g->p_srs, FOOTPRINT_SAMPLES*4, px, py, p_srs)!=0) return 1;
+
+  bbox[0]=px[0]; bbox[1]=py[0];
+  bbox[2]=px[0]; bbox[3]=py[0];
+
+  for (i=1; (i<FOOTPRINT_SAMPLES*4); i++)
+  {
+    if (px[i]<bbox[0]) bbox[0]=px[i];
+    if (py[i]<bbox[1]) bbox[1]=py[i];
+    if (px[i]>bbox[2]) bbox[2]=px[i];
+    if (py[i]>bbox[3]) bbox[3]=py[i];
+  }
+
+  /* A small margin covers what the densification may have missed */
+
+  mx=(bbox[2]-bbox[0])/100;
+  my=(bbox[3]-bbox[1])/100;
+
+  bbox[0]-=mx; bbox[1]-=my;
+  bbox[2]+=mx; bbox[3]+=my;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int gqt_resolution(gqt *g, image *im, srs *p_srs, double *resx, double *resy)
+{
+  /* Ground resolution of the requested image, in units of the SRS of the
+     GeoQuadTree image */
+
+  double bbox[4];
+
+  if (gqt_request_bbox(g, im, p_srs, bbox)!=0) return 1;
+
+  *resx=(bbox[2]-bbox[0])/im->width;
+  *resy=(bbox[3]-bbox[1])/im->height;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void gqt_window(gqt *g, double pixel_width, double pixel_height,
+                double *bbox, unsigned coarsen, tile_window *w)
+{
+  /* Finds the level of the pyramid read for pixels of the given size, or
+     coarsen levels above it, and the tiles of that level that cover bbox,
+     given in the SRS of the tree */
+
+  unsigned i;
+
+  long minx_t_px, miny_t_px, maxx_t_px, maxy_t_px;
+  double minx_g, miny_g, maxx_g, maxy_g;
+
+  minx_g=bbox[0];
+  miny_g=bbox[1];
+  maxx_g=bbox[2];
+  maxy_g=bbox[3];
+
+  if (verbose_level>1)
+    printf("\tpixel_width=%f pixel_height=%f\n", pixel_width, pixel_height);
+  
+  pyramid_level(g, pixel_width, pixel_height, &(w->level),
+                &(w->pixel_width), &(w->pixel_height));
+
+  /* The root of the tree, a single tile, is the coarsest level */
+
+  for (i=0; ((i<coarsen)&&(w->level<g->levels)); i++)
+  {
+    w->level++;
+    w->pixel_width*=2;
+    w->pixel_height*=2;
+  }
+
+  if (verbose_level>1)
+    printf("\tpixel_width_g=%f pixel_height_g=%f\n",
+           w->pixel_width, w->pixel_height);
+
+  minx_t_px=(long)(minx_g/w->pixel_width);
+  miny_t_px=(long)(miny_g/w->pixel_height);
+  maxx_t_px=(long)(maxx_g/w->pixel_width);
+  maxy_t_px=(long)(maxy_g/w->pixel_height);
+
+  if (verbose_level>1)
     printf("minx_t_px=%li miny_t_px=%li maxx_t_px=%li maxy_t_px=%li\n",
            minx_t_px, miny_t_px, maxx_t_px, maxy_t_px);
 		 
@@ -970,20 +1721,155 @@ int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
     printf("\tminx_t_px=%li miny_t_px=%li maxx_t_px=%li maxy_t_px=%li\n",
            minx_t_px, miny_t_px, maxx_t_px, maxy_t_px);
 
-  minx_t=pixel_width_t*(double)minx_t_px;
-  miny_t=pixel_height_t*(double)miny_t_px;
-  maxx_t=pixel_width_t*(double)maxx_t_px;
-  maxy_t=pixel_height_t*(double)maxy_t_px;
+  w->minx=w->pixel_width*(double)minx_t_px;
+  w->miny=w->pixel_height*(double)miny_t_px;
+  w->maxx=w->pixel_width*(double)maxx_t_px;
+  w->maxy=w->pixel_height*(double)maxy_t_px;
 
   if (verbose_level>1)
     printf("\tminx_t=%0.9f miny_t=%0.9f maxx_t=%0.9f maxy_t=%0.9f\n",
-           minx_t, miny_t, maxx_t, maxy_t);
+           w->minx, w->miny, w->maxx, w->maxy);
 
-  numtilesx=(maxx_t-minx_t)/(double)g->tilesizex/pixel_width_t+0.5;
-  numtilesy=(maxy_t-miny_t)/(double)g->tilesizey/pixel_height_t+0.5;
+  w->numtilesx=(w->maxx-w->minx)/(double)g->tilesizex/w->pixel_width+0.5;
+  w->numtilesy=(w->maxy-w->miny)/(double)g->tilesizey/w->pixel_height+0.5;
 
   if (verbose_level>1)
-  printf("\tnumtilesx=%i numtilesy=%i\n", numtilesx, numtilesy);
+  printf("\tnumtilesx=%i numtilesy=%i\n", w->numtilesx, w->numtilesy);
+}
+
+/******************************************************************************/
+
+int gqt_estimate(gqt *g, image *im, srs *p_srs, unsigned coarsen,
+                 export_cost *cost)
+{
+  /* Adds to cost what exporting im would read, without reading anything.
+     Only the tiles of the window inside the extent of the tree and, when
+     it is known, its bounding box are read, but the mosaic of the whole
+     window is allocated as gqt_export does */
+
+  double bbox[4], x, y, tile_width, tile_height, extentx, extenty;
+  unsigned long nx, ny;
+  tile_window w;
+  int i;
+
+  if ((g->p_srs==NULL)||(p_srs==NULL)) return 1;
+
+  if (gqt_request_bbox(g, im, p_srs, bbox)!=0) return 1;
+
+  gqt_window(g, (bbox[2]-bbox[0])/im->width, (bbox[3]-bbox[1])/im->height,
+             bbox, coarsen, &w);
+
+  tile_width=w.pixel_width*g->tilesizex;
+  tile_height=w.pixel_height*g->tilesizey;
+
+  extentx=g->resx*g->tilesizex*(1<<(g->levels-1));
+  extenty=g->resy*g->tilesizey*(1<<(g->levels-1));
+
+  for (nx=0, i=0; (i<w.numtilesx); i++)
+  {
+    x=w.minx+i*tile_width;
+
+    if ((x+tile_width/2<-extentx)||(x+tile_width/2>extentx)) continue;
+    if ((g->bounding_box==1)&&((x+tile_width<=g->minx)||(x>=g->maxx))) continue;
+
+    nx++;
+  }
+
+  for (ny=0, i=0; (i<w.numtilesy); i++)
+  {
+    y=w.miny+i*tile_height;
+
+    if ((y+tile_height/2<-extenty)||(y+tile_height/2>extenty)) continue;
+    if ((g->bounding_box==1)&&((y+tile_height<=g->miny)||(y>=g->maxy))) continue;
+
+    ny++;
+  }
+
+  cost->tiles+=nx*ny;
+  cost->bytes+=pool_size((unsigned long)w.numtilesx*w.numtilesy*
+                         g->tilesizex*g->tilesizey*4);
+  cost->pixels+=im->width*im->height;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int gqt_export(gqt *g, image *im, srs *p_srs, int filter, unsigned coarsen,
+               coverage *cov, tile_cache *c, int under)
+{
+  /* Resamples the tree into im. With under, im holds the rasters already
+     composited (premultiplied) and the tree is put under them */
+
+  double minx, miny, maxx, maxy;
+  int width, height;
+  double bbox_g[4];
+  long window[4];
+  image sub;
+  double pixel_width, pixel_height;
+  unsigned level;
+  double pixel_width_t, pixel_height_t;
+  double minx_t, miny_t, maxx_t, maxy_t;
+  int numtilesx, numtilesy;
+  double tile_width, tile_height;
+  long tile_width_px, tile_height_px;
+  long l;
+  int i, j;
+  unsigned char *tiles;
+  double x, y;
+  int num_read_tiles;
+  tile_read *reads;
+  int num_reads;
+  tile_window w;
+  arena_mark mark;
+
+  if (g->p_srs==NULL) return 1;
+  if (p_srs==NULL) return 1;
+  
+  minx=im->minx;
+  miny=im->miny;
+  maxx=im->maxx;
+  maxy=im->maxy;
+  
+  if (verbose_level>1)
+    fprintf(stderr, "\tminx=%f miny=%f maxx=%f maxy=%f\n", minx, miny, maxx, maxy);
+  
+  width=im->width;
+  height=im->height;
+
+  if (gqt_request_bbox(g, im, p_srs, bbox_g)!=0) return 1;
+
+  pixel_width=(bbox_g[2]-bbox_g[0])/width;
+  pixel_height=(bbox_g[3]-bbox_g[1])/height;
+
+  /* When part of the image is already opaque, only the tiles under the
+     window that is still visible are read */
+
+  if ((cov!=NULL)&&(coverage_window(cov, window)==0)&&
+      ((window[0]>0)||(window[1]>0)||
+       (window[2]<width-1)||(window[3]<height-1)))
+  {
+    sub.width=window[2]-window[0]+1;
+    sub.height=window[3]-window[1]+1;
+    sub.minx=minx+window[0]*(maxx-minx)/width;
+    sub.maxx=minx+(window[2]+1)*(maxx-minx)/width;
+    sub.maxy=maxy-window[1]*(maxy-miny)/height;
+    sub.miny=maxy-(window[3]+1)*(maxy-miny)/height;
+
+    if (gqt_request_bbox(g, &sub, p_srs, bbox_g)!=0) return 1;
+  }
+
+  gqt_window(g, pixel_width, pixel_height, bbox_g, coarsen, &w);
+
+  level=w.level;
+  pixel_width_t=w.pixel_width;
+  pixel_height_t=w.pixel_height;
+  minx_t=w.minx;
+  miny_t=w.miny;
+  maxx_t=w.maxx;
+  maxy_t=w.maxy;
+  numtilesx=w.numtilesx;
+  numtilesy=w.numtilesy;
 
   tile_width=pixel_width_t*g->tilesizex;
   tile_height=pixel_height_t*g->tilesizey;
@@ -1002,15 +1888,19 @@ int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
   if (verbose_level>1)
   printf("malloc %lu\n", l);
 
-  tiles=malloc(l);
-  if (tiles==NULL) { printf("malloc tiles\n"); exit(1); }
+  tiles=pool_alloc(l);
 
   for (l=0; (l<(long)tile_width_px*(long)tile_height_px*4L); )
   { tiles[l++]=0; tiles[l++]=0; tiles[l++]=0; tiles[l++]=0; }
 
-  y=miny_t+tile_height/2;
+  /* The tiles needed are listed first, and then read as a batch */
 
-  num_read_tiles=0;
+  mark=arena_save();
+  reads=arena_alloc((long)numtilesx*(long)numtilesy*sizeof(tile_read));
+
+  num_reads=0;
+
+  y=miny_t+tile_height/2;
 
   for (j=0; (j<numtilesy); j++)
   {
@@ -1018,19 +1908,18 @@ int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
 
     for (i=0; (i<numtilesx); i++)
     {
-      strcpy(filetile, g->path);
-      if (xy2filetile(g, x, y, level, filetile)==1)
+      strcpy(reads[num_reads].path, g->path);
+      if (xy2filetile(g, x, y, level, reads[num_reads].path)==1)
       {
         if (verbose_level>1)
-        printf("\txy2filetile x=%f y=%f level=%i filetile=%s\n", x, y, level, filetile);
-
-        strcat(filetile, "/");
-        strcat(filetile, g->name);
+        printf("\txy2filetile x=%f y=%f level=%i filetile=%s\n", x, y, level, reads[num_reads].path);
 
-        if (verbose_level>1)
-        fprintf(stderr, "readtile %s i=%i j=%i\n", filetile, i, j);
+        strcat(reads[num_reads].path, "/");
+        strcat(reads[num_reads].path, g->name);
 
-        num_read_tiles+=readtile(g, filetile, tiles, numtilesx, numtilesy, i, j);
+        reads[num_reads].col=i;
+        reads[num_reads].row=j;
+        num_reads++;
       }
 
       x+=tile_width;
@@ -1039,6 +1928,11 @@ int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
     y+=tile_height;
   }
 
+  num_read_tiles=read_tiles(g, reads, num_reads, tiles, numtilesx, numtilesy,
+                            c);
+
+  arena_restore(mark);
+
   if (verbose_level>1)
   fprintf(stderr, "num_read_tiles=%i\n", num_read_tiles); 
 
@@ -1056,10 +1950,10 @@ int gqt_export(gqt *g, image *im, srs *p_srs, int filter)
              g->p_srs, minx_t, miny_t, maxx_t, maxy_t,
              im->buffer, width, height,
              p_srs, minx, miny, maxx, maxy,
-             filter);
+             filter, cov, under);
   }
 
-  free(tiles);
+  pool_free(tiles);
   
   return 0;
 }
@@ -1094,7 +1988,7 @@ int gqt_export_file(gqt *g, char *filename, srs *p_srs,
   if (im.buffer==NULL)
   { fprintf(stderr, "gqt_export_file malloc\n"); return 1; }
   
-  gqt_export(g, &im, p_srs, filter);
+  gqt_export(g, &im, p_srs, filter, 0, NULL, NULL, 0);
   
   write_image(&im, p_srs, filename);
   
@@ -1107,3 +2001,137 @@ int gqt_export_file(gqt *g, char *filename, srs *p_srs,
 
 /******************************************************************************/
 
+int sample_tiles(gqt *g, char *dir, int max_tiles, struct sample **list)
+{
+  /* Loads into memory the tile files of the tree under dir, depth first,
+     until max_tiles of them are kept. Returns the number of tiles kept */
+
+  struct sample *s;
+  struct stat buf;
+  char path[1024];
+  int fd, q, n;
+
+  n=0;
+
+  snprintf(path, 1024, "%s/%s", dir, g->name);
+
+  fd=open(path, O_RDONLY);
+  if (fd>=0)
+  {
+    if ((fstat(fd, &buf)==0)&&(buf.st_size>0))
+    {
+      s=malloc(sizeof(struct sample));
+      if (s==NULL) { fprintf(stderr, "sample_tiles: malloc\n"); exit(1); }
+
+      s->path=malloc(strlen(path)+1);
+      s->data=malloc(buf.st_size);
+      if ((s->path==NULL)||(s->data==NULL))
+      { fprintf(stderr, "sample_tiles: malloc\n"); exit(1); }
+
+      strcpy(s->path, path);
+      s->length=read(fd, s->data, buf.st_size);
+
+      s->next=*list;
+      *list=s;
+      n++;
+    }
+
+    close(fd);
+  }
+
+  for (q=1; ((q<=4)&&(n<max_tiles)); q++)
+  {
+    snprintf(path, 1024, "%s/%i", dir, q);
+
+    if ((stat(path, &buf)==0)&&(S_ISDIR(buf.st_mode)))
+      n+=sample_tiles(g, path, max_tiles-n, list);
+  }
+
+  return n;
+}
+
+/******************************************************************************/
+
+double benchmark_seconds(struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return (now.tv_sec-start->tv_sec)+(now.tv_usec-start->tv_usec)/1e6;
+}
+
+/******************************************************************************/
+
+int gqt_benchmark(gqt *g, int max_tiles)
+{
+  /* Measures the tiles decoded per second from a sample of up to
+     max_tiles tiles of the tree: read from their files, which are in the
+     page cache after the first pass, decoded from memory, and decoded from
+     memory without verifying their checksums as in a trusted tree */
+
+  struct sample *list=NULL, *s, *next;
+  struct timeval start;
+  unsigned char *tile;
+  unsigned long count, bytes;
+  double seconds;
+  int num_tiles, pass, ret;
+
+  num_tiles=sample_tiles(g, g->path, max_tiles, &list);
+
+  if (num_tiles==0)
+  { fprintf(stderr, "gqt_benchmark: no tiles in %s\n", g->path); return 1; }
+
+  bytes=0;
+  for (s=list; (s!=NULL); s=s->next) bytes+=s->length;
+
+  printf("  Tiles: %i (%lu bytes encoded)\n", num_tiles, bytes);
+
+  tile=pool_alloc((unsigned long)g->tilesizex*g->tilesizey*4);
+
+  for (pass=0; (pass<3); pass++)
+  {
+    g->trusted=(pass==2);
+
+    count=0;
+    ret=0;
+    gettimeofday(&start, NULL);
+
+    do
+    {
+      for (s=list; (s!=NULL); s=s->next, count++)
+      {
+        if (pass==0) ret+=1-readtile(g, s->path, tile, 1, 1, 0, 0);
+        else ret+=1-readtile_buffer(g, s->data, s->length, tile, 1, 1, 0, 0);
+      }
+
+      seconds=benchmark_seconds(&start);
+    }
+    while (seconds<BENCHMARK_TIME);
+
+    printf("  %s: %.0f tiles/s (%.1f MB/s decoded)",
+           (pass==0)?"From files":
+           (pass==1)?"From memory":"From memory, trusted",
+           count/seconds,
+           count*(double)g->tilesizex*g->tilesizey*4/seconds/1e6);
+
+    if (ret>0) printf(", %i failed", ret);
+    printf("\n");
+  }
+
+  g->trusted=0;
+
+  pool_free(tile);
+
+  for (s=list; (s!=NULL); s=next)
+  {
+    next=s->next;
+    free(s->path);
+    free(s->data);
+    free(s);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
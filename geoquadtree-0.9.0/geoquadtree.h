@@ -26,18 +26,34 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #define __GEOQUADTREE__
 
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
 #include "proj.h"
+#include "composite.h"
+#include "hash.h"
+#include "jobs.h"
+
+#define FOOTPRINT_SAMPLES 8  /* Points per edge used to transform bboxes */
+#define TILE_PREFETCH 64     /* Tile files read ahead at the same time */
+#define JOURNAL_TAIL 4096    /* Bytes read to find the last generation */
+#define JOURNAL_TILES 65536  /* Changed tiles whose time is kept */
+#define BENCHMARK_TIME 2.0   /* Seconds each decoding benchmark runs */
 
 typedef struct
 {
   srs p_srs;
   char *path;
   char *name;
+  char *metadata;  /* XML metadata file, rewritten after every import */
   unsigned levels;
   double resx, resy;
   unsigned tilesizex, tilesizey;
   double minx, miny, maxx, maxy;
   int bounding_box;
+  int trusted;     /* 1 if the checksums of its tiles are not verified */
   struct raster *next;
 } gqt;
 
@@ -50,16 +66,112 @@ typedef struct
   double resx, resy;
 } image;
 
+typedef struct
+{
+  unsigned level;                    /* Level of the pyramid read */
+  double pixel_width, pixel_height;  /* Pixel size of that level */
+  double minx, miny, maxx, maxy;     /* Extent of the tiles read */
+  int numtilesx, numtilesy;
+} tile_window;
+
+typedef struct
+{
+  unsigned long tiles;   /* Tiles read */
+  unsigned long bytes;   /* Of the decoded tiles */
+  unsigned long pixels;  /* Resampled */
+} export_cost;
+
+typedef struct
+{
+  char *path;                /* Change journal of a tree */
+  int exists;                /* 1 once the journal has been found */
+  off_t offset;              /* Bytes of it already read */
+  unsigned long generation;  /* Last complete import read */
+  hash_table *tiles;         /* Time of the last change of each tile id */
+  time_t mtime;              /* Of the tree when the journal was opened,
+                                or of the last change forgotten */
+  pthread_mutex_t mutex;
+} gqt_journal;
+
+typedef struct
+{
+  gqt *g;
+  unsigned char *tiles;  /* Mosaic of numtilesx x numtilesy tiles */
+  unsigned numtilesx, numtilesy;
+} tile_mosaic;
+
+typedef struct
+{
+  char path[1024];     /* Tile file */
+  unsigned col, row;   /* Position of the tile in the mosaic */
+  int fd;
+  tile_mosaic *mosaic;
+  int decoded;         /* 1 once it is in the mosaic */
+  job task;
+} tile_read;
+
+typedef struct
+{
+  char *path;
+  unsigned char *buffer;     /* Decoded tile, or NULL if it has no file */
+  unsigned long generation;  /* Last strip that used it */
+  struct cached_tile *next;
+} cached_tile;
+
+typedef struct
+{
+  hash_table *index;         /* cached_tile indexed by path */
+  cached_tile *tile_list;
+  unsigned long generation;  /* Strip being rendered */
+  pthread_mutex_t mutex;     /* Rasters of a strip render concurrently */
+} tile_cache;
+
 void scanstrs(char *, char **, int);
 void scanfloats(char *, double *, int);
 void scanints(char *, int *, int);
 
 int gqt_import_file(gqt *, char *, int, float, int, int *);
 
-int gqt_export(gqt *, image *, srs *, int);
+tile_cache *tile_cache_new(void);
+
+void tile_cache_next(tile_cache *);
+
+void tile_cache_free(tile_cache *);
+
+int read_tiles(gqt *, tile_read *, int, unsigned char *, unsigned, unsigned,
+               tile_cache *);
+
+int xy2filetile(gqt *, double, double, unsigned, char *);
+
+int gqt_tile_path(gqt *, int, long, long, char *);
+
+void gqt_tile_bbox(gqt *, int, long, long, image *);
+
+time_t gqt_mtime(gqt *);
+
+gqt_journal *gqt_journal_open(gqt *);
+
+int gqt_journal_update(gqt_journal *);
+
+time_t gqt_changed(gqt *, gqt_journal *, image *, srs *);
+
+int gqt_request_bbox(gqt *, image *, srs *, double *);
+
+int gqt_footprint(gqt *, srs *, double *);
+
+int gqt_resolution(gqt *, image *, srs *, double *, double *);
+
+void gqt_window(gqt *, double, double, double *, unsigned, tile_window *);
+
+int gqt_estimate(gqt *, image *, srs *, unsigned, export_cost *);
+
+int gqt_export(gqt *, image *, srs *, int, unsigned, coverage *,
+               tile_cache *, int);
 
 int gqt_export_file(gqt *, char *, srs *, double *, int *, int);
 
+int gqt_benchmark(gqt *, int);
+
 #endif
 
 /******************************************************************************/
@@ -67,6 +67,12 @@ void usage(char *program)
 
   printf("\n");
 
+  printf("Usage: %s -B Measures the tiles of a GeoQuadTree image decoded per second\n", program);
+  printf("          -g path_GeoQuadTree_XML_file\n");
+  printf("          -N number_of_tiles (default 1000)\n");
+  printf("          -v verbose_level (optional)\n");
+  printf("\n");
+
   printf("Usage: %s -o Exports part of a GeoQuadTree image to a JPEG/PNG/TIFF image\n", program);
   printf("          -g path_GeoQuadTree_XML_file\n");
   printf("          -f path_file_to_export\n");
@@ -85,7 +91,8 @@ void usage(char *program)
 int main(int argc, char *argv[])
 {
   int c;
-  int f_create, f_import, f_export;
+  int f_create, f_import, f_export, f_benchmark;
+  int number_of_tiles;
   char geoquadtree_xml[1024];
   char filename[1024];
   char srs_type[16];
@@ -106,9 +113,14 @@ int main(int argc, char *argv[])
 
   init_resample();
 
+  jobs_init(sysconf(_SC_NPROCESSORS_ONLN));
+
   f_create=0;
   f_import=0;
   f_export=0;
+  f_benchmark=0;
+
+  number_of_tiles=1000;
 
   verbose_level=0;
 
@@ -123,7 +135,7 @@ int main(int argc, char *argv[])
 
   b_nondatacolor=0;
 
-  while ((c=getopt(argc, argv, "?b:cd:f:g:hik:l:m:n:or:s:S:t:v:"))>0)
+  while ((c=getopt(argc, argv, "?b:Bcd:f:g:hik:l:m:n:N:or:s:S:t:v:"))>0)
   {
     switch (c)
     {
@@ -131,6 +143,8 @@ int main(int argc, char *argv[])
 
       case 'b': scanfloats(optarg, bbox, 4); break;
 
+      case 'B': f_benchmark=1; break;
+
       case 'c': f_create=1; break;
 
       case 'd': b_nondatacolor=1; scanints(optarg, nondatacolor, 3); break;
@@ -151,6 +165,8 @@ int main(int argc, char *argv[])
 
       case 'n': strcpy(name, optarg); break;
 
+      case 'N': number_of_tiles=atoi(optarg); break;
+
       case 'o': f_export=1; break;
 
       case 'r': scanfloats(optarg, res, 2); break;
@@ -169,9 +185,9 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (f_create+f_import+f_export!=1)
+  if (f_create+f_import+f_export+f_benchmark!=1)
   {
-    if (f_create+f_import+f_export==0)
+    if (f_create+f_import+f_export+f_benchmark==0)
     {
       usage(argv[0]);
       return 0;
@@ -208,7 +224,7 @@ int main(int argc, char *argv[])
 
     gqt_write_metadata(geoquadtree_xml, &g);
 
-    gqt_read_metadata(geoquadtree_xml, &g);
+    if (gqt_read_metadata(geoquadtree_xml, &g)!=0) exit(1);
 
     if (OSRExportToWkt(g.p_srs, &wkt) != OGRERR_NONE)
     {
@@ -249,7 +265,7 @@ int main(int argc, char *argv[])
     }
     printf("\n");
 
-    gqt_read_metadata(geoquadtree_xml, &g);
+    if (gqt_read_metadata(geoquadtree_xml, &g)!=0) exit(1);
 
     gqt_import_file(&g, filename, filter, blur, b_nondatacolor, nondatacolor);
 
@@ -273,13 +289,23 @@ int main(int argc, char *argv[])
     else
       printf("  Filter=1 (Bicubic)\n");
 
-    gqt_read_metadata(geoquadtree_xml, &g);
+    if (gqt_read_metadata(geoquadtree_xml, &g)!=0) exit(1);
 
     if (srs_import(&p_srs, srs_type, srs_definition)==1)
     { fprintf(stderr, "srs_import: error importing SRS\n"); exit(1); }
 
     gqt_export_file(&g, filename, p_srs, bbox, tilesize, filter);
   }
+  else if (f_benchmark==1)
+  {
+    printf("Measuring the decoding of the tiles of a GeoQuadTree image\n");
+
+    printf("  GeoQuadTree XML file: %s\n", geoquadtree_xml);
+
+    if (gqt_read_metadata(geoquadtree_xml, &g)!=0) exit(1);
+
+    gqt_benchmark(&g, number_of_tiles);
+  }
 
   return 0;
 }
@@ -0,0 +1,237 @@
+/*
+
+grid.c - GeoQuadTree spatial index of raster footprints
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "grid.h"
+
+/******************************************************************************/
+
+grid *grid_new(int num)
+{
+  /* Creates an index for num footprints. Until grid_set is called, every
+     footprint is unbounded (it intersects any bounding box) */
+
+  grid *gr;
+  int i;
+
+  gr=malloc(sizeof(grid));
+  if (gr==NULL) { fprintf(stderr, "grid_new: malloc\n"); exit(1); }
+
+  gr->num=num;
+  gr->bounding_box=0;
+  gr->minx=0; gr->miny=0; gr->maxx=0; gr->maxy=0;
+  gr->cellx=0; gr->celly=0;
+
+  gr->bbox=malloc((num+1)*4*sizeof(double));
+  if (gr->bbox==NULL) { fprintf(stderr, "grid_new: malloc\n"); exit(1); }
+
+  gr->unbounded=malloc(num+1);
+  if (gr->unbounded==NULL) { fprintf(stderr, "grid_new: malloc\n"); exit(1); }
+
+  for (i=0; (i<num); i++) gr->unbounded[i]=1;
+
+  gr->cell_count=malloc(GRID_CELLS*GRID_CELLS*sizeof(int));
+  if (gr->cell_count==NULL) { fprintf(stderr, "grid_new: malloc\n"); exit(1); }
+
+  gr->cell=malloc(GRID_CELLS*GRID_CELLS*sizeof(int *));
+  if (gr->cell==NULL) { fprintf(stderr, "grid_new: malloc\n"); exit(1); }
+
+  for (i=0; (i<GRID_CELLS*GRID_CELLS); i++)
+  {
+    gr->cell_count[i]=0;
+    gr->cell[i]=NULL;
+  }
+
+  return gr;
+}
+
+/******************************************************************************/
+
+void grid_set(grid *gr, int id, double *bbox)
+{
+  /* Sets the footprint of id (minx, miny, maxx, maxy), or marks it as
+     unbounded if bbox is NULL */
+
+  if ((id<0)||(id>=gr->num)) return;
+
+  if (bbox==NULL) { gr->unbounded[id]=1; return; }
+
+  gr->bbox[id*4+0]=bbox[0];
+  gr->bbox[id*4+1]=bbox[1];
+  gr->bbox[id*4+2]=bbox[2];
+  gr->bbox[id*4+3]=bbox[3];
+
+  gr->unbounded[id]=0;
+
+  if (gr->bounding_box==0)
+  {
+    gr->minx=bbox[0]; gr->miny=bbox[1]; gr->maxx=bbox[2]; gr->maxy=bbox[3];
+    gr->bounding_box=1;
+  }
+  else
+  {
+    if (bbox[0]<gr->minx) gr->minx=bbox[0];
+    if (bbox[1]<gr->miny) gr->miny=bbox[1];
+    if (bbox[2]>gr->maxx) gr->maxx=bbox[2];
+    if (bbox[3]>gr->maxy) gr->maxy=bbox[3];
+  }
+}
+
+/******************************************************************************/
+
+double cell_clamp(double v, double min, double max)
+{
+  /* v within [min, max], as a whole cell index */
+
+  v=floor(v);
+
+  if (v<min) v=min;
+  if (v>max) v=max;
+
+  return v;
+}
+
+/******************************************************************************/
+
+void cell_range(grid *gr, double minx, double miny, double maxx, double maxy,
+                int *c)
+{
+  /* Range of cells (colmin, rowmin, colmax, rowmax) covered by a bounding
+     box, clipped to the grid. The bounds are clipped before they are
+     converted, as a huge or infinite one does not fit in an int, and a
+     bounding box with a NaN bound covers no cell */
+
+  if (isnan(minx)||isnan(miny)||isnan(maxx)||isnan(maxy))
+  {
+    c[0]=GRID_CELLS; c[1]=GRID_CELLS; c[2]=-1; c[3]=-1;
+    return;
+  }
+
+  c[0]=(int)cell_clamp((minx-gr->minx)/gr->cellx, 0, GRID_CELLS);
+  c[1]=(int)cell_clamp((miny-gr->miny)/gr->celly, 0, GRID_CELLS);
+  c[2]=(int)cell_clamp((maxx-gr->minx)/gr->cellx, -1, GRID_CELLS-1);
+  c[3]=(int)cell_clamp((maxy-gr->miny)/gr->celly, -1, GRID_CELLS-1);
+}
+
+/******************************************************************************/
+
+void grid_build(grid *gr)
+{
+  /* Distributes the known footprints among the cells of the grid */
+
+  int id, i, j, n;
+  int c[4];
+
+  if (gr->bounding_box==0) return;
+
+  gr->cellx=(gr->maxx-gr->minx)/GRID_CELLS;
+  gr->celly=(gr->maxy-gr->miny)/GRID_CELLS;
+
+  if (gr->cellx<=0) gr->cellx=1;
+  if (gr->celly<=0) gr->celly=1;
+
+  for (id=0; (id<gr->num); id++)
+  {
+    if (gr->unbounded[id]==1) continue;
+
+    cell_range(gr, gr->bbox[id*4+0], gr->bbox[id*4+1],
+                   gr->bbox[id*4+2], gr->bbox[id*4+3], c);
+
+    for (j=c[1]; (j<=c[3]); j++)
+    for (i=c[0]; (i<=c[2]); i++)
+    {
+      n=j*GRID_CELLS+i;
+
+      gr->cell[n]=realloc(gr->cell[n], (gr->cell_count[n]+1)*sizeof(int));
+      if (gr->cell[n]==NULL) { fprintf(stderr, "grid_build: realloc\n"); exit(1); }
+
+      gr->cell[n][gr->cell_count[n]++]=id;
+    }
+  }
+}
+
+/******************************************************************************/
+
+int grid_query(grid *gr, double minx, double miny, double maxx, double maxy,
+               unsigned char *hits)
+{
+  /* Sets hits[id] to 1 for every footprint that intersects the bounding box,
+     and to 0 otherwise. Returns the number of hits */
+
+  int id, i, j, k, n, num;
+  int c[4];
+  double *b;
+
+  for (id=0; (id<gr->num); id++) hits[id]=gr->unbounded[id];
+
+  if (gr->bounding_box==1)
+  {
+    cell_range(gr, minx, miny, maxx, maxy, c);
+
+    for (j=c[1]; (j<=c[3]); j++)
+    for (i=c[0]; (i<=c[2]); i++)
+    {
+      n=j*GRID_CELLS+i;
+
+      for (k=0; (k<gr->cell_count[n]); k++)
+      {
+        id=gr->cell[n][k];
+        if (hits[id]==1) continue;
+
+        b=&(gr->bbox[id*4]);
+
+        if ((b[0]<=maxx)&&(b[2]>=minx)&&(b[1]<=maxy)&&(b[3]>=miny))
+          hits[id]=1;
+      }
+    }
+  }
+
+  num=0;
+  for (id=0; (id<gr->num); id++) num+=hits[id];
+
+  return num;
+}
+
+/******************************************************************************/
+
+void grid_free(grid *gr)
+{
+  int i;
+
+  if (gr==NULL) return;
+
+  for (i=0; (i<GRID_CELLS*GRID_CELLS); i++) free(gr->cell[i]);
+
+  free(gr->cell);
+  free(gr->cell_count);
+  free(gr->unbounded);
+  free(gr->bbox);
+  free(gr);
+}
+
+/******************************************************************************/
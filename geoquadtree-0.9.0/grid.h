@@ -0,0 +1,55 @@
+/*
+
+grid.h - GeoQuadTree spatial index of raster footprints
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__GRID__)
+
+#define __GRID__
+
+#define GRID_CELLS 16  /* Number of cells of the grid along each axis */
+
+typedef struct
+{
+  int num;                        /* Number of footprints */
+  double *bbox;                   /* minx, miny, maxx, maxy of each footprint */
+  unsigned char *unbounded;       /* 1 if the footprint is not known */
+  int bounding_box;               /* 1 if at least one footprint is known */
+  double minx, miny, maxx, maxy;  /* Union of all known footprints */
+  double cellx, celly;            /* Size of a cell */
+  int *cell_count;                /* Number of footprints in each cell */
+  int **cell;                     /* Footprint ids in each cell */
+} grid;
+
+grid *grid_new(int);
+
+void grid_set(grid *, int, double *);
+
+void grid_build(grid *);
+
+int grid_query(grid *, double, double, double, double, unsigned char *);
+
+void grid_free(grid *);
+
+#endif
+
+/******************************************************************************/
@@ -0,0 +1,205 @@
+/*
+
+hash.c - GeoQuadTree string hash tables
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+/******************************************************************************/
+
+unsigned long hash_string(const char *str)
+{
+  /* djb2 string hash */
+
+  unsigned long h;
+
+  h=5381;
+  while (*str) h=h*33+(unsigned char)(*str++);
+
+  return h;
+}
+
+/******************************************************************************/
+
+hash_table *hash_new(unsigned size)
+{
+  hash_table *h;
+  unsigned i;
+
+  if (size<16) size=16;
+
+  h=malloc(sizeof(hash_table));
+  if (h==NULL) { fprintf(stderr, "hash_new: malloc\n"); exit(1); }
+
+  h->size=size;
+  h->count=0;
+
+  h->bucket=malloc(size*sizeof(hash_entry *));
+  if (h->bucket==NULL) { fprintf(stderr, "hash_new: malloc\n"); exit(1); }
+
+  for (i=0; (i<size); i++) h->bucket[i]=NULL;
+
+  return h;
+}
+
+/******************************************************************************/
+
+void hash_grow(hash_table *h)
+{
+  /* Doubles the number of buckets, keeping the order of the entries that
+     share a bucket */
+
+  hash_entry **bucket, *e, *next, **tail;
+  unsigned size, i, b;
+
+  size=h->size*2;
+
+  bucket=malloc(size*sizeof(hash_entry *));
+  if (bucket==NULL) { fprintf(stderr, "hash_grow: malloc\n"); exit(1); }
+
+  for (i=0; (i<size); i++) bucket[i]=NULL;
+
+  for (i=0; (i<h->size); i++)
+  {
+    e=h->bucket[i];
+
+    while (e!=NULL)
+    {
+      next=(hash_entry *)e->next;
+
+      b=hash_string(e->key)%size;
+
+      tail=&(bucket[b]);
+      while (*tail!=NULL) tail=(hash_entry **)&((*tail)->next);
+
+      e->next=NULL;
+      *tail=e;
+
+      e=next;
+    }
+  }
+
+  free(h->bucket);
+
+  h->bucket=bucket;
+  h->size=size;
+}
+
+/******************************************************************************/
+
+void hash_put(hash_table *h, const char *key, void *value)
+{
+  /* Adds (or replaces) the value stored under key */
+
+  hash_entry *e;
+  unsigned b;
+
+  b=hash_string(key)%h->size;
+
+  for (e=h->bucket[b]; (e!=NULL); e=(hash_entry *)e->next)
+    if (strcmp(e->key, key)==0) { e->value=value; return; }
+
+  if (h->count>=h->size) { hash_grow(h); b=hash_string(key)%h->size; }
+
+  e=malloc(sizeof(hash_entry));
+  if (e==NULL) { fprintf(stderr, "hash_put: malloc\n"); exit(1); }
+
+  e->key=malloc(strlen(key)+1);
+  if (e->key==NULL) { fprintf(stderr, "hash_put: malloc\n"); exit(1); }
+  strcpy(e->key, key);
+
+  e->value=value;
+  e->next=(struct hash_entry *)h->bucket[b];
+  h->bucket[b]=e;
+
+  h->count++;
+}
+
+/******************************************************************************/
+
+void *hash_get(hash_table *h, const char *key)
+{
+  hash_entry *e;
+
+  if (h==NULL) return NULL;
+
+  for (e=h->bucket[hash_string(key)%h->size]; (e!=NULL);
+       e=(hash_entry *)e->next)
+    if (strcmp(e->key, key)==0) return e->value;
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+void hash_remove(hash_table *h, const char *key)
+{
+  hash_entry *e, **p;
+
+  if (h==NULL) return;
+
+  p=&(h->bucket[hash_string(key)%h->size]);
+
+  for (e=*p; (e!=NULL); p=(hash_entry **)&(e->next), e=*p)
+  {
+    if (strcmp(e->key, key)==0)
+    {
+      *p=(hash_entry *)e->next;
+      free(e->key);
+      free(e);
+      h->count--;
+      return;
+    }
+  }
+}
+
+/******************************************************************************/
+
+void hash_free(hash_table *h)
+{
+  hash_entry *e, *next;
+  unsigned i;
+
+  if (h==NULL) return;
+
+  for (i=0; (i<h->size); i++)
+  {
+    e=h->bucket[i];
+
+    while (e!=NULL)
+    {
+      next=(hash_entry *)e->next;
+      free(e->key);
+      free(e);
+      e=next;
+    }
+  }
+
+  free(h->bucket);
+  free(h);
+}
+
+/******************************************************************************/
@@ -0,0 +1,57 @@
+/*
+
+hash.h - GeoQuadTree string hash tables
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__HASH__)
+
+#define __HASH__
+
+typedef struct
+{
+  char *key;
+  void *value;
+  struct hash_entry *next;
+} hash_entry;
+
+typedef struct
+{
+  unsigned size;
+  unsigned count;
+  hash_entry **bucket;
+} hash_table;
+
+unsigned long hash_string(const char *);
+
+hash_table *hash_new(unsigned);
+
+void hash_put(hash_table *, const char *, void *);
+
+void *hash_get(hash_table *, const char *);
+
+void hash_remove(hash_table *, const char *);
+
+void hash_free(hash_table *);
+
+#endif
+
+/******************************************************************************/
@@ -0,0 +1,817 @@
+/*
+
+http.c - GeoQuadTree standalone HTTP server
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "http.h"
+#include "pool.h"
+
+#define HTTP_UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\n" \
+                         "Content-Length: 0\r\nConnection: close\r\n\r\n"
+
+extern int verbose_level;
+
+int http_connections=0;  /* Open connections of this process */
+
+pthread_mutex_t http_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+http_task *http_queue_first=NULL;  /* Requests waiting for a thread */
+http_task *http_queue_last=NULL;
+
+pthread_mutex_t http_queue_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t http_queue_cond=PTHREAD_COND_INITIALIZER;
+
+/******************************************************************************/
+
+int http_listen(int port)
+{
+  /* Opens a listening socket on port. Every worker thread of every process
+     has its own socket (SO_REUSEPORT), and the kernel balances the incoming
+     connections among them */
+
+  struct sockaddr_in addr;
+  int fd, on=1;
+
+  fd=socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, 0);
+  if (fd<0)
+  { fprintf(stderr, "http_listen: socket: %s\n", strerror(errno)); return -1; }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))!=0)
+  {
+    fprintf(stderr, "http_listen: SO_REUSEPORT: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family=AF_INET;
+  addr.sin_addr.s_addr=htonl(INADDR_ANY);
+  addr.sin_port=htons(port);
+
+  if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr))!=0)||
+      (listen(fd, SOMAXCONN)!=0))
+  {
+    fprintf(stderr, "http_listen: port %i: %s\n", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/******************************************************************************/
+
+void http_watch(http_worker *w, connection *c, int events)
+{
+  /* Selects the events waited for on a connection: EPOLLIN while requests
+     are read, EPOLLOUT while a response is being sent. A connection being
+     served is out of the event loop, and gets them once it is back */
+
+  struct epoll_event ev;
+
+  if (c->busy==1) { c->events=events; return; }
+
+  if (c->events==events) return;
+
+  ev.events=events;
+  ev.data.ptr=c;
+
+  epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+
+  c->events=events;
+}
+
+/******************************************************************************/
+
+void http_open(http_worker *w, int fd)
+{
+  connection *c;
+  struct epoll_event ev;
+  int on=1;
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+  c=malloc(sizeof(connection));
+  if (c==NULL) { fprintf(stderr, "http_open: malloc\n"); exit(1); }
+
+  c->fd=fd;
+  c->request_length=0;
+  c->pending=NULL;
+  c->pending_length=0;
+  c->pending_sent=0;
+  c->file_fd=-1;
+  c->file_remaining=0;
+  c->keep_alive=1;
+  c->events=EPOLLIN;
+  c->busy=0;
+  c->last_activity=time(NULL);
+
+  c->next=(struct connection *)w->connection_list;
+  w->connection_list=c;
+
+  ev.events=EPOLLIN;
+  ev.data.ptr=c;
+
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, fd, &ev)!=0)
+  { fprintf(stderr, "http_open: epoll_ctl: %s\n", strerror(errno)); exit(1); }
+}
+
+/******************************************************************************/
+
+void http_close(http_worker *w, connection *c)
+{
+  connection *p;
+
+  if (w->connection_list==c)
+    w->connection_list=(connection *)c->next;
+  else
+  {
+    p=w->connection_list;
+    while ((connection *)p->next!=c) p=(connection *)p->next;
+    p->next=c->next;
+  }
+
+  close(c->fd);
+  if (c->file_fd>=0) close(c->file_fd);
+
+  free(c->pending);
+  free(c);
+
+  pthread_mutex_lock(&http_mutex);
+  http_connections--;
+  pthread_mutex_unlock(&http_mutex);
+}
+
+/******************************************************************************/
+
+void http_accept(http_worker *w)
+{
+  /* Accepts all the connections waiting on the listening socket. Once
+     MaxConnections connections are open, new ones are answered with a
+     503 status and closed */
+
+  int fd, full;
+
+  while ((fd=accept4(w->listen_fd, NULL, NULL, SOCK_NONBLOCK))>=0)
+  {
+    pthread_mutex_lock(&http_mutex);
+    full=(http_connections>=w->max_connections);
+    if (!full) http_connections++;
+    pthread_mutex_unlock(&http_mutex);
+
+    if (full)
+    {
+      if (write(fd, HTTP_UNAVAILABLE, strlen(HTTP_UNAVAILABLE))<0) {}
+      close(fd);
+      continue;
+    }
+
+    http_open(w, fd);
+  }
+}
+
+/******************************************************************************/
+
+int http_send(http_worker *w, connection *c)
+{
+  /* Sends as much of the pending response, and then of its file, as the
+     socket accepts. Returns 1 if the connection has to be closed */
+
+  ssize_t n;
+
+  while (c->pending_sent<c->pending_length)
+  {
+    n=write(c->fd, c->pending+c->pending_sent,
+            c->pending_length-c->pending_sent);
+
+    if (n<0)
+    {
+      if (errno==EINTR) continue;
+      if ((errno==EAGAIN)||(errno==EWOULDBLOCK)) break;
+      return 1;
+    }
+
+    c->pending_sent+=n;
+    c->last_activity=time(NULL);
+  }
+
+  if (c->pending_sent<c->pending_length)
+  { http_watch(w, c, EPOLLOUT); return 0; }
+
+  free(c->pending);
+  c->pending=NULL;
+  c->pending_length=0;
+  c->pending_sent=0;
+
+  while (c->file_remaining>0)
+  {
+    n=sendfile(c->fd, c->file_fd, NULL, c->file_remaining);
+
+    if (n<0)
+    {
+      if (errno==EINTR) continue;
+      if ((errno==EAGAIN)||(errno==EWOULDBLOCK)) break;
+      return 1;
+    }
+
+    if (n==0) return 1;  /* The file is shorter than announced */
+
+    c->file_remaining-=n;
+    c->last_activity=time(NULL);
+  }
+
+  if (c->file_remaining>0) { http_watch(w, c, EPOLLOUT); return 0; }
+
+  if (c->file_fd>=0) { close(c->file_fd); c->file_fd=-1; }
+
+  if (c->keep_alive==0) return 1;
+
+  http_watch(w, c, EPOLLIN);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int http_respond(http_worker *w, connection *c, output_stream *out,
+                 int head_only)
+{
+  /* Turns the CGI response of the WMS code in out (header lines, an empty
+     line and the body, which may continue in a file) into an HTTP/1.1
+     response and starts sending it. Returns 1 if the connection has to be
+     closed */
+
+  char header[4096], fields[2048], status[128];
+  char *buffer, *line, *eol;
+  unsigned long length, body_length, offset;
+  struct iovec iov[2];
+  int header_length, fields_length, i;
+  ssize_t n;
+
+  buffer=out->buffer;
+  length=out->length;
+
+  strcpy(status, "200 OK");
+  fields_length=0;
+  fields[0]=0;
+
+  /* Header lines of the CGI response */
+
+  offset=0;
+
+  while (offset<length)
+  {
+    line=buffer+offset;
+    eol=memchr(line, '\n', length-offset);
+    if (eol==NULL) { offset=length; break; }
+
+    offset=eol+1-buffer;
+    if ((eol>line)&&(eol[-1]=='\r')) eol--;
+    if (eol==line) break;  /* End of the header */
+
+    if ((eol-line>7)&&(strncasecmp(line, "Status:", 7)==0))
+    {
+      for (line+=7; ((line<eol)&&(*line==' ')); line++);
+      snprintf(status, sizeof(status), "%.*s", (int)(eol-line), line);
+    }
+    else if (fields_length+(eol-line)+2<sizeof(fields))
+    {
+      memcpy(fields+fields_length, line, eol-line);
+      fields_length+=eol-line;
+      fields[fields_length++]='\r';
+      fields[fields_length++]='\n';
+      fields[fields_length]=0;
+    }
+  }
+
+  body_length=length-offset;
+
+  header_length=snprintf(header, sizeof(header),
+                         "HTTP/1.1 %s\r\n%sContent-Length: %lu\r\n"
+                         "Connection: %s\r\n\r\n",
+                         status, fields, body_length+out->file_length,
+                         (c->keep_alive==1)?"keep-alive":"close");
+
+  if (verbose_level>0)
+    printf("http_respond status=%s length=%lu\n", status,
+           body_length+out->file_length);
+
+  /* The file of the response goes with the connection */
+
+  c->file_fd=out->fd;
+  c->file_remaining=out->file_length;
+
+  out->fd=-1;
+  out->file_length=0;
+
+  if (head_only==1) body_length=c->file_remaining=0;
+
+  /* Most responses fit in the socket buffer; only what is left is copied
+     to be sent when the socket becomes writable */
+
+  iov[0].iov_base=header;
+  iov[0].iov_len=header_length;
+  iov[1].iov_base=buffer+offset;
+  iov[1].iov_len=body_length;
+
+  do n=writev(c->fd, iov, 2);
+  while ((n<0)&&(errno==EINTR));
+
+  if (n<0)
+  {
+    if ((errno!=EAGAIN)&&(errno!=EWOULDBLOCK)) return 1;
+    n=0;
+  }
+
+  c->last_activity=time(NULL);
+
+  c->pending_length=header_length+body_length-n;
+  c->pending_sent=0;
+
+  if (c->pending_length==0) return http_send(w, c);
+
+  c->pending=malloc(c->pending_length);
+  if (c->pending==NULL) { fprintf(stderr, "http_respond: malloc\n"); exit(1); }
+
+  for (i=0, offset=0; (i<2); i++)
+  {
+    if (n>=iov[i].iov_len) { n-=iov[i].iov_len; continue; }
+
+    memcpy(c->pending+offset, (char *)iov[i].iov_base+n, iov[i].iov_len-n);
+    offset+=iov[i].iov_len-n;
+    n=0;
+  }
+
+  http_watch(w, c, EPOLLOUT);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int http_error(http_worker *w, connection *c, char *status)
+{
+  /* Answers a request that cannot be served and closes the connection */
+
+  output_reset(&(w->out), NULL);
+  output_printf(&(w->out), "Status: %s\r\nContent-type: text/plain\r\n\r\n%s\n",
+                status, status);
+
+  c->keep_alive=0;
+
+  return http_respond(w, c, &(w->out), 0);
+}
+
+/******************************************************************************/
+
+void http_submit(http_worker *w, http_task *t)
+{
+  /* Hands a request over to the request threads. Its connection leaves
+     the event loop until it is served, as the request points into the
+     buffer of the connection */
+
+  t->c->busy=1;
+  epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, t->c->fd, NULL);
+
+  t->next=NULL;
+
+  pthread_mutex_lock(&http_queue_mutex);
+
+  if (http_queue_last==NULL) http_queue_first=t;
+  else http_queue_last->next=(struct http_task *)t;
+  http_queue_last=t;
+
+  pthread_cond_signal(&http_queue_cond);
+  pthread_mutex_unlock(&http_queue_mutex);
+}
+
+/******************************************************************************/
+
+void *http_answer(void *arg)
+{
+  /* Request thread. Serves the requests of every event loop of the
+     process and starts sending their responses, so that waiting for
+     admission or for another request rendering the same image does not
+     stall the other connections of the loop */
+
+  output_stream out;
+  http_task *t;
+  http_worker *w;
+  service *Service;
+  uint64_t one=1;
+
+  output_init(&out, NULL);
+
+  while (1)
+  {
+    pthread_mutex_lock(&http_queue_mutex);
+
+    while (http_queue_first==NULL)
+      pthread_cond_wait(&http_queue_cond, &http_queue_mutex);
+
+    t=http_queue_first;
+    http_queue_first=(http_task *)t->next;
+    if (http_queue_first==NULL) http_queue_last=NULL;
+
+    pthread_mutex_unlock(&http_queue_mutex);
+
+    w=t->worker;
+
+    output_reset(&out, NULL);
+    t->req.out=&out;
+
+    Service=service_acquire();
+    handle_request(Service, &(t->req));
+    service_release(Service);
+
+    arena_reset();
+
+    t->closing=http_respond(w, t->c, &out, t->head_only);
+
+    pthread_mutex_lock(&(w->mutex));
+    t->next=w->done;
+    w->done=(struct http_task *)t;
+    pthread_mutex_unlock(&(w->mutex));
+
+    if (write(w->event_fd, &one, sizeof(one))<0) {}
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int http_process(http_worker *w, connection *c)
+{
+  /* Hands the next complete request received on a connection over to the
+     request threads, once no response is waiting to be sent. The ones
+     after it are processed once it is served. Returns 1 if the
+     connection has to be closed */
+
+  char *end, *line, *method, *target, *protocol, *query, *host, *value;
+  char *saveptr, *saveptr_line;
+  http_task *t;
+  wms_request *req;
+  int length, path_length, head_only;
+
+  if ((c->busy==0)&&(c->pending==NULL)&&(c->file_fd<0))
+  {
+    c->request[c->request_length]=0;
+
+    end=strstr(c->request, "\r\n\r\n");
+    if (end==NULL)
+    {
+      if (c->request_length>=HTTP_MAX_REQUEST)
+        return http_error(w, c, "431 Request Header Fields Too Large");
+
+      return 0;
+    }
+
+    *end=0;
+    length=end+4-c->request;
+
+    /* Request line */
+
+    line=strtok_r(c->request, "\r\n", &saveptr);
+    if (line==NULL) return http_error(w, c, "400 Bad Request");
+
+    method=strtok_r(line, " ", &saveptr_line);
+    target=strtok_r(NULL, " ", &saveptr_line);
+    protocol=strtok_r(NULL, " ", &saveptr_line);
+
+    if ((method==NULL)||(target==NULL)||(protocol==NULL))
+      return http_error(w, c, "400 Bad Request");
+
+    head_only=(strcmp(method, "HEAD")==0);
+
+    if ((strcmp(method, "GET")!=0)&&(head_only==0))
+      return http_error(w, c, "501 Not Implemented");
+
+    /* HTTP/1.1 connections are persistent unless the client closes them,
+       HTTP/1.0 ones only if the client asks for it */
+
+    c->keep_alive=(strcmp(protocol, "HTTP/1.1")==0);
+
+    t=malloc(sizeof(http_task));
+    if (t==NULL) { fprintf(stderr, "http_process: malloc\n"); exit(1); }
+
+    req=&(t->req);
+
+    /* Header fields */
+
+    host=NULL;
+    req->if_none_match=NULL;
+    req->if_modified_since=NULL;
+
+    while ((line=strtok_r(NULL, "\r\n", &saveptr))!=NULL)
+    {
+      value=strchr(line, ':');
+      if (value==NULL) continue;
+
+      *value++=0;
+      while (*value==' ') value++;
+
+      if (strcasecmp(line, "Host")==0) host=value;
+
+      if (strcasecmp(line, "If-None-Match")==0) req->if_none_match=value;
+
+      if (strcasecmp(line, "If-Modified-Since")==0)
+        req->if_modified_since=value;
+
+      if (strcasecmp(line, "Connection")==0)
+      {
+        if (strcasestr(value, "close")!=NULL) c->keep_alive=0;
+        else if (strcasestr(value, "keep-alive")!=NULL) c->keep_alive=1;
+      }
+    }
+
+    query=strchr(target, '?');
+
+    /* The whole path addresses the WMTS tiles in this mode */
+
+    path_length=(query==NULL)?strlen(target):query-target;
+    if (path_length>=sizeof(t->path)) path_length=sizeof(t->path)-1;
+    memcpy(t->path, target, path_length);
+    t->path[path_length]=0;
+
+    if (verbose_level>0) printf("http_process %s %s\n", method, target);
+
+    req->query_string=(query==NULL)?"":query+1;
+    req->http_host=host;
+    req->request_uri=target;
+    req->path_info=t->path;
+    req->out=NULL;
+    req->version=10300;
+
+    t->worker=w;
+    t->c=c;
+    t->head_only=head_only;
+    t->length=length;
+    t->closing=0;
+
+    http_submit(w, t);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void http_resume(http_worker *w)
+{
+  /* Takes back the connections whose requests have been served. Pipelined
+     requests stay in their buffers and are processed next */
+
+  http_task *t, *next;
+  connection *c;
+  struct epoll_event ev;
+  uint64_t count;
+  int closing;
+
+  if (read(w->event_fd, &count, sizeof(count))<0) {}
+
+  pthread_mutex_lock(&(w->mutex));
+  t=(http_task *)w->done;
+  w->done=NULL;
+  pthread_mutex_unlock(&(w->mutex));
+
+  for (; (t!=NULL); t=next)
+  {
+    next=(http_task *)t->next;
+    c=t->c;
+
+    c->busy=0;
+    c->last_activity=time(NULL);
+
+    c->request_length-=t->length;
+    memmove(c->request, c->request+t->length, c->request_length);
+
+    closing=t->closing;
+    free(t);
+
+    if (closing==0)
+    {
+      ev.events=c->events;
+      ev.data.ptr=c;
+
+      closing=(epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev)!=0);
+    }
+
+    if (closing==0) closing=http_process(w, c);
+
+    if (closing==1) http_close(w, c);
+  }
+}
+
+/******************************************************************************/
+
+int http_receive(http_worker *w, connection *c)
+{
+  /* Reads what the client has sent and serves the complete requests.
+     Returns 1 if the connection has to be closed */
+
+  ssize_t n;
+
+  while (c->request_length<HTTP_MAX_REQUEST)
+  {
+    n=read(c->fd, c->request+c->request_length,
+           HTTP_MAX_REQUEST-c->request_length);
+
+    if (n==0) return 1;  /* Closed by the client */
+
+    if (n<0)
+    {
+      if (errno==EINTR) continue;
+      if ((errno==EAGAIN)||(errno==EWOULDBLOCK)) break;
+      return 1;
+    }
+
+    c->request_length+=n;
+    c->last_activity=time(NULL);
+  }
+
+  return http_process(w, c);
+}
+
+/******************************************************************************/
+
+void *http_work(void *arg)
+{
+  /* Event loop of a worker thread. The connections accepted by a worker are
+     handled by that worker only, so no locking is needed between them,
+     except while a request thread serves one of their requests */
+
+  http_worker *w=(http_worker *)arg;
+  struct epoll_event ev, events[HTTP_MAX_EVENTS];
+  connection *c, *next;
+  time_t now, last_sweep;
+  int n, i, closing;
+
+  w->listen_fd=http_listen(w->port);
+  if (w->listen_fd<0) exit(1);
+
+  w->epoll_fd=epoll_create1(0);
+  if (w->epoll_fd<0)
+  { fprintf(stderr, "http_work: epoll_create1: %s\n", strerror(errno)); exit(1); }
+
+  ev.events=EPOLLIN;
+  ev.data.ptr=NULL;
+
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd, &ev)!=0)
+  { fprintf(stderr, "http_work: epoll_ctl: %s\n", strerror(errno)); exit(1); }
+
+  w->event_fd=eventfd(0, EFD_NONBLOCK);
+  if (w->event_fd<0)
+  { fprintf(stderr, "http_work: eventfd: %s\n", strerror(errno)); exit(1); }
+
+  ev.events=EPOLLIN;
+  ev.data.ptr=w;
+
+  if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->event_fd, &ev)!=0)
+  { fprintf(stderr, "http_work: epoll_ctl: %s\n", strerror(errno)); exit(1); }
+
+  last_sweep=time(NULL);
+
+  while (1)
+  {
+    n=epoll_wait(w->epoll_fd, events, HTTP_MAX_EVENTS, 1000);
+
+    if ((n<0)&&(errno!=EINTR))
+    { fprintf(stderr, "http_work: epoll_wait: %s\n", strerror(errno)); exit(1); }
+
+    for (i=0; (i<n); i++)
+    {
+      c=(connection *)events[i].data.ptr;
+
+      if (c==NULL) { http_accept(w); continue; }
+
+      if ((void *)c==(void *)w) { http_resume(w); continue; }
+
+      if (events[i].events&EPOLLIN)
+        closing=http_receive(w, c);
+      else if (events[i].events&EPOLLOUT)
+      {
+        closing=http_send(w, c);
+        if ((closing==0)&&(c->pending==NULL)&&(c->file_fd<0))
+          closing=http_process(w, c);
+      }
+      else
+        closing=1;
+
+      if (closing==1) http_close(w, c);
+    }
+
+    /* Connections idle for too long are closed */
+
+    now=time(NULL);
+
+    if (now!=last_sweep)
+    {
+      for (c=w->connection_list; (c!=NULL); c=next)
+      {
+        next=(connection *)c->next;
+
+        if ((c->busy==0)&&(now-c->last_activity>HTTP_KEEPALIVE_TIMEOUT))
+          http_close(w, c);
+      }
+
+      last_sweep=now;
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int http_serve(int num_threads, int max_connections, int port)
+{
+  /* Serves WMS requests over HTTP on port, with one event loop per worker
+     thread and HTTP_REQUEST_THREADS threads per loop serving the requests.
+     The calling thread is one of the workers, and this function does not
+     return. Every request is served with the configuration current when
+     it arrives */
+
+  http_worker *workers;
+  pthread_t *threads, thread;
+  int i;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  workers=malloc(num_threads*sizeof(http_worker));
+  if (workers==NULL) { fprintf(stderr, "http_serve: malloc\n"); exit(1); }
+
+  threads=malloc(num_threads*sizeof(pthread_t));
+  if (threads==NULL) { fprintf(stderr, "http_serve: malloc\n"); exit(1); }
+
+  for (i=0; (i<num_threads); i++)
+  {
+    workers[i].max_connections=max_connections;
+    workers[i].port=port;
+    workers[i].connection_list=NULL;
+    output_init(&(workers[i].out), NULL);
+    workers[i].done=NULL;
+    pthread_mutex_init(&(workers[i].mutex), NULL);
+  }
+
+  for (i=0; (i<num_threads*HTTP_REQUEST_THREADS); i++)
+    if (pthread_create(&thread, NULL, http_answer, NULL)!=0)
+    { fprintf(stderr, "http_serve: pthread_create\n"); exit(1); }
+
+  for (i=1; (i<num_threads); i++)
+    if (pthread_create(&threads[i], NULL, http_work, &workers[i])!=0)
+    { fprintf(stderr, "http_serve: pthread_create\n"); exit(1); }
+
+  http_work(&workers[0]);
+
+  for (i=1; (i<num_threads); i++) pthread_join(threads[i], NULL);
+
+  free(threads);
+  free(workers);
+
+  return 0;
+}
+
+/******************************************************************************/
@@ -0,0 +1,86 @@
+/*
+
+http.h - GeoQuadTree standalone HTTP server
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__HTTP__)
+
+#define __HTTP__
+
+#include <time.h>
+#include <pthread.h>
+
+#include "wms.h"
+#include "fcgi.h"
+
+#define HTTP_MAX_REQUEST 8192       /* Size limit of the request headers */
+#define HTTP_MAX_EVENTS 256         /* Events handled per epoll_wait call */
+#define HTTP_KEEPALIVE_TIMEOUT 15   /* Seconds an idle connection is kept */
+#define HTTP_REQUEST_THREADS 8      /* Threads serving requests per loop */
+
+typedef struct
+{
+  int fd;
+  char request[HTTP_MAX_REQUEST+1];  /* Bytes received and not served yet */
+  int request_length;
+  char *pending;                     /* Response bytes not sent yet */
+  unsigned long pending_length;
+  unsigned long pending_sent;
+  int file_fd;                       /* File sent after pending, or -1 */
+  unsigned long file_remaining;
+  int keep_alive;                    /* 0 if closed once pending is sent */
+  int events;                        /* Events waited for on fd */
+  int busy;                          /* 1 while a request thread serves it */
+  time_t last_activity;
+  struct connection *next;
+} connection;
+
+typedef struct
+{
+  int max_connections;               /* Open connections per process */
+  int port;
+  int epoll_fd;
+  int listen_fd;
+  connection *connection_list;
+  output_stream out;                 /* Response of the current error */
+  int event_fd;                      /* Signaled when a request is served */
+  struct http_task *done;            /* Requests served, not resumed yet */
+  pthread_mutex_t mutex;
+} http_worker;
+
+typedef struct
+{
+  http_worker *worker;
+  connection *c;
+  wms_request req;
+  char path[1024];
+  int head_only;
+  int length;                        /* Bytes of the request in c->request */
+  int closing;                       /* 1 if c has to be closed once served */
+  struct http_task *next;
+} http_task;
+
+int http_serve(int, int, int);
+
+#endif
+
+/******************************************************************************/
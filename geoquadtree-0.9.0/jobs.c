@@ -0,0 +1,184 @@
+/*
+
+jobs.c - GeoQuadTree pool of threads running short jobs
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "jobs.h"
+
+extern int verbose_level;
+
+/* Jobs are queued in order and taken by the threads of the pool. A thread
+   waiting for a group runs queued jobs itself meanwhile, so that a job may
+   submit and wait for other jobs without the pool running out of threads */
+
+job *job_first=NULL, *job_last=NULL;
+int job_threads=0;  /* Threads of the pool, 0 if the jobs run serially */
+pthread_mutex_t job_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t job_queued=PTHREAD_COND_INITIALIZER;
+pthread_cond_t job_done=PTHREAD_COND_INITIALIZER;
+
+/******************************************************************************/
+
+job *job_take(void)
+{
+  /* Removes the oldest job from the queue, with job_mutex locked */
+
+  job *j;
+
+  j=job_first;
+  if (j==NULL) return NULL;
+
+  job_first=(job *)j->next;
+  if (job_first==NULL) job_last=NULL;
+
+  return j;
+}
+
+/******************************************************************************/
+
+void job_run(job *j)
+{
+  /* Runs a job taken from the queue, with job_mutex unlocked */
+
+  job_group *group=j->group;
+
+  j->run(j->arg);
+
+  pthread_mutex_lock(&job_mutex);
+  if (--(group->pending)==0) pthread_cond_broadcast(&job_done);
+  pthread_mutex_unlock(&job_mutex);
+}
+
+/******************************************************************************/
+
+void *job_thread(void *arg)
+{
+  job *j;
+
+  while (1)
+  {
+    pthread_mutex_lock(&job_mutex);
+    while ((j=job_take())==NULL) pthread_cond_wait(&job_queued, &job_mutex);
+    pthread_mutex_unlock(&job_mutex);
+
+    job_run(j);
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+void jobs_init(int threads)
+{
+  /* Starts the threads of the pool. Until it is called, or with less than
+     two threads, the jobs run when they are submitted */
+
+  pthread_t thread;
+  int i;
+
+  if (threads<2) return;
+
+  for (i=0; (i<threads); i++)
+  {
+    if (pthread_create(&thread, NULL, job_thread, NULL)!=0)
+    { fprintf(stderr, "jobs_init: pthread_create\n"); exit(1); }
+
+    pthread_detach(thread);
+  }
+
+  job_threads=threads;
+
+  if (verbose_level>1) printf("jobs_init threads=%i\n", threads);
+}
+
+/******************************************************************************/
+
+int jobs_threads(void)
+{
+  /* Threads of the pool, 0 if the jobs run when they are submitted */
+
+  return job_threads;
+}
+
+/******************************************************************************/
+
+void job_group_init(job_group *group)
+{
+  group->pending=0;
+}
+
+/******************************************************************************/
+
+void job_submit(job_group *group, job *j, void (*run)(void *), void *arg)
+{
+  /* Queues run(arg) as a job of group. j is kept by the caller until the
+     group has been waited for */
+
+  j->run=run;
+  j->arg=arg;
+  j->group=group;
+  j->next=NULL;
+
+  if (job_threads==0) { run(arg); return; }
+
+  pthread_mutex_lock(&job_mutex);
+
+  group->pending++;
+
+  if (job_last==NULL) job_first=j;
+  else job_last->next=(struct job *)j;
+  job_last=j;
+
+  pthread_cond_signal(&job_queued);
+  pthread_mutex_unlock(&job_mutex);
+}
+
+/******************************************************************************/
+
+void job_group_wait(job_group *group)
+{
+  /* Returns once all the jobs of group have finished, running queued jobs
+     while they are not */
+
+  job *j;
+
+  pthread_mutex_lock(&job_mutex);
+
+  while (group->pending>0)
+  {
+    j=job_take();
+
+    if (j==NULL) { pthread_cond_wait(&job_done, &job_mutex); continue; }
+
+    pthread_mutex_unlock(&job_mutex);
+    job_run(j);
+    pthread_mutex_lock(&job_mutex);
+  }
+
+  pthread_mutex_unlock(&job_mutex);
+}
+
+/******************************************************************************/
@@ -0,0 +1,56 @@
+/*
+
+jobs.h - GeoQuadTree pool of threads running short jobs
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__JOBS__)
+
+#define __JOBS__
+
+#include <pthread.h>
+
+typedef struct
+{
+  int pending;  /* Jobs of the group not finished yet */
+} job_group;
+
+typedef struct
+{
+  void (*run)(void *);
+  void *arg;
+  job_group *group;
+  struct job *next;
+} job;
+
+void jobs_init(int);
+
+int jobs_threads(void);
+
+void job_group_init(job_group *);
+
+void job_submit(job_group *, job *, void (*)(void *), void *);
+
+void job_group_wait(job_group *);
+
+#endif
+
+/******************************************************************************/
@@ -35,24 +35,33 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 extern int verbose_level;
 
-unsigned char *buffer;
+typedef struct
+{
+  struct jpeg_destination_mgr pub;
+  output_stream *out;
+  unsigned char buffer[BUFFER_SIZE];
+} jpg_destination;
 
 /******************************************************************************/
 
 static void jpg_init_destination(struct jpeg_compress_struct *cinfo)
 {
-  cinfo->dest->next_output_byte=buffer;
-  cinfo->dest->free_in_buffer=BUFFER_SIZE;
+  jpg_destination *dest=(jpg_destination *)cinfo->dest;
+
+  dest->pub.next_output_byte=dest->buffer;
+  dest->pub.free_in_buffer=BUFFER_SIZE;
 }
 
 /******************************************************************************/
 
 boolean jpg_empty_output_buffer(struct jpeg_compress_struct *cinfo)
 {
-  output_buffer(buffer, BUFFER_SIZE);
+  jpg_destination *dest=(jpg_destination *)cinfo->dest;
 
-  cinfo->dest->next_output_byte=buffer;
-  cinfo->dest->free_in_buffer=BUFFER_SIZE;
+  output_buffer(dest->out, dest->buffer, BUFFER_SIZE);
+
+  dest->pub.next_output_byte=dest->buffer;
+  dest->pub.free_in_buffer=BUFFER_SIZE;
 
   return TRUE;
 }
@@ -61,7 +70,10 @@ boolean jpg_empty_output_buffer(struct jpeg_compress_struct *cinfo)
 
 static void jpg_term_destination(struct jpeg_compress_struct *cinfo)
 {
-  output_buffer(buffer, BUFFER_SIZE - cinfo->dest->free_in_buffer);
+  jpg_destination *dest=(jpg_destination *)cinfo->dest;
+
+  output_buffer(dest->out, dest->buffer,
+                BUFFER_SIZE - dest->pub.free_in_buffer);
 }
 
 /******************************************************************************/
@@ -139,7 +151,7 @@ image *read_jpg(char *filename)
 
 /******************************************************************************/
 
-int write_jpg(image *im, char *filename)
+int write_jpg(image *im, char *filename, output_stream *out)
 {
   struct jpeg_compress_struct cinfo;
   struct jpeg_error_mgr jerr;
@@ -148,9 +160,7 @@ int write_jpg(image *im, char *filename)
   int i;
   unsigned char *s, *t;
   JSAMPROW row_pointer[1];
-
-  buffer=malloc(BUFFER_SIZE);
-  if (buffer==NULL) { fprintf(stderr, "write_jpg: malloc\n"); return 1; }
+  jpg_destination dest;
 
   line=malloc(im->width*3);
   if (line==NULL) { fprintf(stderr, "write_jpg: malloc\n"); return 1; }
@@ -161,13 +171,12 @@ int write_jpg(image *im, char *filename)
 
   if (filename==NULL)
   {
-    if (cinfo.dest==NULL)
-      cinfo.dest=(struct jpeg_destination_mgr *)
-                 malloc(sizeof(struct jpeg_destination_mgr));
+    dest.pub.init_destination=jpg_init_destination;
+    dest.pub.empty_output_buffer=jpg_empty_output_buffer;
+    dest.pub.term_destination=jpg_term_destination;
+    dest.out=out;
 
-    cinfo.dest->init_destination=jpg_init_destination;
-    cinfo.dest->empty_output_buffer=jpg_empty_output_buffer;
-    cinfo.dest->term_destination=jpg_term_destination;
+    cinfo.dest=&dest.pub;
   }
   else
   {
@@ -211,7 +220,6 @@ int write_jpg(image *im, char *filename)
 
   jpeg_destroy_compress(&cinfo);
   free(line);
-  free(buffer);
 
   if (filename!=NULL) fclose(fp);
 
@@ -219,3 +227,95 @@ int write_jpg(image *im, char *filename)
 }
 
 /******************************************************************************/
+
+struct jpg_encoder
+{
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  jpg_destination dest;
+  unsigned char *line;
+};
+
+/******************************************************************************/
+
+jpg_encoder *jpg_encoder_begin(unsigned long width, unsigned long height,
+                               output_stream *out)
+{
+  /* Starts writing to out a JPEG image whose rows are given afterwards, a
+     few at a time, so that it never has to be complete in memory */
+
+  jpg_encoder *e;
+
+  e=malloc(sizeof(jpg_encoder));
+  if (e==NULL) { fprintf(stderr, "jpg_encoder_begin: malloc\n"); exit(1); }
+
+  e->line=malloc(width*3);
+  if (e->line==NULL) { fprintf(stderr, "jpg_encoder_begin: malloc\n"); exit(1); }
+
+  e->cinfo.err=jpeg_std_error(&(e->jerr));
+
+  jpeg_create_compress(&(e->cinfo));
+
+  e->dest.pub.init_destination=jpg_init_destination;
+  e->dest.pub.empty_output_buffer=jpg_empty_output_buffer;
+  e->dest.pub.term_destination=jpg_term_destination;
+  e->dest.out=out;
+
+  e->cinfo.dest=&(e->dest.pub);
+
+  e->cinfo.image_width=width;
+  e->cinfo.image_height=height;
+  e->cinfo.input_components=3;
+  e->cinfo.in_color_space=JCS_RGB;
+
+  jpeg_set_defaults(&(e->cinfo));
+  jpeg_set_quality(&(e->cinfo), JPEG_QUALITY, TRUE);
+
+  jpeg_start_compress(&(e->cinfo), TRUE);
+
+  return e;
+}
+
+/******************************************************************************/
+
+int jpg_encoder_rows(jpg_encoder *e, unsigned char *rows, unsigned long count)
+{
+  unsigned long row, i;
+  unsigned char *s, *t;
+  JSAMPROW row_pointer[1];
+
+  s=rows;
+  row_pointer[0]=e->line;
+
+  for (row=0; (row<count); row++)
+  {
+    t=e->line;
+
+    for (i=0; (i<e->cinfo.image_width); i++)
+    {
+      *t++=*s++;
+      *t++=*s++;
+      *t++=*s++;
+      s++;
+    }
+
+    jpeg_write_scanlines(&(e->cinfo), row_pointer, 1);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int jpg_encoder_end(jpg_encoder *e)
+{
+  jpeg_finish_compress(&(e->cinfo));
+  jpeg_destroy_compress(&(e->cinfo));
+
+  free(e->line);
+  free(e);
+
+  return 0;
+}
+
+/******************************************************************************/
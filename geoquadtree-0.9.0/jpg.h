@@ -27,10 +27,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define __JPG__
 
 #include "geoquadtree.h"
+#include "fcgi.h"
 
 image *read_jpg(char *);
 
-int write_jpg(image *, char *);
+int write_jpg(image *, char *, output_stream *);
+
+typedef struct jpg_encoder jpg_encoder;  /* Image being written by rows */
+
+jpg_encoder *jpg_encoder_begin(unsigned long, unsigned long, output_stream *);
+
+int jpg_encoder_rows(jpg_encoder *, unsigned char *, unsigned long);
+
+int jpg_encoder_end(jpg_encoder *);
 
 #endif
 
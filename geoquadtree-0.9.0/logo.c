@@ -121,17 +121,23 @@ int init_logo(service *Service)
 
 /******************************************************************************/
 
-int add_logo(image *im)
+int add_logo_rows(image *im, unsigned long height, unsigned long first_row)
 {
+  /* Stamps the logo at the bottom right corner of an image of the given
+     height, of which im only holds the rows from first_row on */
+
   unsigned char *p_image, *p_logo_image;
   unsigned char alpha;
-  int x, y;
-
-  p_image=im->buffer+4*(im->width*(im->height-im_logo.height)+(im->width-im_logo.width));
-  p_logo_image=im_logo.buffer;
+  long x, y, row;
 
   for (y=0; (y<im_logo.height); y++)
   {
+    row=(long)height-(long)im_logo.height+y;
+    if ((row<(long)first_row)||(row>=(long)(first_row+im->height))) continue;
+
+    p_image=im->buffer+4*(im->width*(row-first_row)+(im->width-im_logo.width));
+    p_logo_image=im_logo.buffer+y*im_logo.width*4;
+
     for (x=0; (x<im_logo.width*4); )
     {
       alpha=p_logo_image[x+3]*LOGO_TRANSPARENCY/255;
@@ -141,12 +147,16 @@ int add_logo(image *im)
       p_image[x]=((long)(p_logo_image[x])*(long)alpha+(long)p_image[x]*(255-(long)alpha))/255; x++;
       p_image[x]=((long)(p_logo_image[x])*(long)alpha+(long)p_image[x]*(255-(long)alpha))/255; x++;
     }
-
-    p_logo_image+=(im_logo.width*4);
-    p_image+=(im->width*4);
   }
 
   return 0;
 }
 
 /******************************************************************************/
+
+int add_logo(image *im)
+{
+  return add_logo_rows(im, im->height, 0);
+}
+
+/******************************************************************************/
@@ -32,6 +32,8 @@ int init_logo(service *);
 
 int add_logo(image *);
 
+int add_logo_rows(image *, unsigned long, unsigned long);
+
 #endif
 
 /******************************************************************************/
@@ -24,10 +24,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <png.h>
 
 #include "png.h"
 #include "fcgi.h"
+#include "pool.h"
 
 extern int verbose_level;
 
@@ -35,7 +42,7 @@ extern int verbose_level;
 
 void my_png_write_data(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-  output_buffer(data, length);
+  output_buffer((output_stream *)png_get_io_ptr(png_ptr), data, length);
 }
 
 /******************************************************************************/
@@ -46,69 +53,258 @@ void my_png_flush_data(png_structp png_ptr)
 
 /******************************************************************************/
 
-int readtile(gqt *g, char *filetile, unsigned char *tiles,
-             unsigned numtilesx, unsigned numtilesy,
-             unsigned coltile, unsigned rowtile)
+/* The encoded tiles are read whole into a buffer of each thread, which is
+   kept between tiles, and decoded from there */
+
+typedef struct
 {
-  FILE *fp;
+  unsigned char *data;
+  unsigned long capacity;
+} png_decoder;
+
+typedef struct
+{
+  unsigned char *data;   /* Encoded tile */
+  unsigned long length;
+  unsigned long offset;  /* Bytes of it already given to libpng */
+} png_source;
+
+pthread_key_t decoder_key;
+pthread_once_t decoder_once=PTHREAD_ONCE_INIT;
+
+/******************************************************************************/
+
+void png_decoder_destroy(void *arg)
+{
+  png_decoder *d=(png_decoder *)arg;
+
+  free(d->data);
+  free(d);
+}
+
+/******************************************************************************/
+
+void png_decoder_key_new(void)
+{
+  pthread_key_create(&decoder_key, png_decoder_destroy);
+}
+
+/******************************************************************************/
+
+png_decoder *png_decoder_thread(void)
+{
+  /* Returns the decoder of the calling thread, creating it the first time */
+
+  png_decoder *d;
+
+  pthread_once(&decoder_once, png_decoder_key_new);
+
+  d=(png_decoder *)pthread_getspecific(decoder_key);
+  if (d!=NULL) return d;
+
+  d=malloc(sizeof(png_decoder));
+  if (d==NULL) { fprintf(stderr, "png_decoder_thread: malloc\n"); exit(1); }
+
+  d->data=NULL;
+  d->capacity=0;
+
+  pthread_setspecific(decoder_key, d);
+
+  return d;
+}
+
+/******************************************************************************/
+
+png_voidp png_arena_malloc(png_structp png_ptr, png_size_t size)
+{
+  return arena_alloc(size);
+}
+
+/******************************************************************************/
+
+void png_arena_free(png_structp png_ptr, png_voidp p)
+{
+  /* Everything is released at once with the arena */
+}
+
+/******************************************************************************/
+
+void png_read_source(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+  png_source *src=(png_source *)png_get_io_ptr(png_ptr);
+
+  if (src->offset+length>src->length) png_error(png_ptr, "truncated tile");
+
+  memcpy(data, src->data+src->offset, length);
+  src->offset+=length;
+}
+
+/******************************************************************************/
+
+int readtile_buffer(gqt *g, unsigned char *data, unsigned long length,
+                    unsigned char *tiles, unsigned numtilesx,
+                    unsigned numtilesy, unsigned coltile, unsigned rowtile)
+{
+  /* Decodes a tile file held in memory into its place of a mosaic of
+     numtilesx x numtilesy tiles. The libpng structures are taken from the
+     arena of the thread, and the CRCs of the tiles of trusted trees are
+     not checked. Returns 1 if the tile was decoded */
+
   unsigned row;
   png_bytep *row_pointers;
   png_structp png_ptr;
   png_infop info_ptr;
+  png_source src;
+  arena_mark mark;
+  png_uint_32 width, height;
+  int bit_depth, color_type;
 
-  if (verbose_level>1)
+  tiles+=(numtilesx*g->tilesizex*(numtilesy-rowtile-1)+coltile)*g->tilesizey*4;
+
+  mark=arena_save();
+  row_pointers=arena_alloc(g->tilesizey*sizeof(png_bytep *));
+
+  for (row=0; (row<g->tilesizey); row++)
   {
-    printf("readtile filetile=%s\n", filetile);
-    printf("numtilesx=%u numtilesy=%u coltile=%u rowtile=%u\n",
-           numtilesx, numtilesy, coltile, rowtile);
+    row_pointers[row]=tiles;
+    tiles+=(numtilesx*g->tilesizex*4);
   }
 
-  fp=fopen(filetile, "rb");
-  if (fp==NULL) return 0;
-  else
-  {	
-    tiles+=(numtilesx*g->tilesizex*(numtilesy-rowtile-1)+coltile)*g->tilesizey*4;
+  src.data=data;
+  src.length=length;
+  src.offset=0;
 
-    row_pointers=malloc(g->tilesizey*sizeof(png_bytep *));
-    if (row_pointers==NULL) { fprintf(stderr, "readtile: malloc\n"); exit(1); }
+  png_ptr=png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL,
+                                   NULL, png_arena_malloc, png_arena_free);
+  if (!png_ptr)
+  {
+    fprintf(stderr, "readtile: png_create_read_struct\n");
+    arena_restore(mark);
+    return 0;
+  }
 
-    for (row=0; (row<g->tilesizey); row++)
-    {
-      row_pointers[row]=tiles;
-      tiles+=(numtilesx*g->tilesizex*4);
-    }
+  info_ptr=png_create_info_struct(png_ptr);
+  if (info_ptr==NULL)
+  {
+    fprintf(stderr, "readtile: png_create_info_struct\n");
+    png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+    arena_restore(mark);
+    return 0;
+  }
 
-    png_ptr=png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (!png_ptr)
-    { fprintf(stderr, "readtile: png_create_read_struct\n"); return 0; }
+  /* A damaged or truncated tile is left out of the mosaic */
 
-    info_ptr=png_create_info_struct(png_ptr);
-    if (info_ptr==NULL)
-    {
-      fprintf(stderr, "readtile: png_create_info_struct\n");
-      png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-      return 1;
-    }
+  if (setjmp(png_jmpbuf(png_ptr)))
+  {
+    fprintf(stderr, "readtile: damaged tile\n");
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    arena_restore(mark);
+    return 0;
+  }
 
-    png_init_io(png_ptr, fp);
+  if (g->trusted==1)
+  {
+    png_set_crc_action(png_ptr, PNG_CRC_QUIET_USE, PNG_CRC_QUIET_USE);
+#if defined(PNG_IGNORE_ADLER32)
+    png_set_option(png_ptr, PNG_IGNORE_ADLER32, PNG_OPTION_ON);
+#endif
+  }
 
-    png_read_info(png_ptr, info_ptr);
-    //png_set_strip_16(png_ptr);
-    png_read_image(png_ptr, row_pointers);
+  png_set_read_fn(png_ptr, &src, png_read_source);
 
-    fclose(fp);
+  png_read_info(png_ptr, info_ptr);
 
-    png_destroy_info_struct(png_ptr, &info_ptr);
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  /* Only tiles of the size and format of the tree fit in their place of
+     the mosaic. The header is checked even for trusted trees, whose CRCs
+     would not catch a damaged one */
 
-    free(row_pointers);
+  png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+               NULL, NULL, NULL);
+
+  if ((width!=g->tilesizex)||(height!=g->tilesizey)||(bit_depth!=8)||
+      (color_type!=PNG_COLOR_TYPE_RGB_ALPHA))
+  {
+    fprintf(stderr, "readtile: tile of %lux%lu, %i bits, colour type %i\n",
+            (unsigned long)width, (unsigned long)height, bit_depth,
+            color_type);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    arena_restore(mark);
+    return 0;
   }
 
+  //png_set_strip_16(png_ptr);
+  png_read_image(png_ptr, row_pointers);
+
+  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+  arena_restore(mark);
+
   return 1;
 }
 
 /******************************************************************************/
 
+int readtile_fd(gqt *g, int fd, unsigned char *tiles,
+                unsigned numtilesx, unsigned numtilesy,
+                unsigned coltile, unsigned rowtile)
+{
+  /* Reads a whole open tile file into the buffer of the thread with as
+     few calls as possible, and decodes it into the mosaic */
+
+  png_decoder *d=png_decoder_thread();
+  struct stat buf;
+  unsigned long length;
+  ssize_t n;
+
+  if ((fstat(fd, &buf)!=0)||(buf.st_size<=0)) return 0;
+
+  if ((unsigned long)buf.st_size>d->capacity)
+  {
+    free(d->data);
+    d->capacity=buf.st_size;
+    d->data=malloc(d->capacity);
+    if (d->data==NULL) { fprintf(stderr, "readtile_fd: malloc\n"); exit(1); }
+  }
+
+  for (length=0; (length<buf.st_size); length+=n)
+  {
+    n=read(fd, d->data+length, buf.st_size-length);
+    if ((n<0)&&(errno==EINTR)) { n=0; continue; }
+    if (n<=0) break;
+  }
+
+  return readtile_buffer(g, d->data, length, tiles, numtilesx, numtilesy,
+                         coltile, rowtile);
+}
+
+/******************************************************************************/
+
+int readtile(gqt *g, char *filetile, unsigned char *tiles,
+             unsigned numtilesx, unsigned numtilesy,
+             unsigned coltile, unsigned rowtile)
+{
+  int fd;
+  int ret;
+
+  if (verbose_level>1)
+  {
+    printf("readtile filetile=%s\n", filetile);
+    printf("numtilesx=%u numtilesy=%u coltile=%u rowtile=%u\n",
+           numtilesx, numtilesy, coltile, rowtile);
+  }
+
+  fd=open(filetile, O_RDONLY);
+  if (fd<0) return 0;
+
+  ret=readtile_fd(g, fd, tiles, numtilesx, numtilesy, coltile, rowtile);
+
+  close(fd);
+
+  return ret;
+}
+
+/******************************************************************************/
+
 image *read_png(char *filename)
 {
   image *im;
@@ -224,7 +420,7 @@ image *read_png(char *filename)
 
 /******************************************************************************/
 
-int write_png(image *im, char *filename)
+int write_png(image *im, char *filename, output_stream *out)
 {
   FILE *fp=NULL;
   png_bytep *row_pointers;
@@ -270,7 +466,7 @@ int write_png(image *im, char *filename)
   { fprintf(stderr, "write_png: setjmp\n"); return 1; }
 
   if (filename==NULL)
-    png_set_write_fn(png_ptr, NULL, my_png_write_data, my_png_flush_data);
+    png_set_write_fn(png_ptr, out, my_png_write_data, my_png_flush_data);
   else
     png_init_io(png_ptr, fp);
 
@@ -304,3 +500,133 @@ int write_png(image *im, char *filename)
 }
 
 /******************************************************************************/
+
+struct png_encoder
+{
+  png_structp png_ptr;
+  png_infop info_ptr;
+  unsigned long width;
+  palette *colors;       /* Palette of an 8 bit image, or NULL for RGBA */
+  unsigned char *line;   /* Row of palette indices */
+};
+
+/******************************************************************************/
+
+png_encoder *png_encoder_begin(unsigned long width, unsigned long height,
+                               palette *colors, output_stream *out)
+{
+  /* Starts writing to out a PNG image whose rows are given afterwards, a
+     few at a time, so that it never has to be complete in memory. With a
+     palette, the image is written with 8 bit indices into it */
+
+  png_encoder *e;
+  png_color plte[PALETTE_COLORS];
+  png_byte trns[1];
+  int i;
+
+  e=malloc(sizeof(png_encoder));
+  if (e==NULL) { fprintf(stderr, "png_encoder_begin: malloc\n"); exit(1); }
+
+  e->width=width;
+  e->colors=colors;
+  e->line=NULL;
+
+  if (colors!=NULL)
+  {
+    e->line=malloc(width);
+    if (e->line==NULL) { fprintf(stderr, "png_encoder_begin: malloc\n"); exit(1); }
+  }
+
+  e->png_ptr=png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!e->png_ptr) exit(1);
+
+  e->info_ptr=png_create_info_struct(e->png_ptr);
+  if (e->info_ptr==NULL)
+  {
+    png_destroy_write_struct(&(e->png_ptr), (png_infopp)NULL);
+    exit(1);
+  }
+
+  if (setjmp(png_jmpbuf(e->png_ptr)))
+  { fprintf(stderr, "png_encoder_begin: setjmp\n"); exit(1); }
+
+  png_set_write_fn(e->png_ptr, out, my_png_write_data, my_png_flush_data);
+
+  if (colors==NULL)
+  {
+    png_set_IHDR(e->png_ptr, e->info_ptr, width, height, 8,
+        PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  }
+  else
+  {
+    png_set_IHDR(e->png_ptr, e->info_ptr, width, height, 8,
+        PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    for (i=0; (i<colors->num_colors); i++)
+    {
+      plte[i].red=colors->color[i][0];
+      plte[i].green=colors->color[i][1];
+      plte[i].blue=colors->color[i][2];
+    }
+
+    png_set_PLTE(e->png_ptr, e->info_ptr, plte, colors->num_colors);
+
+    /* Only the first entry is transparent */
+
+    trns[0]=0;
+    png_set_tRNS(e->png_ptr, e->info_ptr, trns, 1, NULL);
+
+    /* Indices do not gain from filtering, and skipping it saves time */
+
+    png_set_filter(e->png_ptr, 0, PNG_FILTER_NONE);
+  }
+
+  png_write_info(e->png_ptr, e->info_ptr);
+
+  return e;
+}
+
+/******************************************************************************/
+
+int png_encoder_rows(png_encoder *e, unsigned char *rows, unsigned long count)
+{
+  unsigned long row;
+
+  if (setjmp(png_jmpbuf(e->png_ptr)))
+  { fprintf(stderr, "png_encoder_rows: setjmp\n"); return 1; }
+
+  for (row=0; (row<count); row++)
+  {
+    if (e->colors==NULL)
+      png_write_row(e->png_ptr, rows+row*e->width*4);
+    else
+    {
+      palette_map(e->colors, rows+row*e->width*4, e->width, e->line);
+      png_write_row(e->png_ptr, e->line);
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int png_encoder_end(png_encoder *e)
+{
+  if (setjmp(png_jmpbuf(e->png_ptr)))
+  { fprintf(stderr, "png_encoder_end: setjmp\n"); return 1; }
+
+  png_write_end(e->png_ptr, e->info_ptr);
+
+  png_destroy_info_struct(e->png_ptr, &(e->info_ptr));
+  png_destroy_write_struct(&(e->png_ptr), &(e->info_ptr));
+
+  free(e->line);
+  free(e);
+
+  return 0;
+}
+
+/******************************************************************************/
@@ -27,13 +27,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define __PNG__
 
 #include "geoquadtree.h"
+#include "fcgi.h"
+#include "quantize.h"
+
+int readtile_buffer(gqt *, unsigned char *, unsigned long, unsigned char *,
+                    unsigned, unsigned, unsigned, unsigned);
+
+int readtile_fd(gqt *, int, unsigned char *,
+                unsigned, unsigned, unsigned, unsigned);
 
 int readtile(gqt *, char *, unsigned char *,
              unsigned, unsigned, unsigned, unsigned);
 
 image *read_png(char *);
 
-int write_png(image *, char *);
+int write_png(image *, char *, output_stream *);
+
+typedef struct png_encoder png_encoder;  /* Image being written by rows */
+
+png_encoder *png_encoder_begin(unsigned long, unsigned long, palette *,
+                               output_stream *);
+
+int png_encoder_rows(png_encoder *, unsigned char *, unsigned long);
+
+int png_encoder_end(png_encoder *);
 
 #endif
 
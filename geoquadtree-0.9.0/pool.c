@@ -0,0 +1,289 @@
+/*
+
+pool.c - GeoQuadTree pools of buffers reused between requests
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+extern int verbose_level;
+
+/* Large buffers are kept in free lists by power of two size classes and
+   shared by the threads. Each buffer is preceded by a header with its
+   class, or POOL_CLASSES if it is too large to be kept */
+
+typedef union
+{
+  int size_class;
+  double align[2];
+} pool_header;
+
+void *pool_list[POOL_CLASSES];  /* Free buffers, linked through their data */
+unsigned long pool_bytes=0;     /* Of the free buffers */
+pthread_mutex_t pool_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+/* Small temporaries are taken from an arena of each thread, released in
+   the reverse order they were allocated */
+
+pthread_key_t arena_key;
+pthread_once_t arena_once=PTHREAD_ONCE_INIT;
+
+/******************************************************************************/
+
+void *pool_alloc(unsigned long size)
+{
+  /* Returns an uninitialised buffer of at least size bytes, reusing one
+     that was freed before if possible */
+
+  pool_header *h;
+  int c;
+
+  for (c=0; ((c<POOL_CLASSES)&&((1UL<<(POOL_MIN_SHIFT+c))<size)); c++);
+
+  h=NULL;
+
+  if (c<POOL_CLASSES)
+  {
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_list[c]!=NULL)
+    {
+      h=(pool_header *)pool_list[c];
+      pool_list[c]=*(void **)(h+1);
+      pool_bytes-=(1UL<<(POOL_MIN_SHIFT+c));
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (h==NULL) h=malloc(sizeof(pool_header)+(1UL<<(POOL_MIN_SHIFT+c)));
+  }
+  else
+    h=malloc(sizeof(pool_header)+size);
+
+  if (h==NULL) { fprintf(stderr, "pool_alloc: malloc\n"); exit(1); }
+
+  h->size_class=c;
+
+  return h+1;
+}
+
+/******************************************************************************/
+
+unsigned long pool_size(unsigned long size)
+{
+  /* Bytes that pool_alloc takes for a buffer of size bytes */
+
+  int c;
+
+  for (c=0; ((c<POOL_CLASSES)&&((1UL<<(POOL_MIN_SHIFT+c))<size)); c++);
+
+  if (c<POOL_CLASSES) return 1UL<<(POOL_MIN_SHIFT+c);
+
+  return size;
+}
+
+/******************************************************************************/
+
+void pool_free(void *buffer)
+{
+  /* Returns a buffer of pool_alloc to its free list, or to the system if
+     the free lists already keep POOL_MAX_BYTES */
+
+  pool_header *h;
+  unsigned long size;
+
+  if (buffer==NULL) return;
+
+  h=(pool_header *)buffer-1;
+
+  if (h->size_class==POOL_CLASSES) { free(h); return; }
+
+  size=1UL<<(POOL_MIN_SHIFT+h->size_class);
+
+  pthread_mutex_lock(&pool_mutex);
+  if (pool_bytes+size<=POOL_MAX_BYTES)
+  {
+    *(void **)buffer=pool_list[h->size_class];
+    pool_list[h->size_class]=h;
+    pool_bytes+=size;
+    h=NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  if (h!=NULL) free(h);
+}
+
+/******************************************************************************/
+
+void arena_destroy(void *arg)
+{
+  arena *a=(arena *)arg;
+  arena_chunk *chunk, *next;
+
+  for (chunk=a->first; (chunk!=NULL); chunk=next)
+  {
+    next=(arena_chunk *)chunk->next;
+    free(chunk->buffer);
+    free(chunk);
+  }
+
+  free(a);
+}
+
+/******************************************************************************/
+
+void arena_key_new(void)
+{
+  pthread_key_create(&arena_key, arena_destroy);
+}
+
+/******************************************************************************/
+
+arena *arena_thread(void)
+{
+  /* Returns the arena of the calling thread, creating it the first time */
+
+  arena *a;
+
+  pthread_once(&arena_once, arena_key_new);
+
+  a=(arena *)pthread_getspecific(arena_key);
+  if (a!=NULL) return a;
+
+  a=malloc(sizeof(arena));
+  if (a==NULL) { fprintf(stderr, "arena_thread: malloc\n"); exit(1); }
+
+  a->first=NULL;
+  a->current=NULL;
+
+  pthread_setspecific(arena_key, a);
+
+  return a;
+}
+
+/******************************************************************************/
+
+arena_chunk *arena_chunk_new(unsigned long size)
+{
+  arena_chunk *chunk;
+
+  chunk=malloc(sizeof(arena_chunk));
+  if (chunk==NULL) { fprintf(stderr, "arena_chunk_new: malloc\n"); exit(1); }
+
+  chunk->size=(size>ARENA_CHUNK)?size:ARENA_CHUNK;
+  chunk->used=0;
+  chunk->next=NULL;
+
+  chunk->buffer=malloc(chunk->size);
+  if (chunk->buffer==NULL)
+  { fprintf(stderr, "arena_chunk_new: malloc\n"); exit(1); }
+
+  if (verbose_level>1) printf("arena_chunk_new %lu\n", chunk->size);
+
+  return chunk;
+}
+
+/******************************************************************************/
+
+void *arena_alloc(unsigned long size)
+{
+  /* Returns size bytes of the arena of the calling thread, valid until
+     the arena is restored to a mark taken before. The chunks of the arena
+     are kept, so once it has grown no memory is requested any more */
+
+  arena *a=arena_thread();
+  arena_chunk *chunk;
+  void *p;
+
+  size=(size+15)&~15UL;
+
+  if (a->first==NULL)
+  {
+    a->first=arena_chunk_new(size);
+    a->current=a->first;
+  }
+
+  chunk=a->current;
+
+  while (chunk->used+size>chunk->size)
+  {
+    if (chunk->next==NULL)
+      chunk->next=(struct arena_chunk *)arena_chunk_new(size);
+
+    chunk=(arena_chunk *)chunk->next;
+    chunk->used=0;
+  }
+
+  a->current=chunk;
+
+  p=chunk->buffer+chunk->used;
+  chunk->used+=size;
+
+  return p;
+}
+
+/******************************************************************************/
+
+arena_mark arena_save(void)
+{
+  /* Marks the current top of the arena of the calling thread */
+
+  arena *a=arena_thread();
+  arena_mark m;
+
+  m.chunk=a->current;
+  m.used=(a->current!=NULL)?a->current->used:0;
+
+  return m;
+}
+
+/******************************************************************************/
+
+void arena_restore(arena_mark m)
+{
+  /* Frees everything allocated in the arena since the mark was taken */
+
+  arena *a=arena_thread();
+
+  if (m.chunk==NULL) m.chunk=a->first;
+  if (m.chunk==NULL) return;
+
+  a->current=m.chunk;
+  a->current->used=m.used;
+}
+
+/******************************************************************************/
+
+void arena_reset(void)
+{
+  /* Frees everything allocated in the arena of the calling thread, after
+     a request that may have not released its temporaries */
+
+  arena_mark m;
+
+  m.chunk=NULL;
+  m.used=0;
+
+  arena_restore(m);
+}
+
+/******************************************************************************/
@@ -0,0 +1,70 @@
+/*
+
+pool.h - GeoQuadTree pools of buffers reused between requests
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__POOL__)
+
+#define __POOL__
+
+#define POOL_MIN_SHIFT 12  /* Smallest size class, 4 KB */
+#define POOL_CLASSES 17    /* Size classes, up to 256 MB */
+#define POOL_MAX_BYTES (256UL*1024*1024)  /* Free buffers kept per process */
+#define ARENA_CHUNK (256*1024)  /* Bytes a thread arena grows at once */
+
+typedef struct
+{
+  char *buffer;
+  unsigned long size;
+  unsigned long used;
+  struct arena_chunk *next;
+} arena_chunk;
+
+typedef struct
+{
+  arena_chunk *first;
+  arena_chunk *current;  /* Chunk being filled, the next ones are free */
+} arena;
+
+typedef struct
+{
+  arena_chunk *chunk;
+  unsigned long used;
+} arena_mark;
+
+void *pool_alloc(unsigned long);
+
+void pool_free(void *);
+
+unsigned long pool_size(unsigned long);
+
+void *arena_alloc(unsigned long);
+
+arena_mark arena_save(void);
+
+void arena_restore(arena_mark);
+
+void arena_reset(void);
+
+#endif
+
+/******************************************************************************/
@@ -22,13 +22,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 /******************************************************************************/
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "proj.h"
 
 #define SRS_MAX_LENGTH 8192
 
+/* The spatial references are shared by all the threads of the WMS server,
+   and creating a transformation from them is not reentrant. Once created,
+   a transformation is used by one thread only, without locking */
+
+pthread_mutex_t proj_mutex=PTHREAD_MUTEX_INITIALIZER;
+
 /******************************************************************************/
 
 int srs_import_file(srs *p_srs, char *srs_filename)
@@ -36,15 +44,24 @@ int srs_import_file(srs *p_srs, char *srs_filename)
   char *str, *str0;
   FILE *fp;
 
+  fp=fopen(srs_filename, "rt");
+  if (fp==NULL) return 1;
+
   str=malloc(SRS_MAX_LENGTH);
+  if (str==NULL) { fprintf(stderr, "srs_import_file: malloc\n"); exit(1); }
   str0=str;
-  fp=fopen(srs_filename, "rt");
-  fgets(str, SRS_MAX_LENGTH, fp);
+
+  if (fgets(str, SRS_MAX_LENGTH, fp)==NULL) str[0]=0;
   fclose(fp);
 
   *p_srs=OSRNewSpatialReference(NULL);
   if (OSRImportFromWkt(*p_srs, &str) != OGRERR_NONE)
-  { fprintf(stderr, "Importing dataset projection failed"); return 1; }
+  {
+    fprintf(stderr, "Importing dataset projection failed");
+    OSRDestroySpatialReference(*p_srs);
+    free(str0);
+    return 1;
+  }
 
   free(str0);
 
@@ -96,44 +113,56 @@ int srs_import(srs *p_srs, char *srs_type, char *srs_definition)
 
 /******************************************************************************/
 
-int proj_transform(srs *p_src, long count, double *x, double *y, srs *p_dst)
+transformation proj_new(srs *p_src, srs *p_dst)
 {
-  OGRCoordinateTransformationH *p_ct;
-  //long i;
+  /* Creates the transformation from p_src to p_dst, to transform many
+     batches of points with proj_apply. Returns NULL if it fails */
 
-  p_ct=OCTNewCoordinateTransformation(p_src, p_dst);
+  transformation ct;
 
-  if (p_ct==NULL)
-  { fprintf(stderr, "OGRCreateCoordinateTransformation\n"); return 1; }
+  pthread_mutex_lock(&proj_mutex);
+  ct=OCTNewCoordinateTransformation(p_src, p_dst);
+  pthread_mutex_unlock(&proj_mutex);
 
-  /*
-  if (p_src->in_degrees==1)
-  {
-    for (i=0; (i<count); i++)
-    {
-      x[i]*=DEG_TO_RAD;
-      y[i]*=DEG_TO_RAD;
-    }
-  }
-  */
+  if (ct==NULL) fprintf(stderr, "OGRCreateCoordinateTransformation\n");
 
-  if (!(OCTTransform(p_ct, count, x, y, NULL)))
-  { fprintf(stderr, "OCTTransform\n"); return 1; }
+  return ct;
+}
 
-  /*
-  if (p_dst->in_degrees==1)
-  {
-    for (i=0; (i<count); i++)
-    {
-      x[i]*=RAD_TO_DEG;
-      y[i]*=RAD_TO_DEG;
-    }
-  }
-  */
+/******************************************************************************/
 
-  OCTDestroyCoordinateTransformation(p_ct);
+int proj_apply(transformation ct, long count, double *x, double *y)
+{
+  if (!(OCTTransform(ct, count, x, y, NULL)))
+  { fprintf(stderr, "OCTTransform\n"); return 1; }
 
   return 0;
 }
 
 /******************************************************************************/
+
+void proj_free(transformation ct)
+{
+  if (ct!=NULL) OCTDestroyCoordinateTransformation(ct);
+}
+
+/******************************************************************************/
+
+int proj_transform(srs *p_src, long count, double *x, double *y, srs *p_dst)
+{
+  /* Transforms a single batch of points */
+
+  transformation ct;
+  int ret;
+
+  ct=proj_new(p_src, p_dst);
+  if (ct==NULL) return 1;
+
+  ret=proj_apply(ct, count, x, y);
+
+  proj_free(ct);
+
+  return ret;
+}
+
+/******************************************************************************/
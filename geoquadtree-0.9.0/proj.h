@@ -30,9 +30,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 typedef OGRSpatialReferenceH srs;
 
+typedef OGRCoordinateTransformationH transformation;
+
 int srs_import_file(srs *, char *);
 int srs_import(srs *, char *, char *);
 
+transformation proj_new(srs *, srs *);
+
+int proj_apply(transformation, long, double *, double *);
+
+void proj_free(transformation);
+
 int proj_transform(srs *, long, double *, double *, srs *);
 
 #endif
@@ -0,0 +1,380 @@
+/*
+
+quantize.c - GeoQuadTree colour quantisation
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quantize.h"
+
+extern int verbose_level;
+
+/******************************************************************************/
+
+long channel_distance(long c, long lo, long hi, long *max)
+{
+  /* Distance from c to the nearest and, in max, to the farthest of the
+     values from lo to hi */
+
+  *max=(c-lo>hi-c)?c-lo:hi-c;
+
+  if (c<lo) return lo-c;
+  if (c>hi) return c-hi;
+  return 0;
+}
+
+/******************************************************************************/
+
+void palette_cell(palette *p, long r, long g, long b, long size,
+                  int *candidates, int num_candidates)
+{
+  /* Finds the nearest colour of the palette to the 15 bit colours of the
+     cell of size x size x size from (r, g, b), among the candidates. Only
+     the candidates whose nearest distance to the cell is not over the
+     farthest distance of some candidate can be the nearest colour to any
+     of its colours. These are passed on to the eight halves of the cell,
+     or compared with each colour of a small cell */
+
+  long half, far, bound, dr, dg, db, far_r, far_g, far_b, d, best_d;
+  long nears[PALETTE_COLORS], cr, cg, cb;
+  int kept[PALETTE_COLORS], num_kept, i, c, best;
+
+  bound=-1;
+
+  for (i=0; (i<num_candidates); i++)
+  {
+    c=candidates[i];
+
+    dr=channel_distance(p->color[c][0], (r<<3)+4, ((r+size-1)<<3)+4, &far_r);
+    dg=channel_distance(p->color[c][1], (g<<3)+4, ((g+size-1)<<3)+4, &far_g);
+    db=channel_distance(p->color[c][2], (b<<3)+4, ((b+size-1)<<3)+4, &far_b);
+
+    nears[i]=dr*dr+dg*dg+db*db;
+    far=far_r*far_r+far_g*far_g+far_b*far_b;
+
+    if ((bound<0)||(far<bound)) bound=far;
+  }
+
+  num_kept=0;
+
+  for (i=0; (i<num_candidates); i++)
+    if (nears[i]<=bound) kept[num_kept++]=candidates[i];
+
+  if (size>PALETTE_CELL)
+  {
+    half=size/2;
+
+    for (i=0; (i<8); i++)
+      palette_cell(p, r+((i>>2)&1)*half, g+((i>>1)&1)*half, b+(i&1)*half,
+                   half, kept, num_kept);
+    return;
+  }
+
+  /* Ties go to the first colour of the palette, as the candidates keep
+     its order */
+
+  for (cr=r; (cr<r+size); cr++)
+  for (cg=g; (cg<g+size); cg++)
+  for (cb=b; (cb<b+size); cb++)
+  {
+    best=kept[0];
+    best_d=-1;
+
+    for (i=0; (i<num_kept); i++)
+    {
+      c=kept[i];
+
+      dr=(cr<<3)+4-p->color[c][0];
+      dg=(cg<<3)+4-p->color[c][1];
+      db=(cb<<3)+4-p->color[c][2];
+      d=dr*dr+dg*dg+db*db;
+
+      if ((best_d<0)||(d<best_d)) { best_d=d; best=c; }
+    }
+
+    p->lookup[(cr<<10)|(cg<<5)|cb]=best;
+  }
+}
+
+/******************************************************************************/
+
+void palette_index(palette *p)
+{
+  /* Finds the nearest colour of the palette to every 15 bit colour, so
+     that mapping a pixel is a single lookup. The colour cube is split as
+     an octree, narrowing at each level the colours that can be the
+     nearest ones */
+
+  int candidates[PALETTE_COLORS], i;
+
+  for (i=1; (i<p->num_colors); i++) candidates[i-1]=i;
+
+  palette_cell(p, 0, 0, 0, 32, candidates, p->num_colors-1);
+}
+
+/******************************************************************************/
+
+palette *palette_new(void)
+{
+  palette *p;
+
+  p=malloc(sizeof(palette));
+  if (p==NULL) { fprintf(stderr, "palette_new: malloc\n"); exit(1); }
+
+  /* The first entry is kept for transparent pixels */
+
+  p->num_colors=1;
+  p->color[0][0]=0; p->color[0][1]=0; p->color[0][2]=0;
+
+  return p;
+}
+
+/******************************************************************************/
+
+palette *palette_read(char *filename)
+{
+  /* Reads a fixed palette, one "red green blue" colour per line. Empty
+     lines and lines starting with # are skipped */
+
+  FILE *fp;
+  palette *p;
+  char line[256];
+  int r, g, b;
+
+  fp=fopen(filename, "r");
+  if (fp==NULL)
+  { fprintf(stderr, "palette_read: fopen %s\n", filename); return NULL; }
+
+  p=palette_new();
+
+  while ((fgets(line, sizeof(line), fp)!=NULL)&&(p->num_colors<PALETTE_COLORS))
+  {
+    if (line[0]=='#') continue;
+    if (sscanf(line, "%i %i %i", &r, &g, &b)!=3) continue;
+
+    p->color[p->num_colors][0]=r;
+    p->color[p->num_colors][1]=g;
+    p->color[p->num_colors][2]=b;
+    p->num_colors++;
+  }
+
+  fclose(fp);
+
+  if (p->num_colors==1)
+  {
+    fprintf(stderr, "palette_read: no colours in %s\n", filename);
+    free(p);
+    return NULL;
+  }
+
+  palette_index(p);
+
+  return p;
+}
+
+/******************************************************************************/
+
+octree_node *octree_new(octree_node **reducible, int level)
+{
+  octree_node *n;
+
+  n=calloc(1, sizeof(octree_node));
+  if (n==NULL) { fprintf(stderr, "octree_new: malloc\n"); exit(1); }
+
+  if (level==OCTREE_DEPTH) n->leaf=1;
+  else
+  {
+    n->next=(struct octree_node *)reducible[level];
+    reducible[level]=n;
+  }
+
+  return n;
+}
+
+/******************************************************************************/
+
+void octree_free(octree_node *n)
+{
+  int i;
+
+  for (i=0; (i<8); i++)
+    if (n->child[i]!=NULL) octree_free((octree_node *)n->child[i]);
+
+  free(n);
+}
+
+/******************************************************************************/
+
+int octree_reduce(octree_node **reducible)
+{
+  /* Merges into their parent the children of the deepest node that has
+     any. Returns the number of leaves removed */
+
+  octree_node *n, *c;
+  int level, i, removed;
+
+  for (level=OCTREE_DEPTH-1; ((level>0)&&(reducible[level]==NULL)); level--);
+
+  n=reducible[level];
+  if (n==NULL) return 0;
+  reducible[level]=(octree_node *)n->next;
+
+  removed=-1;
+
+  for (i=0; (i<8); i++)
+  {
+    c=(octree_node *)n->child[i];
+    if (c==NULL) continue;
+
+    n->count+=c->count;
+    n->red+=c->red;
+    n->green+=c->green;
+    n->blue+=c->blue;
+
+    free(c);
+    n->child[i]=NULL;
+    removed++;
+  }
+
+  n->leaf=1;
+
+  return removed;
+}
+
+/******************************************************************************/
+
+void octree_palette(octree_node *n, palette *p)
+{
+  int i;
+
+  if (n->leaf==1)
+  {
+    if ((n->count>0)&&(p->num_colors<PALETTE_COLORS))
+    {
+      p->color[p->num_colors][0]=n->red/n->count;
+      p->color[p->num_colors][1]=n->green/n->count;
+      p->color[p->num_colors][2]=n->blue/n->count;
+      p->num_colors++;
+    }
+    return;
+  }
+
+  for (i=0; (i<8); i++)
+    if (n->child[i]!=NULL) octree_palette((octree_node *)n->child[i], p);
+}
+
+/******************************************************************************/
+
+palette *palette_octree(unsigned char *rgba, unsigned long pixels, int colors)
+{
+  /* Builds a palette of at most colors opaque colours for an image with
+     an octree, in a single pass over its pixels. The branches of the tree
+     are merged from the deepest ones up whenever it has too many leaves */
+
+  octree_node *root, *n, *reducible[OCTREE_DEPTH];
+  unsigned long i;
+  unsigned char *s;
+  int level, k, leaves;
+  palette *p;
+
+  if (colors>PALETTE_COLORS-1) colors=PALETTE_COLORS-1;
+
+  for (level=0; (level<OCTREE_DEPTH); level++) reducible[level]=NULL;
+
+  root=octree_new(reducible, 0);
+  leaves=0;
+
+  for (i=0, s=rgba; (i<pixels); i++, s+=4)
+  {
+    if (s[3]<128) continue;
+
+    n=root;
+
+    for (level=0; ((level<OCTREE_DEPTH)&&(n->leaf==0)); level++)
+    {
+      k=(((s[0]>>(7-level))&1)<<2)|(((s[1]>>(7-level))&1)<<1)|
+        ((s[2]>>(7-level))&1);
+
+      if (n->child[k]==NULL)
+      {
+        n->child[k]=(struct octree_node *)octree_new(reducible, level+1);
+        if (level+1==OCTREE_DEPTH) leaves++;
+      }
+
+      n=(octree_node *)n->child[k];
+    }
+
+    n->count++;
+    n->red+=s[0];
+    n->green+=s[1];
+    n->blue+=s[2];
+
+    while (leaves>colors) leaves-=octree_reduce(reducible);
+  }
+
+  p=palette_new();
+  octree_palette(root, p);
+  octree_free(root);
+
+  /* An image without opaque pixels still needs a colour to map to */
+
+  if (p->num_colors==1)
+  {
+    p->color[1][0]=0; p->color[1][1]=0; p->color[1][2]=0;
+    p->num_colors=2;
+  }
+
+  if (verbose_level>1) printf("palette_octree colors=%i\n", p->num_colors);
+
+  palette_index(p);
+
+  return p;
+}
+
+/******************************************************************************/
+
+void palette_map(palette *p, unsigned char *rgba, unsigned long pixels,
+                 unsigned char *indexed)
+{
+  /* Converts pixels to palette indices. Mostly transparent pixels go to
+     the transparent entry */
+
+  unsigned long i;
+
+  for (i=0; (i<pixels); i++, rgba+=4)
+  {
+    if (rgba[3]<128) indexed[i]=0;
+    else
+      indexed[i]=p->lookup[((rgba[0]>>3)<<10)|((rgba[1]>>3)<<5)|(rgba[2]>>3)];
+  }
+}
+
+/******************************************************************************/
+
+void palette_free(palette *p)
+{
+  free(p);
+}
+
+/******************************************************************************/
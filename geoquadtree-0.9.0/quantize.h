@@ -0,0 +1,61 @@
+/*
+
+quantize.h - GeoQuadTree colour quantisation
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__QUANTIZE__)
+
+#define __QUANTIZE__
+
+#define PALETTE_COLORS 256  /* Entries of a palette, the first transparent */
+#define OCTREE_DEPTH 6      /* Bits per channel told apart by the octree */
+#define PALETTE_CELL 4      /* Side of the smallest cell of palette_index */
+
+typedef struct
+{
+  int num_colors;                          /* Including the transparent one */
+  unsigned char color[PALETTE_COLORS][3];
+  unsigned char lookup[32768];             /* Index of each 15 bit colour */
+} palette;
+
+typedef struct
+{
+  unsigned long count;
+  unsigned long red, green, blue;
+  int leaf;
+  struct octree_node *child[8];
+  struct octree_node *next;                /* Next reducible node */
+} octree_node;
+
+palette *palette_read(char *);
+
+palette *palette_octree(unsigned char *, unsigned long, int);
+
+void palette_index(palette *);
+
+void palette_map(palette *, unsigned char *, unsigned long, unsigned char *);
+
+void palette_free(palette *);
+
+#endif
+
+/******************************************************************************/
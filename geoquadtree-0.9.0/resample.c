@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <string.h>
 
 #include "proj.h"
+#include "composite.h"
+#include "pool.h"
 
 double r_resample(double);
 double r_resample_calc(double);
@@ -99,20 +101,24 @@ int resample_bicubic(unsigned char *image_src,
              unsigned char *image_dst,
              unsigned long width_dst, unsigned long height_dst,
              srs *srs_dst,
-             double xmin_dst, double ymin_dst, double xmax_dst, double ymax_dst)
+             double xmin_dst, double ymin_dst, double xmax_dst, double ymax_dst,
+             transformation ct, coverage *cov, int under)
 {
   double pixel_width_src, pixel_height_src;
   double pixel_width_dst, pixel_height_dst;
   long col_src, row_src;
   long col_dst, row_dst;
+  long col_first, col_last, num;
   long i, j, m, n;
   double x_dst, y_dst;
   double dx, dy;
   double f_r, f_g, f_b, f_a;
   double ff;
+  unsigned char pixel[4];
   unsigned long p_src;
   unsigned long p_dst;
   double *x, *y;
+  arena_mark mark;
   double xx, yy;
 
   pixel_width_src=(xmax_src-xmin_src)/width_src;
@@ -121,21 +127,32 @@ int resample_bicubic(unsigned char *image_src,
   pixel_width_dst=(xmax_dst-xmin_dst)/width_dst;
   pixel_height_dst=(ymax_dst-ymin_dst)/height_dst;
 
-  x=malloc(width_dst*sizeof(double));
-  if (x==NULL) { printf("malloc x\n"); exit(1); }
-
-  y=malloc(width_dst*sizeof(double));
-  if (y==NULL) { printf("malloc y\n"); exit(1); }
-
-  p_dst=0;
+  mark=arena_save();
+  x=arena_alloc(width_dst*sizeof(double));
+  y=arena_alloc(width_dst*sizeof(double));
 
   y_dst=ymax_dst;
 
   for (row_dst=height_dst-1; (row_dst>=0); row_dst--)
   {
-    x_dst=xmin_dst;
+    /* Only the span of the row that is not opaque yet is resampled */
 
-    for (col_dst=0; (col_dst<width_dst); col_dst++)
+    col_first=0;
+    col_last=width_dst-1;
+
+    if (cov!=NULL)
+    {
+      col_first=cov->first[height_dst-1-row_dst];
+      col_last=cov->last[height_dst-1-row_dst];
+
+      if (col_first>col_last) { y_dst-=pixel_height_dst; continue; }
+    }
+
+    num=col_last-col_first+1;
+
+    x_dst=xmin_dst+col_first*pixel_width_dst;
+
+    for (col_dst=0; (col_dst<num); col_dst++)
     {
       x[col_dst]=x_dst;
       y[col_dst]=y_dst;
@@ -143,10 +160,11 @@ int resample_bicubic(unsigned char *image_src,
       x_dst+=pixel_width_dst;
     }
 
-    if (srs_src!=srs_dst)
-	  proj_transform(srs_dst, width_dst, x, y, srs_src);
+    if (ct!=NULL) proj_apply(ct, num, x, y);
+
+    p_dst=((height_dst-1-row_dst)*width_dst+col_first)*4;
 
-    for (col_dst=0; (col_dst<width_dst); col_dst++)
+    for (col_dst=0; (col_dst<num); col_dst++)
     {
       xx=(x[col_dst]-xmin_src)/(xmax_src-xmin_src)*width_src;
       yy=(y[col_dst]-ymin_src)/(ymax_src-ymin_src)*height_src;
@@ -196,17 +214,29 @@ int resample_bicubic(unsigned char *image_src,
       if (f_b>255) f_b=255;
       if (f_a>255) f_a=255;
 
-      image_dst[p_dst++]=f_r;
-      image_dst[p_dst++]=f_g;
-      image_dst[p_dst++]=f_b;
-      image_dst[p_dst++]=f_a;
+      if (under==0)
+      {
+        image_dst[p_dst++]=f_r;
+        image_dst[p_dst++]=f_g;
+        image_dst[p_dst++]=f_b;
+        image_dst[p_dst++]=f_a;
+      }
+      else
+      {
+        pixel[0]=f_r;
+        pixel[1]=f_g;
+        pixel[2]=f_b;
+        pixel[3]=f_a;
+
+        COMPOSITE_PIXEL(image_dst+p_dst, pixel);
+        p_dst+=4;
+      }
     }
 
     y_dst-=pixel_height_dst;
   }
   
-  free(x);
-  free(y);
+  arena_restore(mark);
 
   return 0;
 }
@@ -220,14 +250,17 @@ int resample_nearest(unsigned char *image_src,
              unsigned char *image_dst,
              unsigned long width_dst, unsigned long height_dst,
              srs *srs_dst,
-             double xmin_dst, double ymin_dst, double xmax_dst, double ymax_dst)
+             double xmin_dst, double ymin_dst, double xmax_dst, double ymax_dst,
+             coverage *cov, int under)
 {
   double pixel_width_src, pixel_height_src;
   double pixel_width_dst, pixel_height_dst;
   long col_dst, row_dst;
+  long col_first, col_last, num;
   long i, j;
   double x_dst, y_dst;
   double *x, *y;
+  arena_mark mark;
   unsigned long p_src;
   unsigned long p_dst;
   double mx, my;
@@ -256,25 +289,44 @@ int resample_nearest(unsigned char *image_src,
     printf("resample_nearest fx_inc=%f fy_inc=%f\n", fx_inc, fy_inc);
   }
 
-  p_dst=0;
-
   if (srs_src!=srs_dst)
   {
     fy=(ymax_dst-ymin_src)*my;
 
     for (row_dst=height_dst-1; (row_dst>=0); row_dst--)
     {
-      fx=(xmin_dst-xmin_src)*mx;
+      col_first=0;
+      col_last=width_dst-1;
+
+      if (cov!=NULL)
+      {
+        col_first=cov->first[height_dst-1-row_dst];
+        col_last=cov->last[height_dst-1-row_dst];
+
+        if (col_first>col_last) { fy-=fy_inc; continue; }
+      }
 
-      for (col_dst=0; (col_dst<width_dst); col_dst++)
+      fx=(xmin_dst-xmin_src)*mx+col_first*fx_inc;
+
+      p_dst=((height_dst-1-row_dst)*width_dst+col_first)*4;
+
+      for (col_dst=col_first; (col_dst<=col_last); col_dst++)
       {
         p_src=((double)height_src-fy)*width_src+fx;
         p_src=p_src<<2;
 
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src];
+        if (under==0)
+        {
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src];
+        }
+        else
+        {
+          COMPOSITE_PIXEL(image_dst+p_dst, image_src+p_src);
+          p_dst+=4;
+        }
 
         fx+=fx_inc;
       }
@@ -284,19 +336,30 @@ int resample_nearest(unsigned char *image_src,
   }
   else
   {
-    x=malloc(width_dst*sizeof(double));
-    if (x==NULL) { printf("malloc x\n"); exit(1); }
-
-    y=malloc(width_dst*sizeof(double));
-    if (y==NULL) { printf("malloc x\n"); exit(1); }
+    mark=arena_save();
+    x=arena_alloc(width_dst*sizeof(double));
+    y=arena_alloc(width_dst*sizeof(double));
 
     y_dst=ymax_dst;
 
     for (row_dst=height_dst-1; (row_dst>=0); row_dst--)
     {
-      x_dst=xmin_dst;
+      col_first=0;
+      col_last=width_dst-1;
 
-      for (col_dst=0; (col_dst<width_dst); col_dst++)
+      if (cov!=NULL)
+      {
+        col_first=cov->first[height_dst-1-row_dst];
+        col_last=cov->last[height_dst-1-row_dst];
+
+        if (col_first>col_last) { y_dst-=pixel_height_dst; continue; }
+      }
+
+      num=col_last-col_first+1;
+
+      x_dst=xmin_dst+col_first*pixel_width_dst;
+
+      for (col_dst=0; (col_dst<num); col_dst++)
       {
         x[col_dst]=x_dst;
         y[col_dst]=y_dst;
@@ -304,26 +367,36 @@ int resample_nearest(unsigned char *image_src,
         x_dst+=pixel_width_dst;
       }
 
-      proj_transform(srs_dst, width_dst, x, y, srs_src);
+      /* Both rasters are in the same SRS, so the points need no
+         transformation */
 
-      for (col_dst=0; (col_dst<width_dst); col_dst++)
+      p_dst=((height_dst-1-row_dst)*width_dst+col_first)*4;
+
+      for (col_dst=0; (col_dst<num); col_dst++)
       {
         i=(x[col_dst]-xmin_src)*mx;
         j=(y[col_dst]-ymin_src)*my;
 
         p_src=((height_src-j-1)*width_src+i)*4;
 
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src++];
-        image_dst[p_dst++]=image_src[p_src];
+        if (under==0)
+        {
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src++];
+          image_dst[p_dst++]=image_src[p_src];
+        }
+        else
+        {
+          COMPOSITE_PIXEL(image_dst+p_dst, image_src+p_src);
+          p_dst+=4;
+        }
       }
 
       y_dst-=pixel_height_dst;
     }
 
-    free(x);
-    free(y);
+    arena_restore(mark);
   }
 
   return 0;
@@ -339,8 +412,17 @@ int resample(unsigned char *image_src,
              unsigned long width_dst, unsigned long height_dst,
              srs *srs_dst,
              double xmin_dst, double ymin_dst, double xmax_dst, double ymax_dst,
-             int filter)
+             int filter, coverage *cov, int under)
 {
+  /* Resamples image_src into image_dst, only inside the spans of cov not
+     yet opaque if it is not NULL. With under, image_dst is an accumulation
+     buffer (premultiplied) and each pixel is put under it as soon as it is
+     computed, instead of being written. Returns 1 if the SRS of image_dst
+     cannot be transformed to the one of image_src */
+
+  transformation ct;
+  int ret;
+
   if (verbose_level>1)
   {
     printf("resample width_src=%lu height_src=%lu\n", width_src, height_src);
@@ -359,15 +441,29 @@ int resample(unsigned char *image_src,
     return resample_nearest(image_src, width_src, height_src,
                             srs_src, xmin_src, ymin_src, xmax_src, ymax_src,
                             image_dst, width_dst, height_dst,
-                            srs_dst, xmin_dst, ymin_dst, xmax_dst, ymax_dst);
+                            srs_dst, xmin_dst, ymin_dst, xmax_dst, ymax_dst,
+                            cov, under);
   }
-  else
+
+  /* The transformation is created once for all the rows */
+
+  ct=NULL;
+
+  if (srs_src!=srs_dst)
   {
-    return resample_bicubic(image_src, width_src, height_src,
-                            srs_src, xmin_src, ymin_src, xmax_src, ymax_src,
-                            image_dst, width_dst, height_dst,
-                            srs_dst, xmin_dst, ymin_dst, xmax_dst, ymax_dst);
+    ct=proj_new(srs_dst, srs_src);
+    if (ct==NULL) return 1;
   }
+
+  ret=resample_bicubic(image_src, width_src, height_src,
+                       srs_src, xmin_src, ymin_src, xmax_src, ymax_src,
+                       image_dst, width_dst, height_dst,
+                       srs_dst, xmin_dst, ymin_dst, xmax_dst, ymax_dst,
+                       ct, cov, under);
+
+  proj_free(ct);
+
+  return ret;
 }
 
 /******************************************************************************/
@@ -27,6 +27,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #define __RESAMPLE__
 
 #include "proj.h"
+#include "composite.h"
 
 void init_resample(void);
 
@@ -34,7 +35,7 @@ int resample(unsigned char *, unsigned long, unsigned long,
              srs *, double, double, double, double,
              unsigned char *, unsigned long, unsigned long,
              srs *, double, double, double, double,
-             int);
+             int, coverage *, int);
 
 #endif
 
@@ -0,0 +1,54 @@
+/*
+
+check.h - GeoQuadTree unit test checks
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__CHECK__)
+
+#define __CHECK__
+
+#include <stdio.h>
+
+int check_failures=0;  /* Checks failed by the test */
+
+/* Reports a condition that does not hold, and goes on with the test */
+
+#define CHECK(condition) \
+{ \
+  if (!(condition)) \
+  { \
+    fprintf(stderr, "%s:%i: %s\n", __FILE__, __LINE__, #condition); \
+    check_failures++; \
+  } \
+}
+
+/* Ends a test, returning 1 if any check failed */
+
+#define CHECK_DONE(name) \
+{ \
+  printf("%s: %s\n", (name), (check_failures==0)?"ok":"FAILED"); \
+  return (check_failures!=0); \
+}
+
+#endif
+
+/******************************************************************************/
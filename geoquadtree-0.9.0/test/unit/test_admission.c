@@ -0,0 +1,205 @@
+/*
+
+test_admission.c - GeoQuadTree test of the request admission
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "admission.h"
+#include "check.h"
+
+int verbose_level=0;
+
+typedef struct
+{
+  admission *a;
+  unsigned long cost;
+  int result;
+  int order;         /* Of admission, from 1, or 0 if not admitted yet */
+} request;
+
+pthread_mutex_t order_mutex=PTHREAD_MUTEX_INITIALIZER;
+int admitted=0;
+
+/******************************************************************************/
+
+void *enter(void *arg)
+{
+  /* Enters, notes the order of admission and leaves */
+
+  request *r=(request *)arg;
+
+  r->result=admission_enter(r->a, r->cost);
+
+  if (r->result==ADMISSION_ADMITTED)
+  {
+    pthread_mutex_lock(&order_mutex);
+    r->order=++admitted;
+    pthread_mutex_unlock(&order_mutex);
+
+    admission_leave(r->a, r->cost);
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int queued(admission *a)
+{
+  admission_waiter *w;
+  int n;
+
+  pthread_mutex_lock(&(a->mutex));
+
+  n=0;
+  for (w=a->first; (w!=NULL); w=(admission_waiter *)w->next) n++;
+
+  pthread_mutex_unlock(&(a->mutex));
+
+  return n;
+}
+
+/******************************************************************************/
+
+void start(pthread_t *thread, request *r, admission *a, unsigned long cost,
+           int queue)
+{
+  /* Starts a request, and waits until the queue is queue long */
+
+  r->a=a;
+  r->cost=cost;
+  r->result=-1;
+  r->order=0;
+
+  pthread_create(thread, NULL, enter, r);
+
+  while (queued(a)<queue) usleep(1000);
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  admission *a;
+  pthread_t threads[3];
+  request r[3];
+  int order;
+
+  /* Requests are admitted at once while they fit */
+
+  a=admission_new(10, 1);
+
+  CHECK(admission_free(a)==10);
+  CHECK(admission_enter(a, 11)==ADMISSION_TOO_LARGE);
+  CHECK(admission_enter(a, 4)==ADMISSION_ADMITTED);
+  CHECK(admission_free(a)==6);
+  CHECK(admission_try(a, 7)==0);
+  CHECK(admission_try(a, 6)==1);
+  CHECK(admission_free(a)==0);
+
+  admission_leave(a, 6);
+  admission_leave(a, 4);
+
+  CHECK(admission_free(a)==10);
+
+  /* A costly request is not passed over by the cheaper ones behind it,
+     even when they would fit */
+
+  CHECK(admission_enter(a, 5)==ADMISSION_ADMITTED);
+
+  start(&threads[0], &r[0], a, 8, 1);
+  start(&threads[1], &r[1], a, 1, 2);
+  start(&threads[2], &r[2], a, 1, 3);
+
+  usleep(100000);
+
+  CHECK(admitted==0);
+  CHECK(admission_try(a, 1)==0);
+  CHECK(admission_free(a)==5);
+
+  admission_leave(a, 5);
+
+  for (order=0; (order<3); order++) pthread_join(threads[order], NULL);
+
+  CHECK(r[0].result==ADMISSION_ADMITTED);
+  CHECK(r[1].result==ADMISSION_ADMITTED);
+  CHECK(r[2].result==ADMISSION_ADMITTED);
+  CHECK(r[0].order==1);
+  CHECK((r[1].order==2)||(r[1].order==3));
+  CHECK((r[2].order==2)||(r[2].order==3));
+  CHECK((a->first==NULL)&&(a->last==NULL));
+  CHECK(admission_free(a)==10);
+
+  /* The first request of the queue times out, and the one behind it is
+     admitted later on */
+
+  admitted=0;
+
+  CHECK(admission_enter(a, 10)==ADMISSION_ADMITTED);
+
+  start(&threads[0], &r[0], a, 3, 1);
+  usleep(500000);
+  start(&threads[1], &r[1], a, 3, 2);
+
+  pthread_join(threads[0], NULL);
+
+  CHECK(r[0].result==ADMISSION_TIMEOUT);
+  CHECK(queued(a)==1);
+  CHECK((a->first==a->last)&&(a->first!=NULL)&&(a->first->cost==3));
+
+  admission_leave(a, 10);
+
+  pthread_join(threads[1], NULL);
+
+  CHECK(r[1].result==ADMISSION_ADMITTED);
+  CHECK(r[1].order==1);
+  CHECK((a->first==NULL)&&(a->last==NULL));
+
+  /* A lone request times out and leaves the queue empty */
+
+  CHECK(admission_enter(a, 10)==ADMISSION_ADMITTED);
+
+  start(&threads[0], &r[0], a, 5, 1);
+  pthread_join(threads[0], NULL);
+
+  CHECK(r[0].result==ADMISSION_TIMEOUT);
+  CHECK((a->first==NULL)&&(a->last==NULL));
+  CHECK(admission_try(a, 5)==0);
+
+  admission_leave(a, 10);
+
+  CHECK(admission_try(a, 5)==1);
+
+  admission_leave(a, 5);
+
+  CHECK(admission_free(a)==10);
+
+  free(a);
+
+  CHECK_DONE("admission");
+}
+
+/******************************************************************************/
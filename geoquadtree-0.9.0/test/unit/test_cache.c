@@ -0,0 +1,175 @@
+/*
+
+test_cache.c - GeoQuadTree test of the cache of rendered images
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "check.h"
+
+#define IMAGE 1000  /* Bytes of each cached image */
+
+int verbose_level=0;
+
+response_cache *cache;
+unsigned char image[IMAGE];
+
+/******************************************************************************/
+
+int cached(char *key, time_t last_modified)
+{
+  /* Returns 1 if the image of key is cached with its whole contents */
+
+  unsigned char buffer[IMAGE];
+  unsigned long length;
+  ssize_t n;
+  int fd;
+
+  fd=cache_get(cache, key, last_modified, &length);
+  if (fd<0) return 0;
+
+  n=read(fd, buffer, IMAGE);
+  close(fd);
+
+  return ((length==IMAGE)&&(n==IMAGE)&&(memcmp(buffer, image, IMAGE)==0));
+}
+
+/******************************************************************************/
+
+void *waiter(void *arg)
+{
+  /* A request identical to the one being rendered waits for it */
+
+  cache_flight *f;
+
+  f=cache_begin(cache, "flight", 7);
+  if (f!=NULL) { cache_end(cache, f); return NULL; }
+
+  return (void *)(long)cached("flight", 7);
+}
+
+/******************************************************************************/
+
+void remove_directory(char *path)
+{
+  char file[1024];
+  struct dirent *d;
+  DIR *dir;
+
+  dir=opendir(path);
+  if (dir==NULL) return;
+
+  while ((d=readdir(dir))!=NULL)
+  {
+    if (d->d_name[0]=='.') continue;
+
+    snprintf(file, sizeof(file), "%s/%s", path, d->d_name);
+    unlink(file);
+  }
+
+  closedir(dir);
+  rmdir(path);
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  char path[]="/tmp/gqt_test_cacheXXXXXX";
+  cache_flight *f;
+  pthread_t thread;
+  void *ret;
+  int i;
+
+  if (mkdtemp(path)==NULL)
+  { fprintf(stderr, "test_cache: mkdtemp\n"); return 1; }
+
+  for (i=0; (i<IMAGE); i++) image[i]=i%251;
+
+  cache=cache_new(path, 3*IMAGE);
+  CHECK(cache!=NULL);
+  if (cache==NULL) return 1;
+
+  /* Validators: an image is only valid for the trees it was rendered
+     from, and until its time expires */
+
+  cache_put(cache, "a", 5, 60, image, IMAGE);
+  CHECK(cached("a", 5)==1);
+  CHECK(cached("a", 6)==0);
+  CHECK(cached("a", 5)==0);  /* Removed once found stale */
+
+  cache_put(cache, "expired", 5, 0, image, IMAGE);
+  CHECK(cached("expired", 5)==0);
+
+  CHECK(cached("unknown", 5)==0);
+
+  /* Least recently used order: the image read last stays */
+
+  cache_put(cache, "k0", 5, 60, image, IMAGE);
+  cache_put(cache, "k1", 5, 60, image, IMAGE);
+  cache_put(cache, "k2", 5, 60, image, IMAGE);
+  CHECK(cache->bytes==3*IMAGE);
+
+  CHECK(cached("k0", 5)==1);
+
+  cache_put(cache, "k3", 5, 60, image, IMAGE);
+  CHECK(cache->bytes==3*IMAGE);
+  CHECK(cached("k1", 5)==0);
+  CHECK(cached("k0", 5)==1);
+  CHECK(cached("k2", 5)==1);
+  CHECK(cached("k3", 5)==1);
+
+  /* An image larger than the cache is not stored */
+
+  cache_put(cache, "k0", 5, 60, image, 4*IMAGE);
+  CHECK(cache->bytes==3*IMAGE);
+  CHECK(cached("k0", 5)==1);
+
+  /* Identical requests wait for the one rendering the image, and find it
+     cached once it is done */
+
+  f=cache_begin(cache, "flight", 7);
+  CHECK(f!=NULL);
+
+  if (pthread_create(&thread, NULL, waiter, NULL)!=0)
+  { fprintf(stderr, "test_cache: pthread_create\n"); return 1; }
+
+  usleep(100000);
+
+  cache_put(cache, "flight", 7, 60, image, IMAGE);
+  if (f!=NULL) cache_end(cache, f);
+
+  pthread_join(thread, &ret);
+  CHECK(ret==(void *)1);
+
+  remove_directory(path);
+
+  CHECK_DONE("cache");
+}
+
+/******************************************************************************/
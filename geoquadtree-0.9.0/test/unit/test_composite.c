@@ -0,0 +1,205 @@
+/*
+
+test_composite.c - GeoQuadTree test of the front-to-back compositing of rasters
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "composite.h"
+#include "check.h"
+
+#define WIDTH 64
+#define HEIGHT 48
+#define LAYERS 4
+#define TOLERANCE 3  /* Rounding difference allowed per channel */
+
+/******************************************************************************/
+
+void painter(unsigned char *dst, unsigned char **layers, int num)
+{
+  /* Reference: every layer over dst, from the bottommost to the topmost,
+     with dst opaque */
+
+  unsigned long i;
+  int k, c;
+  double alpha;
+
+  for (k=num-1; (k>=0); k--)
+  {
+    for (i=0; (i<WIDTH*HEIGHT*4); i+=4)
+    {
+      alpha=layers[k][i+3]/255.0;
+
+      for (c=0; (c<3); c++)
+        dst[i+c]=(unsigned char)(layers[k][i+c]*alpha+dst[i+c]*(1-alpha)+0.5);
+    }
+  }
+}
+
+/******************************************************************************/
+
+int max_difference(unsigned char *a, unsigned char *b)
+{
+  unsigned long i;
+  int d, max;
+
+  max=0;
+
+  for (i=0; (i<WIDTH*HEIGHT*4); i++)
+  {
+    d=abs((int)a[i]-(int)b[i]);
+    if (d>max) max=d;
+  }
+
+  return max;
+}
+
+/******************************************************************************/
+
+void fill(unsigned char *im, unsigned char *pixel)
+{
+  unsigned long i;
+
+  for (i=0; (i<WIDTH*HEIGHT*4); i++) im[i]=pixel[i%4];
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  unsigned char *layers[LAYERS], *acc, *result, *expected;
+  unsigned char background[4]={255, 255, 255, 255};
+  unsigned char red[4]={255, 0, 0, 255}, blue[4]={0, 0, 255, 255};
+  unsigned char clear[4]={0, 0, 0, 0}, half_red[4]={255, 0, 0, 128};
+  unsigned char pixel[4];
+  unsigned long i, row, col;
+  long window[4];
+  coverage *cov;
+  int k;
+
+  srand(1);
+
+  acc=malloc(WIDTH*HEIGHT*4);
+  result=malloc(WIDTH*HEIGHT*4);
+  expected=malloc(WIDTH*HEIGHT*4);
+
+  for (k=0; (k<LAYERS); k++) layers[k]=malloc(WIDTH*HEIGHT*4);
+
+  if ((acc==NULL)||(result==NULL)||(expected==NULL)||(layers[LAYERS-1]==NULL))
+  { fprintf(stderr, "test_composite: malloc\n"); return 1; }
+
+  /* Random translucent layers, the first one the topmost */
+
+  for (k=0; (k<LAYERS); k++)
+    for (i=0; (i<WIDTH*HEIGHT*4); i++) layers[k][i]=rand()%256;
+
+  memset(acc, 0, WIDTH*HEIGHT*4);
+  cov=coverage_new(WIDTH, HEIGHT);
+
+  for (k=0; (k<LAYERS); k++) composite_under(acc, layers[k], cov);
+
+  fill(result, background);
+  composite_background(result, acc, WIDTH*HEIGHT);
+
+  fill(expected, background);
+  painter(expected, layers, LAYERS);
+
+  CHECK(max_difference(result, expected)<=TOLERANCE);
+
+  coverage_free(cov);
+
+  /* An opaque layer hides the ones under it, and a transparent one lets
+     them through */
+
+  fill(layers[0], clear);
+  fill(layers[1], red);
+  fill(layers[2], blue);
+
+  memset(acc, 0, WIDTH*HEIGHT*4);
+  cov=coverage_new(WIDTH, HEIGHT);
+
+  composite_under(acc, layers[0], cov);
+  CHECK(coverage_complete(cov)==0);
+
+  composite_under(acc, layers[1], cov);
+  CHECK(coverage_complete(cov)==1);
+  CHECK(coverage_window(cov, window)==1);
+
+  fill(result, background);
+  composite_background(result, acc, WIDTH*HEIGHT);
+
+  fill(expected, red);
+  CHECK(max_difference(result, expected)==0);
+
+  coverage_free(cov);
+
+  /* Only the pixels left uncovered by a partly opaque layer are open, and
+     only they take the layers under it */
+
+  fill(layers[0], clear);
+
+  for (row=10; (row<20); row++)
+    for (col=0; (col<WIDTH); col++)
+      memcpy(layers[0]+(row*WIDTH+col)*4, red, 4);
+
+  memset(acc, 0, WIDTH*HEIGHT*4);
+  cov=coverage_new(WIDTH, HEIGHT);
+
+  composite_under(acc, layers[0], cov);
+
+  CHECK(coverage_window(cov, window)==0);
+  CHECK((window[0]==0)&&(window[1]==0));
+  CHECK((window[2]==WIDTH-1)&&(window[3]==HEIGHT-1));
+  CHECK(cov->open_rows==HEIGHT-10);
+
+  composite_under(acc, layers[2], cov);
+  CHECK(coverage_complete(cov)==1);
+
+  for (row=0; (row<HEIGHT); row++)
+  {
+    memcpy(pixel, acc+row*WIDTH*4, 4);
+    CHECK(memcmp(pixel, ((row>=10)&&(row<20))?red:blue, 4)==0);
+  }
+
+  coverage_free(cov);
+
+  /* A pixel put under a translucent one keeps the one on top in front */
+
+  pixel[0]=0; pixel[1]=0; pixel[2]=0; pixel[3]=0;
+  COMPOSITE_PIXEL(pixel, half_red);
+  COMPOSITE_PIXEL(pixel, blue);
+
+  CHECK(pixel[3]==255);
+  CHECK((pixel[0]>=127)&&(pixel[0]<=129));
+  CHECK((pixel[2]>=126)&&(pixel[2]<=128));
+
+  for (k=0; (k<LAYERS); k++) free(layers[k]);
+  free(acc);
+  free(result);
+  free(expected);
+
+  CHECK_DONE("composite");
+}
+
+/******************************************************************************/
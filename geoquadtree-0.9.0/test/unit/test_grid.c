@@ -0,0 +1,147 @@
+/*
+
+test_grid.c - GeoQuadTree test of the spatial index of raster footprints
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "grid.h"
+#include "check.h"
+
+#define FOOTPRINTS 200
+#define QUERIES 2000
+
+/******************************************************************************/
+
+double random_coordinate(void)
+{
+  return (rand()%20000)/10.0-1000;
+}
+
+/******************************************************************************/
+
+void random_bbox(double *bbox)
+{
+  double x, y;
+
+  x=random_coordinate();
+  y=random_coordinate();
+
+  bbox[0]=x;
+  bbox[1]=y;
+  bbox[2]=x+(rand()%3000)/10.0;
+  bbox[3]=y+(rand()%3000)/10.0;
+}
+
+/******************************************************************************/
+
+int intersects(double *a, double *b)
+{
+  return ((a[0]<=b[2])&&(a[2]>=b[0])&&(a[1]<=b[3])&&(a[3]>=b[1]));
+}
+
+/******************************************************************************/
+
+void check_query(grid *gr, double *footprints, double *q)
+{
+  /* The hits of the index are the footprints intersecting q, found one by
+     one, and the unbounded footprint */
+
+  unsigned char hits[FOOTPRINTS];
+  int id, num, expected, wrong;
+
+  num=grid_query(gr, q[0], q[1], q[2], q[3], hits);
+
+  expected=0;
+  wrong=0;
+
+  for (id=0; (id<FOOTPRINTS); id++)
+  {
+    if ((id==0)||(intersects(&(footprints[id*4]), q)))
+    {
+      expected++;
+      if (hits[id]!=1) wrong++;
+    }
+    else if (hits[id]!=0) wrong++;
+  }
+
+  CHECK(wrong==0);
+  CHECK(num==expected);
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  double footprints[FOOTPRINTS*4], q[4];
+  unsigned char hits[FOOTPRINTS];
+  grid *gr;
+  int id, i;
+
+  srand(1);
+
+  /* Footprint 0 is not known */
+
+  gr=grid_new(FOOTPRINTS);
+
+  for (id=1; (id<FOOTPRINTS); id++)
+  {
+    random_bbox(&(footprints[id*4]));
+    grid_set(gr, id, &(footprints[id*4]));
+  }
+
+  grid_build(gr);
+
+  for (i=0; (i<QUERIES); i++)
+  {
+    random_bbox(q);
+    check_query(gr, footprints, q);
+  }
+
+  /* Bounding boxes out of the grid, huge or infinite */
+
+  q[0]=-1e300; q[1]=-1e300; q[2]=1e300; q[3]=1e300;
+  check_query(gr, footprints, q);
+
+  q[0]=-INFINITY; q[1]=0; q[2]=INFINITY; q[3]=10;
+  check_query(gr, footprints, q);
+
+  q[0]=5000; q[1]=5000; q[2]=6000; q[3]=6000;
+  check_query(gr, footprints, q);
+
+  q[0]=-6000; q[1]=-6000; q[2]=-5000; q[3]=-5000;
+  check_query(gr, footprints, q);
+
+  /* A bounding box with a NaN bound only hits the unbounded footprint */
+
+  q[0]=NAN; q[1]=0; q[2]=10; q[3]=10;
+  CHECK(grid_query(gr, q[0], q[1], q[2], q[3], hits)==1);
+  CHECK(hits[0]==1);
+
+  grid_free(gr);
+
+  CHECK_DONE("grid");
+}
+
+/******************************************************************************/
@@ -0,0 +1,184 @@
+/*
+
+test_jobs.c - GeoQuadTree test of the job pool
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "jobs.h"
+#include "check.h"
+
+#define OUTER_JOBS 4  /* More than the threads of the pool */
+#define INNER_JOBS 8
+#define DEADLOCK 10   /* Seconds after which the jobs are taken as stuck */
+
+int verbose_level=0;
+
+typedef struct
+{
+  int done[INNER_JOBS];
+  int all_done;         /* All the inner jobs had finished after the wait */
+} outer;
+
+pthread_mutex_t test_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t test_done=PTHREAD_COND_INITIALIZER;
+int finished=0;
+
+/******************************************************************************/
+
+void inner_job(void *arg)
+{
+  int *done=(int *)arg;
+
+  pthread_mutex_lock(&test_mutex);
+  (*done)++;
+  pthread_mutex_unlock(&test_mutex);
+}
+
+/******************************************************************************/
+
+void outer_job(void *arg)
+{
+  /* Submits jobs to a group of its own and waits for them, from a thread
+     of the pool */
+
+  outer *o=(outer *)arg;
+  job_group group;
+  job jobs[INNER_JOBS];
+  int i;
+
+  job_group_init(&group);
+
+  for (i=0; (i<INNER_JOBS); i++) o->done[i]=0;
+  for (i=0; (i<INNER_JOBS); i++)
+    job_submit(&group, &jobs[i], inner_job, &(o->done[i]));
+
+  job_group_wait(&group);
+
+  pthread_mutex_lock(&test_mutex);
+  o->all_done=1;
+  for (i=0; (i<INNER_JOBS); i++) if (o->done[i]!=1) o->all_done=0;
+  pthread_mutex_unlock(&test_mutex);
+}
+
+/******************************************************************************/
+
+void *nested(void *arg)
+{
+  outer *o=(outer *)arg;
+  job_group group;
+  job jobs[OUTER_JOBS];
+  int i;
+
+  job_group_init(&group);
+
+  for (i=0; (i<OUTER_JOBS); i++)
+    job_submit(&group, &jobs[i], outer_job, &o[i]);
+
+  job_group_wait(&group);
+
+  pthread_mutex_lock(&test_mutex);
+  finished=1;
+  pthread_cond_signal(&test_done);
+  pthread_mutex_unlock(&test_mutex);
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  outer o[OUTER_JOBS];
+  job_group group;
+  job j;
+  pthread_t thread;
+  struct timespec deadline;
+  int done, i, stuck;
+
+  /* Without threads a job runs when it is submitted */
+
+  jobs_init(0);
+
+  CHECK(jobs_threads()==0);
+
+  job_group_init(&group);
+  done=0;
+
+  job_submit(&group, &j, inner_job, &done);
+
+  CHECK(done==1);
+  CHECK(group.pending==0);
+
+  job_group_wait(&group);
+
+  CHECK(done==1);
+
+  /* Nested jobs run serially as well */
+
+  o[0].all_done=0;
+  job_group_init(&group);
+  job_submit(&group, &j, outer_job, &o[0]);
+
+  CHECK(o[0].all_done==1);
+
+  /* A job of a two thread pool may wait for jobs of its own, as the
+     waiting threads run the queued jobs */
+
+  jobs_init(2);
+
+  CHECK(jobs_threads()==2);
+
+  for (i=0; (i<OUTER_JOBS); i++) o[i].all_done=0;
+
+  pthread_create(&thread, NULL, nested, o);
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec+=DEADLOCK;
+
+  stuck=0;
+
+  pthread_mutex_lock(&test_mutex);
+  while ((finished==0)&&(stuck==0))
+    if (pthread_cond_timedwait(&test_done, &test_mutex, &deadline)==ETIMEDOUT)
+      stuck=1;
+  pthread_mutex_unlock(&test_mutex);
+
+  CHECK(stuck==0);
+
+  /* A stuck thread cannot be joined */
+
+  if (stuck==0)
+  {
+    pthread_join(thread, NULL);
+
+    for (i=0; (i<OUTER_JOBS); i++) CHECK(o[i].all_done==1);
+  }
+
+  CHECK_DONE("jobs");
+}
+
+/******************************************************************************/
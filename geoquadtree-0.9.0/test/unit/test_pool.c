@@ -0,0 +1,148 @@
+/*
+
+test_pool.c - GeoQuadTree test of the buffer pool and the thread arenas
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "check.h"
+
+#define BLOCKS 16
+#define BLOCK (100*1024)  /* Several blocks do not fit in a chunk */
+
+int verbose_level=0;
+
+/******************************************************************************/
+
+void *other_thread(void *arg)
+{
+  /* The arena of another thread is its own */
+
+  unsigned char *p;
+
+  p=arena_alloc(64);
+  memset(p, 0xff, 64);
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  unsigned char *a, *b, *blocks[BLOCKS], *first, *p;
+  arena_mark mark;
+  pthread_t thread;
+  int i, j, overlap;
+
+  /* Size classes */
+
+  CHECK(pool_size(1)==(1UL<<POOL_MIN_SHIFT));
+  CHECK(pool_size(1UL<<POOL_MIN_SHIFT)==(1UL<<POOL_MIN_SHIFT));
+  CHECK(pool_size((1UL<<POOL_MIN_SHIFT)+1)==(1UL<<(POOL_MIN_SHIFT+1)));
+  CHECK(pool_size(1000000)==(1UL<<20));
+  CHECK(pool_size(1UL<<(POOL_MIN_SHIFT+POOL_CLASSES-1))==
+        (1UL<<(POOL_MIN_SHIFT+POOL_CLASSES-1)));
+  CHECK(pool_size((1UL<<(POOL_MIN_SHIFT+POOL_CLASSES-1))+1)==
+        (1UL<<(POOL_MIN_SHIFT+POOL_CLASSES-1))+1);
+
+  /* A freed buffer is reused by the next one of its class only */
+
+  a=pool_alloc(5000);
+  CHECK(((unsigned long)a&15)==0);
+  memset(a, 1, pool_size(5000));
+  pool_free(a);
+
+  b=pool_alloc(100);
+  CHECK(b!=a);
+
+  p=pool_alloc(8000);
+  CHECK(p==a);
+
+  pool_free(p);
+  pool_free(b);
+  pool_free(NULL);
+
+  /* Arena blocks are aligned, do not overlap, and are taken again from
+     the same memory once the arena is restored */
+
+  mark=arena_save();
+
+  for (i=0; (i<BLOCKS); i++)
+  {
+    blocks[i]=arena_alloc(BLOCK+i);
+    CHECK(((unsigned long)blocks[i]&15)==0);
+    memset(blocks[i], i, BLOCK+i);
+  }
+
+  overlap=0;
+
+  for (i=0; (i<BLOCKS); i++)
+    for (j=0; (j<BLOCK+i); j++)
+      if (blocks[i][j]!=i) overlap++;
+
+  CHECK(overlap==0);
+
+  arena_restore(mark);
+
+  for (i=0; (i<BLOCKS); i++) CHECK(arena_alloc(BLOCK+i)==blocks[i]);
+
+  /* A block larger than a chunk */
+
+  p=arena_alloc(4*ARENA_CHUNK);
+  memset(p, 0, 4*ARENA_CHUNK);
+
+  /* Marks nest, and a reset frees everything */
+
+  arena_reset();
+
+  first=arena_alloc(32);
+  mark=arena_save();
+  a=arena_alloc(32);
+  CHECK(a==first+32);
+
+  arena_restore(mark);
+  CHECK(arena_alloc(32)==a);
+
+  arena_reset();
+  CHECK(arena_alloc(32)==first);
+
+  /* Other threads do not take memory of this arena */
+
+  mark=arena_save();
+
+  if (pthread_create(&thread, NULL, other_thread, NULL)!=0)
+  { fprintf(stderr, "test_pool: pthread_create\n"); return 1; }
+
+  pthread_join(thread, NULL);
+
+  CHECK(arena_alloc(32)==first+32);
+  arena_restore(mark);
+
+  CHECK_DONE("pool");
+}
+
+/******************************************************************************/
@@ -0,0 +1,232 @@
+/*
+
+test_quantize.c - GeoQuadTree test of the colour quantisation
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quantize.h"
+#include "check.h"
+
+#define PALETTES 40
+#define PIXELS 20000
+
+int verbose_level=0;
+
+/******************************************************************************/
+
+int nearest(palette *p, int colour)
+{
+  /* The nearest opaque colour of the palette to the centre of a 15 bit
+     colour, by comparing it with all of them. Ties go to the first one */
+
+  long r, g, b, dr, dg, db, d, best_d;
+  int c, best;
+
+  r=(((colour>>10)&31)<<3)+4;
+  g=(((colour>>5)&31)<<3)+4;
+  b=((colour&31)<<3)+4;
+
+  best=1;
+  best_d=-1;
+
+  for (c=1; (c<p->num_colors); c++)
+  {
+    dr=r-p->color[c][0];
+    dg=g-p->color[c][1];
+    db=b-p->color[c][2];
+    d=dr*dr+dg*dg+db*db;
+
+    if ((best_d<0)||(d<best_d)) { best_d=d; best=c; }
+  }
+
+  return best;
+}
+
+/******************************************************************************/
+
+int lookup_errors(palette *p)
+{
+  int colour, errors;
+
+  errors=0;
+
+  for (colour=0; (colour<32768); colour++)
+    if (p->lookup[colour]!=nearest(p, colour)) errors++;
+
+  return errors;
+}
+
+/******************************************************************************/
+
+void random_palette(palette *p, int coarse)
+{
+  /* Coarse palettes only take channel values that are multiples of 8,
+     at the same distance from the centres of neighbour 15 bit colours,
+     and repeat colours, so that ties are frequent */
+
+  int c, k;
+
+  p->num_colors=2+rand()%(PALETTE_COLORS-1);
+
+  for (c=1; (c<p->num_colors); c++)
+  {
+    for (k=0; (k<3); k++)
+    {
+      if (coarse) p->color[c][k]=(rand()%32)*8;
+      else p->color[c][k]=rand()%256;
+    }
+
+    if ((coarse)&&(c>1)&&(rand()%4==0))
+      memcpy(p->color[c], p->color[1+rand()%(c-1)], 3);
+  }
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  palette fixed, *p;
+  unsigned char *rgba, *indexed;
+  unsigned long i;
+  int n, colors, errors, repeated;
+  static const int color_counts[]={1, 2, 7, 16, 64, 255, 1000};
+  static const unsigned char few[3][4]={{0, 0, 0, 255}, {255, 0, 0, 255},
+                                        {0, 0, 255, 255}};
+
+  srand(1);
+
+  rgba=malloc(PIXELS*4);
+  indexed=malloc(PIXELS);
+
+  if ((rgba==NULL)||(indexed==NULL))
+  { fprintf(stderr, "test_quantize: malloc\n"); return 1; }
+
+  /* The lookup table holds the nearest colour of the palette */
+
+  errors=0;
+
+  for (n=0; (n<PALETTES); n++)
+  {
+    random_palette(&fixed, n%2);
+    palette_index(&fixed);
+    errors+=lookup_errors(&fixed);
+  }
+
+  CHECK(errors==0);
+
+  /* A single colour, and the same colour repeated: the first one is
+     taken */
+
+  fixed.num_colors=2;
+  fixed.color[1][0]=10; fixed.color[1][1]=200; fixed.color[1][2]=30;
+  palette_index(&fixed);
+
+  CHECK(lookup_errors(&fixed)==0);
+  CHECK(fixed.lookup[0]==1);
+
+  fixed.num_colors=4;
+  memcpy(fixed.color[2], fixed.color[1], 3);
+  memcpy(fixed.color[3], fixed.color[1], 3);
+  palette_index(&fixed);
+
+  repeated=0;
+  for (i=0; (i<32768); i++) if (fixed.lookup[i]!=1) repeated++;
+
+  CHECK(repeated==0);
+
+  /* Two colours at the same distance from the centre of a 15 bit colour */
+
+  fixed.num_colors=3;
+  fixed.color[1][0]=8; fixed.color[1][1]=4; fixed.color[1][2]=4;
+  fixed.color[2][0]=0; fixed.color[2][1]=4; fixed.color[2][2]=4;
+  palette_index(&fixed);
+
+  CHECK(fixed.lookup[0]==1);
+  CHECK(lookup_errors(&fixed)==0);
+
+  /* The octree palette keeps to the number of colours asked for */
+
+  for (i=0; (i<PIXELS*4); i++) rgba[i]=rand()%256;
+
+  for (n=0; (n<sizeof(color_counts)/sizeof(color_counts[0])); n++)
+  {
+    colors=color_counts[n];
+
+    p=palette_octree(rgba, PIXELS, colors);
+
+    if (colors>PALETTE_COLORS-1) colors=PALETTE_COLORS-1;
+
+    CHECK(p->num_colors>=2);
+    CHECK(p->num_colors-1<=colors);
+    CHECK(lookup_errors(p)==0);
+
+    palette_free(p);
+  }
+
+  /* A few colours are kept as they are, and transparent pixels map to
+     the first entry */
+
+  for (i=0; (i<PIXELS); i++)
+  {
+    memcpy(rgba+i*4, few[i%3], 4);
+    if (i%5==0) rgba[i*4+3]=0;
+  }
+
+  p=palette_octree(rgba, PIXELS, 16);
+  palette_map(p, rgba, PIXELS, indexed);
+
+  CHECK(p->num_colors==4);
+
+  errors=0;
+
+  for (i=0; (i<PIXELS); i++)
+  {
+    if (i%5==0) { if (indexed[i]!=0) errors++; }
+    else if ((indexed[i]==0)||(memcmp(p->color[indexed[i]], few[i%3], 3)!=0))
+      errors++;
+  }
+
+  CHECK(errors==0);
+
+  palette_free(p);
+
+  /* Without opaque pixels there is still a colour to map to */
+
+  memset(rgba, 0, PIXELS*4);
+
+  p=palette_octree(rgba, PIXELS, 16);
+
+  CHECK(p->num_colors==2);
+  CHECK(lookup_errors(p)==0);
+
+  palette_free(p);
+
+  free(rgba);
+  free(indexed);
+
+  CHECK_DONE("quantize");
+}
+
+/******************************************************************************/
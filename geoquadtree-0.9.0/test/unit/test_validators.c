@@ -0,0 +1,73 @@
+/*
+
+test_validators.c - GeoQuadTree test of the HTTP dates of the validators
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fcgi.h"
+#include "check.h"
+
+/******************************************************************************/
+
+int main(void)
+{
+  char date[64];
+  time_t t, parsed;
+
+  /* The three formats of RFC 2616 give the same time */
+
+  t=784111777;
+
+  CHECK(http_parse_date("Sun, 06 Nov 1994 08:49:37 GMT", &parsed)==0);
+  CHECK(parsed==t);
+
+  CHECK(http_parse_date("Sunday, 06-Nov-94 08:49:37 GMT", &parsed)==0);
+  CHECK(parsed==t);
+
+  CHECK(http_parse_date("Sun Nov  6 08:49:37 1994", &parsed)==0);
+  CHECK(parsed==t);
+
+  /* Last-Modified is read back as sent */
+
+  http_date(t, date);
+  CHECK(strcmp(date, "Sun, 06 Nov 1994 08:49:37 GMT")==0);
+
+  t=time(NULL);
+  http_date(t, date);
+  CHECK(http_parse_date(date, &parsed)==0);
+  CHECK(parsed==t);
+
+  /* Dates not understood are rejected */
+
+  CHECK(http_parse_date("", &parsed)==1);
+  CHECK(http_parse_date("yesterday", &parsed)==1);
+  CHECK(http_parse_date("Sun, 06 Foo 1994 08:49:37 GMT", &parsed)==1);
+  CHECK(http_parse_date("Sun, 06 Nov", &parsed)==1);
+
+  CHECK_DONE("validators");
+}
+
+/******************************************************************************/
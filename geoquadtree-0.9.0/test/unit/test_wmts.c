@@ -0,0 +1,126 @@
+/*
+
+test_wmts.c - GeoQuadTree test of the WMTS tile grid
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "geoquadtree.h"
+#include "check.h"
+
+#define LEVELS 5
+
+int verbose_level=0;
+
+/******************************************************************************/
+
+void check_tile(gqt *g, int z, long x, long y)
+{
+  /* The file of a tile is the one of the tree holding the centre of its
+     extent, and the tile is next to the ones after it */
+
+  char path[1024], expected[1024];
+  image im, next;
+  double x0, y0, sizex, sizey;
+
+  CHECK(gqt_tile_path(g, z, x, y, path)==0);
+  gqt_tile_bbox(g, z, x, y, &im);
+
+  CHECK((im.width==g->tilesizex)&&(im.height==g->tilesizey));
+
+  sizex=g->resx*g->tilesizex*(1<<(g->levels-z));
+  sizey=g->resy*g->tilesizey*(1<<(g->levels-z));
+
+  CHECK(im.maxx-im.minx==sizex);
+  CHECK(im.maxy-im.miny==sizey);
+
+  x0=(im.minx+im.maxx)/2;
+  y0=(im.miny+im.maxy)/2;
+
+  strcpy(expected, g->path);
+  CHECK(xy2filetile(g, x0, y0, g->levels-z, expected+strlen(expected))==1);
+  strcat(expected, "/");
+  strcat(expected, g->name);
+
+  CHECK(strcmp(path, expected)==0);
+
+  /* Columns go eastwards and rows southwards */
+
+  gqt_tile_bbox(g, z, x+1, y, &next);
+  CHECK((next.minx==im.maxx)&&(next.maxy==im.maxy));
+
+  gqt_tile_bbox(g, z, x, y+1, &next);
+  CHECK((next.maxy==im.miny)&&(next.minx==im.minx));
+}
+
+/******************************************************************************/
+
+int main(void)
+{
+  char path[1024];
+  image im;
+  gqt g;
+  long x, y;
+  int z;
+
+  memset(&g, 0, sizeof(g));
+
+  g.path="/trees/bmng";
+  g.name="bmng.png";
+  g.levels=LEVELS;
+  g.resx=0.5;
+  g.resy=0.25;
+  g.tilesizex=256;
+  g.tilesizey=128;
+
+  for (z=0; (z<=LEVELS); z++)
+    for (y=0; (y<(1L<<z)); y++)
+      for (x=0; (x<(1L<<z)); x++) check_tile(&g, z, x, y);
+
+  /* The root tile covers the whole tree, centred on the origin */
+
+  gqt_tile_bbox(&g, 0, 0, 0, &im);
+  CHECK((im.minx==-im.maxx)&&(im.miny==-im.maxy));
+  CHECK(im.maxx==g.resx*g.tilesizex*(1<<(LEVELS-1)));
+
+  CHECK(gqt_tile_path(&g, 0, 0, 0, path)==0);
+  CHECK(strcmp(path, "/trees/bmng/bmng.png")==0);
+
+  CHECK(gqt_tile_path(&g, 2, 3, 0, path)==0);
+  CHECK(strcmp(path, "/trees/bmng/2/2/bmng.png")==0);
+
+  CHECK(gqt_tile_path(&g, 2, 0, 3, path)==0);
+  CHECK(strcmp(path, "/trees/bmng/4/4/bmng.png")==0);
+
+  /* Tiles out of the grid */
+
+  CHECK(gqt_tile_path(&g, -1, 0, 0, path)==1);
+  CHECK(gqt_tile_path(&g, LEVELS+1, 0, 0, path)==1);
+  CHECK(gqt_tile_path(&g, 2, 4, 0, path)==1);
+  CHECK(gqt_tile_path(&g, 2, 0, -1, path)==1);
+
+  CHECK_DONE("wmts");
+}
+
+/******************************************************************************/
@@ -28,9 +28,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <math.h>
 #include <ctype.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcgi_stdio.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <fcgiapp.h>
 
 #include "geoquadtree.h"
 #include "xml.h"
@@ -40,16 +43,42 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "fcgi.h"
 #include "resample.h"
 #include "logo.h"
+#include "composite.h"
+#include "http.h"
+#include "wmts.h"
+#include "pool.h"
 
 int verbose_level=0;
 
 char configuration_file[1024];
-char configuration_file_time[128];
 
-int current_version;
+#define MAX_REQUEST_LAYERS 128
+
+#define METATILE_TOLERANCE 0.001  /* Tiles off the grid, as a fraction */
+#define STRIP_ROWS 256  /* Rows of a GetMap image rendered at once */
+#define FORMAT_PNG8 "image/png; mode=8bit"
+#define MAX_COARSEN 3     /* Levels above its own a degraded map is read */
+#define BICUBIC_WEIGHT 4  /* Work of a bicubic pixel, a nearest one is 1 */
+#define BLANK_IMAGES 64   /* Encoded images without data kept in memory */
+#define RELOAD_INTERVAL 5  /* Seconds between checks of the configuration */
+#define RENDER_PARALLEL 4  /* Rasters of an image rendered at the same time */
+#define BUILT_PALETTES 256  /* Lists of layers whose palette is kept */
 
 srs p_srs_84;
 
+pthread_mutex_t accept_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t palette_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t rate_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t blank_mutex=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t service_mutex=PTHREAD_MUTEX_INITIALIZER;
+
+service *current_service=NULL;  /* Configuration given to new requests */
+
+hash_table *blank_images=NULL;  /* output_stream indexed by size, format,
+                                   background and logo */
+
+double render_rate=0;  /* Work rendered per millisecond, 0 until measured */
+
 /******************************************************************************/
 
 char *strlwr(char *str)
@@ -65,13 +94,13 @@ char *strlwr(char *str)
 
 /******************************************************************************/
 
-void exception(char *code, char *description)
+void exception(wms_request *req, char *code, char *description)
 {
-  /* Writes to standard output a WMS service exception report  */
+  /* Writes to the output of the request a WMS service exception report  */
 
   char str[1024];
 
-  if (current_version==10101)
+  if (req->version==10101)
   {
     strcpy(str, "Content-type: application/vnd.ogc.se_xml\r\n\r\n");
     strcat(str, "<?xml version='1.0' encoding=\"UTF-8\"?>");
@@ -102,7 +131,7 @@ void exception(char *code, char *description)
 
   strcat(str, "</ServiceExceptionReport>");
 
-  puts(str);
+  output_printf(req->out, "%s\n", str);
 }
 
 /******************************************************************************/
@@ -124,30 +153,23 @@ int get_current_time(char *str)
 
 /******************************************************************************/
 
-int get_mtime(char *path, char *mtime)
+void get_mtime(time_t t, char *mtime)
 {
-  struct stat buf;
   struct tm tp;
 
-  strcpy(mtime, "");
-  
-  if (stat(path, &buf)!=0) return 1;
-
-  tp=*gmtime(&(buf.st_mtime));
+  tp=*gmtime(&t);
 
   sprintf(mtime, "%04d-%02d-%02dT%02d%02d%02dZ",
                  tp.tm_year+1900, tp.tm_mon+1, tp.tm_mday,
                  tp.tm_hour, tp.tm_min, tp.tm_sec);
-
-  return 0;
 }
 
 /******************************************************************************/
 
-int version2numeric(char *version_str)
+int version2numeric(wms_request *req, char *version_str)
 {
   int v, i;
-  char *pch;
+  char *pch, *saveptr;
 
   /*
      The version number contains three non-negative integers, separated by
@@ -158,16 +180,16 @@ int version2numeric(char *version_str)
   v=0;
   i=0;
 
-  pch=strtok(version_str, ".");
+  pch=strtok_r(version_str, ".", &saveptr);
   while (pch!=NULL)
   {
     v=v*100+atoi(pch);
-    pch=strtok(NULL, ".");
+    pch=strtok_r(NULL, ".", &saveptr);
     i++;
   }
 
   if (i!=3)
-  { exception("", "Version format not understood");  return 0; }
+  { exception(req, "", "Version format not understood");  return 0; }
 
   return v;
 }
@@ -220,21 +242,23 @@ int geographic_bounding_box(layer *l, double *bb)
 
   if (bounding_box==0) return 1;
 
-  bb[0]=x[0];
-  bb[1]=y[0];
-  bb[2]=x[1];
-  bb[3]=y[1];
+  bb[0]=xmin;
+  bb[1]=ymin;
+  bb[2]=xmax;
+  bb[3]=ymax;
 
   return 0;
 }
 
 /******************************************************************************/
 
-int prepare_getcapabilities(service *Service,
+int prepare_getcapabilities(service *Service, int version,
                             xmlChar **buffer_capabilities,
                             int *buffer_capabilities_len)
 {
-  /* Writes to a buffer the WMS GetCapabilities message */
+  /* Writes to a buffer the WMS GetCapabilities message. The online resource
+     URL depends on the request, so the placeholder ONLINE_RESOURCE is
+     written instead */
 
   xmlDocPtr doc;
   xmlNodePtr n_root, n_service, n_capability, n_onlineresource;
@@ -242,27 +266,13 @@ int prepare_getcapabilities(service *Service,
   xmlNodePtr n_request, n_getcapabilities, n_dcptype, n_http, n_get, n_getmap;
   xmlNodePtr n_layer, n_layer_2, n_boundingbox, n_exception;
   char url[256], str[256];
-  int i;
   layer *l;
   layer_srs *p_layer_srs;
-  double gbb[4], x[2], y[2];
-
-  /*
-     This server supports WMS versions 1.1.1 and 1.3.0
-
-     If the requested version is greater than or equal to 1.3.0,
-     then the server will send 1.3.0
-
-     If the requested version is less than 1.3.0,
-     then the server will send 1.1.1
-  */
-
-  if (current_version>=10300) current_version=10300;
-  else current_version=10101;
+  double *gbb, *bbox;
 
   doc=xmlNewDoc((xmlChar *)"1.0");
 
-  if (current_version==10101)
+  if (version==10101)
   {
     xmlCreateIntSubset(doc, (xmlChar *)"WMT_MS_Capabilities", NULL,
                        (xmlChar *)"http://schemas.opengis.net/wms/1.1.1/capabilities_1_1_1.dtd");
@@ -283,10 +293,10 @@ int prepare_getcapabilities(service *Service,
     xmlNewProp(n_root, (xmlChar *)"xsi:schemaLocation", (xmlChar *)"http://www.opengis.net/wms http://schemas.opengis.net/wms/1.3.0/capabilities_1_3_0.xsd");
   }
 
-  xmlNewProp(n_root, (xmlChar *)"updateSequence", (xmlChar *)configuration_file_time);
+  xmlNewProp(n_root, (xmlChar *)"updateSequence",
+             (xmlChar *)Service->update_sequence);
 
-  sprintf(url, "http://%s%s", getenv("HTTP_HOST"), getenv("REQUEST_URI"));
-  for (i=0; (i<strlen(url)); i++) if (url[i]=='?') url[i]=0;
+  strcpy(url, ONLINE_RESOURCE);
 
   /* Define Service */
 
@@ -321,7 +331,7 @@ int prepare_getcapabilities(service *Service,
   xmlNewChild(n_service, NULL, (xmlChar *)"Fees", (xmlChar *)Service->Fees); /* 0 or 1 occurrences */
   xmlNewChild(n_service, NULL, (xmlChar *)"AccessConstraints", (xmlChar *)Service->AccessConstraints); /* 0 or 1 occurrences */
 
-  if (current_version==10303)   /* Only in WMS version 1.3.0 (not in 1.1.1) */
+  if (version==10303)   /* Only in WMS version 1.3.0 (not in 1.1.1) */
   {
     sprintf(str, "%i", Service->MaxWidth);
     xmlNewChild(n_service, NULL, (xmlChar *)"MaxWidth", (xmlChar *)str); /* 0 or 1 occurrences */
@@ -336,7 +346,7 @@ int prepare_getcapabilities(service *Service,
   n_request=xmlNewChild(n_capability, NULL, (xmlChar *)"Request", NULL); /* Mandatory */
   n_getcapabilities=xmlNewChild(n_request, NULL, (xmlChar *)"GetCapabilities", NULL); /* Mandatory */
 
-  if (current_version==10101)
+  if (version==10101)
     xmlNewChild(n_getcapabilities, NULL, (xmlChar *)"Format", (xmlChar *)"application/vnd.ogc.wms_xml");
   else
     xmlNewChild(n_getcapabilities, NULL, (xmlChar *)"Format", (xmlChar *)"text/xml");
@@ -352,6 +362,7 @@ int prepare_getcapabilities(service *Service,
   n_getmap=xmlNewChild(n_request, NULL, (xmlChar *)"GetMap", NULL); /* Mandatory */
   xmlNewChild(n_getmap, NULL, (xmlChar *)"Format", (xmlChar *)"image/jpeg"); /* 1 or more times */
   xmlNewChild(n_getmap, NULL, (xmlChar *)"Format", (xmlChar *)"image/png");  /* 1 or more times */
+  xmlNewChild(n_getmap, NULL, (xmlChar *)"Format", (xmlChar *)FORMAT_PNG8);
   n_dcptype=xmlNewChild(n_getmap, NULL, (xmlChar *)"DCPType", NULL); /* 1 or more times */
   n_http=xmlNewChild(n_dcptype, NULL, (xmlChar *)"HTTP", NULL);
   n_get=xmlNewChild(n_http, NULL, (xmlChar *)"Get", NULL);
@@ -362,7 +373,7 @@ int prepare_getcapabilities(service *Service,
 
   n_exception=xmlNewChild(n_capability, NULL, (xmlChar *)"Exception", NULL); /* Mandatory */
 
-  if (current_version==10101)
+  if (version==10101)
     xmlNewChild(n_exception, NULL, (xmlChar *)"Format", (xmlChar *)"application/vnd.ogc.se_xml");
   else
     xmlNewChild(n_exception, NULL, (xmlChar *)"Format", (xmlChar *)"XML");
@@ -371,7 +382,7 @@ int prepare_getcapabilities(service *Service,
   xmlNewChild(n_layer, NULL, (xmlChar *)"Title", (xmlChar *)Service->Title);
 
   /*
-  if (current_version==10101)
+  if (version==10101)
   {
     xmlNewChild(n_layer, NULL, (xmlChar *)"SRS", (xmlChar *)"EPSG:23031");
     xmlNewChild(n_layer, NULL, (xmlChar *)"SRS", (xmlChar *)"EPSG:4326");
@@ -382,7 +393,7 @@ int prepare_getcapabilities(service *Service,
     xmlNewChild(n_layer, NULL, (xmlChar *)"CRS", (xmlChar *)"EPSG:4326");
   }
 
-  if (current_version==10101)
+  if (version==10101)
   {
     n_boundingbox=xmlNewChild(n_layer, NULL, (xmlChar *)"LatLonBoundingBox", NULL);
     xmlNewProp(n_boundingbox, (xmlChar *)"maxx", (xmlChar *)"3.446");
@@ -400,7 +411,7 @@ int prepare_getcapabilities(service *Service,
   }
  
   n_boundingbox=xmlNewChild(n_layer, NULL, (xmlChar *)"BoundingBox", NULL);
-  if (current_version==10101)
+  if (version==10101)
     xmlNewProp(n_boundingbox, (xmlChar *)"SRS", (xmlChar *)"EPSG:23031");
   else
     xmlNewProp(n_boundingbox, (xmlChar *)"CRS", (xmlChar *)"EPSG:23031");
@@ -433,7 +444,7 @@ int prepare_getcapabilities(service *Service,
     p_layer_srs=l->layer_srs_list;
     while (p_layer_srs!=NULL)
     {
-      if (current_version==10101)
+      if (version==10101)
         xmlNewChild(n_layer_2, NULL, (xmlChar *)"SRS",
                     (xmlChar *)p_layer_srs->name);
       else
@@ -443,10 +454,9 @@ int prepare_getcapabilities(service *Service,
       p_layer_srs=(layer_srs *)p_layer_srs->next;
     }
 
-    gbb[0]=0; gbb[1]=0; gbb[2]=0; gbb[3]=0;
-    geographic_bounding_box(l, gbb);
+    gbb=l->gbb;
 
-    if (current_version==10101)
+    if (version==10101)
     {
       n_boundingbox=xmlNewChild(n_layer_2, NULL,
                                 (xmlChar *)"LatLonBoundingBox", NULL);
@@ -488,28 +498,26 @@ int prepare_getcapabilities(service *Service,
     p_layer_srs=l->layer_srs_list;
     while (p_layer_srs!=NULL)
     {
-      x[0]=gbb[0]; y[0]=gbb[1];
-      x[1]=gbb[2]; y[1]=gbb[3];
-      proj_transform(p_srs_84, 2, x, y, p_layer_srs->p_srs);
+      bbox=p_layer_srs->bbox;
 
       n_boundingbox=xmlNewChild(n_layer_2, NULL, (xmlChar *)"BoundingBox", NULL);
-      if (current_version==10101)
+      if (version==10101)
         xmlNewProp(n_boundingbox, (xmlChar *)"SRS",
                    (xmlChar *)p_layer_srs->name);
       else
         xmlNewProp(n_boundingbox, (xmlChar *)"CRS",
                    (xmlChar *)p_layer_srs->name);
 
-      sprintf(str, "%f", x[0]);
+      sprintf(str, "%f", bbox[0]);
       xmlNewProp(n_boundingbox, (xmlChar *)"minx", (xmlChar *)str);
 
-      sprintf(str, "%f", y[0]);
+      sprintf(str, "%f", bbox[1]);
       xmlNewProp(n_boundingbox, (xmlChar *)"miny", (xmlChar *)str);
 
-      sprintf(str, "%f", x[1]);
+      sprintf(str, "%f", bbox[2]);
       xmlNewProp(n_boundingbox, (xmlChar *)"maxx", (xmlChar *)str);
 
-      sprintf(str, "%f", y[1]);
+      sprintf(str, "%f", bbox[3]);
       xmlNewProp(n_boundingbox, (xmlChar *)"maxy", (xmlChar *)str);
 
       p_layer_srs=(layer_srs *)p_layer_srs->next;
@@ -537,14 +545,160 @@ int prepare_getcapabilities(service *Service,
 
   xmlFreeDoc(doc);
 
-  xmlCleanupParser();
-  xmlMemoryDump();
+  return 0;
+}
+
+/******************************************************************************/
+
+void store_capabilities(xmlChar *buffer, int length, char *content_type,
+                        capabilities *c)
+{
+  /* Keeps a serialised capabilities document, recording where the online
+     resource URL has to be inserted */
+
+  int i, n, len_placeholder;
+  char *p;
+
+  c->content_type=content_type;
+
+  len_placeholder=strlen(ONLINE_RESOURCE);
+
+  c->buffer=malloc(length+1);
+  if (c->buffer==NULL) { fprintf(stderr, "build_capabilities: malloc\n"); exit(1); }
+
+  n=0;
+  for (p=strstr((char *)buffer, ONLINE_RESOURCE); (p!=NULL);
+       p=strstr(p+len_placeholder, ONLINE_RESOURCE)) n++;
+
+  c->url_offset=malloc((n+1)*sizeof(int));
+  if (c->url_offset==NULL) { fprintf(stderr, "build_capabilities: malloc\n"); exit(1); }
+
+  /* The placeholders are removed from the stored document */
+
+  c->length=0;
+  c->num_urls=0;
+
+  for (i=0; (i<length); )
+  {
+    if ((i+len_placeholder<=length)&&
+        (strncmp((char *)&buffer[i], ONLINE_RESOURCE, len_placeholder)==0))
+    {
+      c->url_offset[c->num_urls++]=c->length;
+      i+=len_placeholder;
+    }
+    else
+      c->buffer[c->length++]=buffer[i++];
+  }
+}
+
+/******************************************************************************/
+
+int build_capabilities(service *Service, int version, capabilities *c)
+{
+  /* Serialises once the GetCapabilities message of a WMS version */
+
+  xmlChar *buffer;
+  int length;
+
+  if (prepare_getcapabilities(Service, version, &buffer, &length)!=0) return 1;
+
+  store_capabilities(buffer, length, "application/vnd.ogc.wms_xml", c);
+
+  xmlFree(buffer);
 
   return 0;
 }
 
 /******************************************************************************/
 
+void build_catalog(service *Service)
+{
+  /* Precomputes everything that GetCapabilities needs: the geographic
+     bounding box of each layer, its bounding box in every SRS it offers,
+     and the serialised documents of each supported WMS version */
+
+  layer *l;
+  layer_srs *ls;
+  double x[2], y[2];
+
+  l=Service->layer_list;
+  while (l!=NULL)
+  {
+    l->gbb[0]=0; l->gbb[1]=0; l->gbb[2]=0; l->gbb[3]=0;
+    geographic_bounding_box(l, l->gbb);
+
+    ls=l->layer_srs_list;
+    while (ls!=NULL)
+    {
+      x[0]=l->gbb[0]; y[0]=l->gbb[1];
+      x[1]=l->gbb[2]; y[1]=l->gbb[3];
+      proj_transform(p_srs_84, 2, x, y, ls->p_srs);
+
+      ls->bbox[0]=x[0]; ls->bbox[1]=y[0];
+      ls->bbox[2]=x[1]; ls->bbox[3]=y[1];
+
+      ls=(layer_srs *)ls->next;
+    }
+
+    l=(layer *)(l->next);
+  }
+
+  build_capabilities(Service, 10101, &(Service->capabilities_1_1_1));
+  build_capabilities(Service, 10300, &(Service->capabilities_1_3_0));
+  build_wmts_capabilities(Service, &(Service->capabilities_wmts));
+}
+
+/******************************************************************************/
+
+void write_capabilities(wms_request *req, capabilities *c)
+{
+  /* Writes to the output of the request a precomputed GetCapabilities
+     message, inserting the online resource URL of this request */
+
+  char url[256], escaped[1024];
+  char *host, *uri;
+  int i, j, offset, length;
+
+  host=req->http_host;
+  uri=req->request_uri;
+
+  snprintf(url, 256, "http://%s%s",
+           (host==NULL)?"":host, (uri==NULL)?"":uri);
+  for (i=0; (i<strlen(url)); i++) if (url[i]=='?') url[i]=0;
+
+  /* Requests addressed by their path are answered by the program itself */
+
+  if (req->path_info!=NULL)
+  {
+    length=strlen(url)-strlen(req->path_info);
+    if ((length>0)&&(strcmp(url+length, req->path_info)==0)) url[length]=0;
+  }
+
+  for (i=0, j=0; ((url[i]!=0)&&(j<1000)); i++)
+  {
+    if      (url[i]=='&') { strcpy(&escaped[j], "&amp;"); j+=5; }
+    else if (url[i]=='<') { strcpy(&escaped[j], "&lt;"); j+=4; }
+    else if (url[i]=='"') { strcpy(&escaped[j], "&quot;"); j+=6; }
+    else escaped[j++]=url[i];
+  }
+  escaped[j]=0;
+
+  output_printf(req->out, "Content-type: %s\r\n\r\n", c->content_type);
+
+  offset=0;
+
+  for (i=0; (i<c->num_urls); i++)
+  {
+    output_buffer(req->out, c->buffer+offset, c->url_offset[i]-offset);
+    output_buffer(req->out, escaped, j);
+    offset=c->url_offset[i];
+  }
+
+  output_buffer(req->out, c->buffer+offset, c->length-offset);
+}
+
+/******************************************************************************/
+
 void init_service(service *Service)
 {
   /* Initializes the Service structure, so that the optional parameters
@@ -568,378 +722,2007 @@ void init_service(service *Service)
   Service->ContactElectronicMailAddress=NULL;
   Service->MaxWidth=0;
   Service->MaxHeight=0;
+  Service->Logo=NULL;
+  Service->Threads=1;
+  Service->DecodeThreads=0;
+  Service->MaxConnections=1024;
+  Service->CachePath=NULL;
+  Service->MetaTile=1;
+  Service->AdmissionMaxBytes=0;
+  Service->QueueTimeout=10;
+  Service->BudgetMaxBytes=0;
+  Service->BudgetMaxTime=0;
+  Service->cache=NULL;
+  Service->admission=NULL;
+  Service->configuration_mtime=0;
+  strcpy(Service->update_sequence, "");
+  Service->refs=1;
   Service->layer_list=NULL;
+  Service->layer_hash=NULL;
+  Service->palettes=NULL;
+  Service->capabilities_1_1_1.buffer=NULL;
+  Service->capabilities_1_3_0.buffer=NULL;
+  Service->capabilities_wmts.buffer=NULL;
 }
 
 /******************************************************************************/
 
-int image_from_layers(service *Service, image *ima, char *layer_names,
-                      char *str_srs)
+void free_capabilities(capabilities *c)
 {
-  /* Writes into a buffer an image corresponding to a set of layers,
-     a SRS, a bounding box in world units, and the size in pixels */
+  if (c->buffer==NULL) return;
 
-  char *layer_name;
-  layer *l;
-  raster *r;
-  srs *p_srs;
-  unsigned char alpha;
-  image im;
-  long i, length;
-  int ret;
+  free(c->buffer);
+  free(c->url_offset);
+}
+
+/******************************************************************************/
+
+void free_service(service *Service)
+{
+  /* Frees a configuration that no request uses any more. The response
+     cache, the admission queue and the change journals of the trees are
+     kept, because they are shared with the configuration that replaced it */
+
+  char **str[]={ &Service->Title, &Service->Abstract, &Service->Fees,
+                 &Service->AccessConstraints, &Service->ContactPerson,
+                 &Service->ContactOrganization, &Service->ContactPosition,
+                 &Service->AddressType, &Service->Address, &Service->City,
+                 &Service->StateOrProvince, &Service->PostCode,
+                 &Service->Country, &Service->ContactVoiceTelephone,
+                 &Service->ContactFacsimileTelephone,
+                 &Service->ContactElectronicMailAddress, &Service->Logo,
+                 &Service->CachePath };
+  layer *l, *next_layer;
+  layer_srs *ls, *next_srs;
+  raster *r, *next_raster;
+  hash_entry *e;
+  int i;
 
-  im.width=ima->width;
-  im.height=ima->height;
+  for (i=0; (i<sizeof(str)/sizeof(char **)); i++) free(*str[i]);
 
-  im.minx=ima->minx;
-  im.miny=ima->miny;
-  im.maxx=ima->maxx;
-  im.maxy=ima->maxy;
+  for (l=Service->layer_list; (l!=NULL); l=next_layer)
+  {
+    next_layer=(layer *)l->next;
+
+    for (ls=l->layer_srs_list; (ls!=NULL); ls=next_srs)
+    {
+      next_srs=(layer_srs *)ls->next;
+      OSRDestroySpatialReference(ls->p_srs);
+      grid_free(ls->index);
+      free(ls->name);
+      free(ls);
+    }
 
-  length=(long)im.width*(long)im.height;
+    for (r=l->raster_list; (r!=NULL); r=next_raster)
+    {
+      next_raster=(raster *)r->next;
+      OSRDestroySpatialReference(r->geoquadtree->p_srs);
+      free(r->geoquadtree->path);
+      free(r->geoquadtree->name);
+      free(r->geoquadtree->metadata);
+      free(r->geoquadtree);
+      free(r);
+    }
 
-  im.buffer=malloc(length*4L);
-  if (im.buffer==NULL) { fprintf(stderr, "image_from_layer malloc"); return 1; }
+    hash_free(l->srs_hash);
+    free(l->rasters);
+    palette_free(l->colors);
+    free(l->name);
+    free(l->title);
+    free(l);
+  }
 
-  layer_name=strtok(layer_names, ",");
+  hash_free(Service->layer_hash);
 
-  while (layer_name!=NULL)
+  if (Service->palettes!=NULL)
   {
-    /* For each raster composing this layer (buffer "im"),
-       the function gqt_export is called.
+    for (i=0; (i<Service->palettes->size); i++)
+      for (e=Service->palettes->bucket[i]; (e!=NULL); e=(hash_entry *)e->next)
+        palette_free((palette *)e->value);
 
-       The returned images are fusioned into the buffer "image". */
-    
-    l=seek_layer(Service, layer_name);
-    if (l==NULL)
-    { exception("", "Layer unknown"); free(im.buffer); return 1; }
+    hash_free(Service->palettes);
+  }
 
-    r=l->raster_list;
+  free_capabilities(&(Service->capabilities_1_1_1));
+  free_capabilities(&(Service->capabilities_1_3_0));
+  free_capabilities(&(Service->capabilities_wmts));
 
-    while (r!=NULL)
-    {
-      p_srs=seek_layer_srs(l, str_srs);
-      if (p_srs==NULL)
-      { exception("", "Invalid SRS"); free(im.buffer); return 1; }
+  free(Service);
+}
 
-      for (i=0; (i<length*4); )
-      {
-        im.buffer[i++]=255;
-        im.buffer[i++]=0;
-        im.buffer[i++]=0;
-        im.buffer[i++]=0;
-      }
+/******************************************************************************/
 
-      ret=gqt_export(r->geoquadtree, &im, p_srs, 1); // bicubic filter
+service *load_service(char *path, service *previous)
+{
+  /* Reads a configuration and precomputes its catalog. The response cache
+     and the admission queue of the previous configuration, if any, are
+     kept. Returns NULL if the configuration is not valid */
 
-      if (ret==0)
-      {
-        /* Puts im over image */
+  service *Service;
+  struct stat buf;
+  raster *r;
+  layer *l;
+  time_t newest;
 
-        for (i=0; (i<length*4); )
-        {
-          alpha=im.buffer[i+3]; /* This is the value of the alpha channel */
+  Service=malloc(sizeof(service));
+  if (Service==NULL) { fprintf(stderr, "load_service: malloc\n"); exit(1); }
 
-          ima->buffer[i]=((long)im.buffer[i]*(long)alpha+(long)ima->buffer[i]*(255-(long)alpha))/255; i++;
-          ima->buffer[i]=((long)im.buffer[i]*(long)alpha+(long)ima->buffer[i]*(255-(long)alpha))/255; i++;
-          ima->buffer[i]=((long)im.buffer[i]*(long)alpha+(long)ima->buffer[i]*(255-(long)alpha))/255; i++;
-          ima->buffer[i]=((long)im.buffer[i]*(long)alpha+(long)ima->buffer[i]*(255-(long)alpha))/255; i++;
-        }
-      }
+  init_service(Service);
 
-      r=(raster *)r->next;
-    }
+  /* The time is taken before reading, so that a later change is seen */
+
+  if (stat(path, &buf)==0) Service->configuration_mtime=buf.st_mtime;
 
-    layer_name=strtok(NULL, ",");
+  if (read_configuration(Service, path)!=0)
+  {
+    free_service(Service);
+    return NULL;
   }
 
-  free(im.buffer);
+  /* The capabilities change with the configuration and with the extent
+     of the trees */
 
-  return 0;
+  newest=Service->configuration_mtime;
+
+  for (l=Service->layer_list; (l!=NULL); l=(layer *)l->next)
+    for (r=l->raster_list; (r!=NULL); r=(raster *)r->next)
+      if (r->mtime>newest) newest=r->mtime;
+
+  get_mtime(newest, Service->update_sequence);
+
+  build_catalog(Service);
+
+  if (previous!=NULL)
+  {
+    Service->cache=previous->cache;
+    Service->admission=previous->admission;
+  }
+
+  return Service;
 }
 
 /******************************************************************************/
 
-int main(int argc, char *argv[])
+service *service_acquire(void)
 {
-  /* This is the main function of the WMS service */  
+  /* Returns the current configuration, which is not freed until the
+     request using it calls service_release */
 
-  char query_string[1024], *pch;
-  char version[256], request[256], layers[256], format[256];
-  char sbbox[256], swidth[256], sheight[256], styles[256], srs[256];
-  char transparent[256], bgcolor[256], updatesequence[256], str[256];
-  int red, green, blue;
-  double bbox[4];
-  int size[2];
-  unsigned long length, i;
-  image im;
-  service Service;
-  int buffer_capabilities_len;
-  xmlChar *buffer_capabilities;
-  int ret;
+  service *Service;
 
-  buffer_capabilities=NULL;
-  buffer_capabilities_len=0;
+  pthread_mutex_lock(&service_mutex);
+  Service=current_service;
+  Service->refs++;
+  pthread_mutex_unlock(&service_mutex);
 
-  strcpy(configuration_file, "/etc/geoquadtree/geoquadtreeserver.xml");
+  return Service;
+}
 
-  init_service(&Service);
-  read_configuration(&Service, configuration_file);
-  list_configuration(&Service, "/tmp/geoquadtree.log");
-  get_mtime(configuration_file, configuration_file_time); 
-  init_logo(&Service);
-  init_resample();
-  srs_import(&p_srs_84, "EPSG", "EPSG:4326");
+/******************************************************************************/
 
-  /* This is the never ending loop in this FastCGI program */
+void service_release(service *Service)
+{
+  int refs;
 
-  while (FCGI_Accept()>=0)
-  {
-    strncpy(query_string, getenv("QUERY_STRING"), 1024);
-    query_string[1024]=0;
+  pthread_mutex_lock(&service_mutex);
+  refs=--(Service->refs);
+  pthread_mutex_unlock(&service_mutex);
 
-    strcpy(version, " ");
-    strcpy(request, " ");
-    strcpy(layers, " ");
-    strcpy(styles, " ");
-    strcpy(srs, " ");
-    strcpy(sbbox, " ");
-    strcpy(swidth, " ");
-    strcpy(sheight, " ");
-    strcpy(format, " ");
-    strcpy(transparent, " ");
-    strcpy(bgcolor, " ");
-    strcpy(updatesequence, " ");
+  if (refs==0) free_service(Service);
+}
 
-    pch=strtok(query_string, "&");
-    while (pch!=NULL)
-    {
-      if (strncasecmp(pch, "VERSION=",      8)==0)
-        strncpy(version,     &pch[ 8], 256);
+/******************************************************************************/
 
-      if (strncasecmp(pch, "REQUEST=",      8)==0)
-        strncpy(request,     &pch[ 8], 256);
+unsigned long service_stamp(service *Service)
+{
+  /* Sums the current modification times of the configuration file and of
+     the trees it serves, which changes when any of them is rewritten */
 
-      if (strncasecmp(pch, "LAYERS=",       7)==0)
-        strncpy(layers,      &pch[ 7], 256);
+  struct stat buf;
+  unsigned long stamp=0;
+  raster *r;
+  layer *l;
 
-      if (strncasecmp(pch, "STYLES=",       7)==0)
-        strncpy(styles,      &pch[ 7], 256);
+  if (stat(configuration_file, &buf)==0) stamp+=buf.st_mtime;
 
-      if (strncasecmp(pch, "SRS=",          4)==0)
-        strncpy(srs,         &pch[ 4], 256);
+  for (l=Service->layer_list; (l!=NULL); l=(layer *)l->next)
+    for (r=l->raster_list; (r!=NULL); r=(raster *)r->next)
+      stamp+=gqt_mtime(r->geoquadtree);
 
-      if (strncasecmp(pch, "BBOX=",         5)==0)
-        strncpy(sbbox,       &pch[ 5], 256);
+  return stamp;
+}
 
-      if (strncasecmp(pch, "WIDTH=",        6)==0)
-        strncpy(swidth,      &pch[ 6], 256);
+/******************************************************************************/
 
-      if (strncasecmp(pch, "HEIGHT=",       7)==0)
-        strncpy(sheight,     &pch[ 7], 256);
+void *reloader(void *arg)
+{
+  /* Replaces the current configuration when its file or the metadata of
+     one of its trees changes. The requests being served finish with the
+     configuration they started with. The threads, connections, logo,
+     cache and admission settings are read only when the server starts */
 
-      if (strncasecmp(pch, "FORMAT=",       7)==0)
-        strncpy(format,      &pch[ 7], 256);
+  service *Service, *fresh, *old;
+  unsigned long seen, pending, stamp;
 
-      if (strncasecmp(pch, "TRANSPARENT=", 12)==0)
-        strncpy(transparent, &pch[12], 256);
+  Service=service_acquire();
+  seen=service_stamp(Service);
+  pending=seen;
+  service_release(Service);
 
-      if (strncasecmp(pch, "BGCOLOR=",      8)==0)
-        strncpy(bgcolor,     &pch[ 8], 256);
+  while (1)
+  {
+    sleep(RELOAD_INTERVAL);
 
-      if (strncasecmp(pch, "UPDATESEQUENCE=",     15)==0)
-        strncpy(updatesequence, &pch[15], 256);
+    Service=service_acquire();
+    stamp=service_stamp(Service);
 
-      pch=strtok(NULL, "&");
-    }
+    /* A change is applied once it has been stable for an interval, so
+       that files still being written are not read */
 
-    if (strlen(request)==0)
+    if ((stamp==seen)||(stamp!=pending))
     {
-      exception("", "Missing parameter: REQUEST");
+      pending=stamp;
+      service_release(Service);
       continue;
     }
 
-    if ((strcmp(request, "GetCapabilities")==0)||
-        (strcmp(request, "capabilities")==0))
+    if (verbose_level>0) printf("reloader: reading %s\n", configuration_file);
+
+    fresh=load_service(configuration_file, Service);
+
+    if (fresh==NULL)
     {
-      if (strcmp(updatesequence, " ")!=0)
-      {
-        if (strcmp(updatesequence, configuration_file_time)==0)
-        {
-          exception("CurrentUpdateSequence", "Capabilities have not changed");
-          continue;
-        }
+      /* The configuration in use is kept until the files change again */
 
-        if (strcmp(updatesequence, configuration_file_time)>0)
-        {
-          exception("InvalidUpdateSequence", "Capabilities older than requested");
-          continue;
-        }
-      }
+      fprintf(stderr, "reloader: %s not reloaded\n", configuration_file);
+      seen=stamp;
+    }
+    else
+    {
+      seen=service_stamp(fresh);
+      pending=seen;
 
-      /* In response to a GetCapabilities request that does not specify a
-         version number, the server shall respond with the highest version
-         it supports */
+      pthread_mutex_lock(&service_mutex);
+      old=current_service;
+      current_service=fresh;
+      pthread_mutex_unlock(&service_mutex);
 
-      if (strcmp(version, " ")==0) strcpy(version, "1.3.0");
+      service_release(old);
+    }
 
-      current_version=version2numeric(version);
+    service_release(Service);
+  }
 
-      if (current_version>0)
-      {
-        if (prepare_getcapabilities(&Service,
-                                    &buffer_capabilities,
-                                    &buffer_capabilities_len)==0)
-        {
-          printf("Content-type: application/vnd.ogc.wms_xml\r\n\r\n");
-          fwrite(buffer_capabilities, buffer_capabilities_len, 1, stdout);
-        }
-      }
+  return NULL;
+}
 
-      continue;
-    }
-    else if (strcmp(request, "GetMap")==0)
-    {
-      /* The VERSION parameter is madatory in requests
-         other than GetCapabilities */
+/******************************************************************************/
+
+int raster_in_scale(raster *r, image *im, srs *p_srs)
+{
+  /* Checks whether the resolution of the requested image falls inside the
+     scale range configured for the raster (MinResX, MinResY, MaxResX and
+     MaxResY, in units of the SRS of the raster). A maximum resolution of 0
+     means that there is no upper limit */
+
+  double resx, resy;
+
+  if (gqt_resolution(r->geoquadtree, im, p_srs, &resx, &resy)!=0) return 1;
 
-      if (strlen(version)==0)
-      { exception("VersionNotDefined", "Missing parameter: VERSION"); continue; }
+  if (verbose_level>1)
+    printf("raster_in_scale resx=%f resy=%f\n", resx, resy);
 
-      current_version=version2numeric(version);
-      if (current_version==0) continue;
+  if ((resx<r->minresx)||(resy<r->minresy)) return 0;
 
-      if ((current_version!=10101)&&(current_version!=10300))
-      { exception("", "Version not supported"); continue; }
-      
-      if (strcmp(layers,  " ")==0)
-      { exception("LayerNotDefined", "Missing parameter: LAYERS"); continue; }
+  if ((r->maxresx>0)&&(resx>r->maxresx)) return 0;
+  if ((r->maxresy>0)&&(resy>r->maxresy)) return 0;
 
-      if (strcmp(styles,  " ")==0)
-      { exception("StyleNotDefined", "Missing parameter: STYLES"); continue; }
+  return 1;
+}
 
-      if (strcmp(srs,     " ")==0)
-      { exception("CRSNotDefined", "Missing parameter: CRS"); continue; }
+/******************************************************************************/
 
-      if (strcmp(sbbox,   " ")==0)
-      { exception("", "Missing parameter: SBBOX"); continue; }
+void render_raster(void *arg)
+{
+  /* Job resampling a raster, only where the image was not opaque when it
+     started. When every raster over it is already composited, it is put
+     directly under them while it is resampled. Otherwise it is resampled
+     into its own buffer, to be composited once its turn comes. It is not
+     started at all once the rasters over it have made the image opaque */
+
+  raster_render *rr=(raster_render *)arg;
+  render_batch *batch=rr->batch;
+  image im;
 
-      if (strcmp(swidth,  " ")==0)
-      { exception("", "Missing parameter: WIDTH");  continue; }
+  pthread_mutex_lock(&(batch->mutex));
 
-      if (strcmp(sheight, " ")==0)
-      { exception("", "Missing parameter: HEIGHT"); continue; }
+  rr->ret=-1;
+  rr->under=0;
 
-      if (strcmp(format,  " ")==0)
-      { exception("InvalidFormat", "Missing parameter: FORMAT"); continue; }
+  if (batch->cancelled==0)
+  {
+    rr->ret=0;
 
-      if (strcmp(transparent, " ")==0)
-      { strcpy(transparent, "FALSE"); }
+    if (batch->composited==rr->index) rr->under=1;
+    else coverage_copy(rr->cov, batch->cov);
+  }
 
-      if (strcmp(bgcolor, " ")==0)
-      { strcpy(bgcolor, "0xFFFFFF"); }
+  pthread_mutex_unlock(&(batch->mutex));
 
-      pch=strtok(sbbox, ","); bbox[0]=atof(pch);
-      pch=strtok(NULL,  ","); bbox[1]=atof(pch);
-      pch=strtok(NULL,  ","); bbox[2]=atof(pch);
-      pch=strtok(NULL,  ","); bbox[3]=atof(pch);
+  if (rr->ret!=0) return;
 
-      size[0]=atoi(swidth);
-      size[1]=atoi(sheight);
+  if (rr->under==1)
+  {
+    /* Nothing else touches acc and the coverage until it has finished */
 
-      if (size[0]<=0)
-      { exception("", "Invalid width: must be positive"); continue; }
+    im=rr->im;
+    im.buffer=batch->acc;
 
-      if (size[1]<=0)
-      { exception("", "Invalid height: must be positive"); continue; }
+    rr->ret=gqt_export(rr->r->geoquadtree, &im, rr->p_srs, batch->filter,
+                       batch->coarsen, batch->cov, batch->tiles, 1);
+    return;
+  }
 
-      if (size[0]>Service.MaxWidth)
-      {
-        sprintf(str, "Invalid width %i: cannot be more than MaxWidth (%i)",
-                size[0], Service.MaxWidth);
-        exception("", str);
-        continue;
-      }
+  memset(rr->im.buffer, 0, (long)rr->im.width*(long)rr->im.height*4L);
 
-      if (size[1]>Service.MaxHeight)
-      {
-        sprintf(str, "Invalid width %i: cannot be more than MaxHeight (%i)",
-                size[1], Service.MaxHeight);
-        exception("", str);
-        continue;
-      }
+  rr->ret=gqt_export(rr->r->geoquadtree, &(rr->im), rr->p_srs, batch->filter,
+                     batch->coarsen, rr->cov, batch->tiles, 0);
+}
 
-      if (bbox[0]>bbox[2])
-      { exception("", "Invalid bounding box (xmin>xmax)"); continue; }
+/******************************************************************************/
 
-      if (bbox[1]>bbox[3])
-      { exception("", "Invalid bounding box (ymin<ymax)"); continue; }
+int image_from_layers(service *Service, wms_request *req, image *ima,
+                      char *layer_names, char *str_srs, int filter,
+                      unsigned coarsen, tile_cache *tiles)
+{
+  /* Writes into a buffer an image corresponding to a set of layers,
+     a SRS, a bounding box in world units, and the size in pixels. The
+     rasters are resampled with filter from coarsen levels above the ones
+     that match the resolution of the image */
+
+  char *layer_name, *saveptr;
+  layer *l, *layers[MAX_REQUEST_LAYERS];
+  layer_srs *ls, *layers_srs[MAX_REQUEST_LAYERS];
+  raster *r, **rasters;
+  srs **rasters_srs;
+  raster_render renders[RENDER_PARALLEL], *rr;
+  render_batch batch;
+  unsigned char *hits;
+  arena_mark mark;
+  unsigned char *acc;
+  long length;
+  int num_layers, num_rasters, window, submitted, k, id;
+
+  /* The layers are listed from the bottom to the top */
+
+  num_layers=0;
+  num_rasters=0;
+
+  layer_name=strtok_r(layer_names, ",", &saveptr);
 
-      strlwr(format); /* Converts format to lowercase */
-      if ((strcmp(format, "jpeg")==0)||(strcmp(format, "image/jpeg")==0)||
-          (strcmp(format, "jpg")==0)||(strcmp(format, "image/jpg")==0))
-      { strcpy(format, "image/jpeg"); }
-      else if ((strcmp(format, "png")==0)||(strcmp(format, "image/png")==0))
-      { strcpy(format, "image/png"); }
-      else
-      { exception("", "Invalid image format"); continue; }
+  while (layer_name!=NULL)
+  {
+    if (num_layers==MAX_REQUEST_LAYERS)
+    { exception(req, "", "Too many layers"); return 1; }
 
-      im.width=size[0];
-      im.height=size[1];
+    l=seek_layer(Service, layer_name);
+    if (l==NULL) { exception(req, "", "Layer unknown"); return 1; }
 
-      im.minx=bbox[0];
-      im.miny=bbox[1];
-      im.maxx=bbox[2];
-      im.maxy=bbox[3];
+    ls=seek_layer_srs_entry(l, str_srs);
+    if (ls==NULL) { exception(req, "", "Invalid SRS"); return 1; }
 
-      length=im.width*im.height;
-      im.buffer=malloc(length*4);
-      if (im.buffer==NULL) { printf("image_from_layer malloc\n"); return 1; }
+    layers[num_layers]=l;
+    layers_srs[num_layers]=ls;
+    num_layers++;
+    num_rasters+=l->num_rasters;
 
-      if (strcmp(transparent, "FALSE")==0)
-      {
-        str[0]=bgcolor[2]; str[1]=bgcolor[3]; str[2]=0; sscanf(str, "%x", &red);
-        str[0]=bgcolor[4]; str[1]=bgcolor[5]; str[2]=0; sscanf(str, "%x", &green);
-        str[0]=bgcolor[6]; str[1]=bgcolor[7]; str[2]=0; sscanf(str, "%x", &blue);
+    layer_name=strtok_r(NULL, ",", &saveptr);
+  }
 
-        for (i=0; (i<length*4); )
-        {
-          im.buffer[i++]=red;
-          im.buffer[i++]=green;
-          im.buffer[i++]=blue;
-          im.buffer[i++]=255;
-        }
-      }
-      else
-      {
-        for (i=0; (i<length*4); i++) im.buffer[i]=0;
-      }
+  length=(long)ima->width*(long)ima->height;
 
-      ret=image_from_layers(&Service, &im, layers, srs);
-      if (ret==0)
-      {
-        add_logo(&im);
+  mark=arena_save();
 
-        if (strcmp(format, "image/jpeg")==0)
-        {
-          printf("Content-type: image/jpeg\r\n\r\n");
-          write_jpg(&im, NULL);
-        }
-        else
-        {
-          printf("Content-type: image/png\r\n\r\n");
-          write_png(&im, NULL);
-        }
-      }
+  /* The rasters to render, from the topmost to the bottommost one. Only
+     the rasters whose footprint intersects the requested bounding box
+     and whose scale range includes the image are kept, before any tile
+     is read */
 
-      free(im.buffer);
+  rasters=arena_alloc(num_rasters*sizeof(raster *)+1);
+  rasters_srs=arena_alloc(num_rasters*sizeof(srs *)+1);
 
-      continue;
+  num_rasters=0;
+
+  for (k=num_layers-1; (k>=0); k--)
+  {
+    l=layers[k];
+    ls=layers_srs[k];
+
+    hits=arena_alloc(l->num_rasters+1);
+
+    if (grid_query(ls->index, ima->minx, ima->miny, ima->maxx, ima->maxy,
+                   hits)==0) continue;
+
+    for (id=l->num_rasters-1; (id>=0); id--)
+    {
+      r=l->rasters[id];
+
+      if ((hits[r->id]==0)||(raster_in_scale(r, ima, ls->p_srs)==0)) continue;
+
+      rasters[num_rasters]=r;
+      rasters_srs[num_rasters]=ls->p_srs;
+      num_rasters++;
+    }
+  }
+
+  /* The buffers are reused by the following requests of the same size */
+
+  acc=pool_alloc(length*4L);
+  memset(acc, 0, length*4L);
+
+  batch.filter=filter;
+  batch.coarsen=coarsen;
+  batch.tiles=tiles;
+  batch.acc=acc;
+  batch.cov=coverage_new(ima->width, ima->height);
+  batch.composited=0;
+  batch.cancelled=0;
+  pthread_mutex_init(&(batch.mutex), NULL);
+
+  /* Up to window rasters render at the same time. The topmost one not
+     composited yet is put directly under acc, and the others render into
+     their own buffers and are composited as soon as they finish, in order.
+     A single raster at a time needs no buffer of its own */
+
+  window=(jobs_threads()>1)?RENDER_PARALLEL:1;
+  if (window>num_rasters) window=num_rasters;
+
+  for (k=0; (k<window); k++)
+  {
+    rr=&renders[k];
+
+    rr->im.width=ima->width;
+    rr->im.height=ima->height;
+
+    rr->im.minx=ima->minx;
+    rr->im.miny=ima->miny;
+    rr->im.maxx=ima->maxx;
+    rr->im.maxy=ima->maxy;
+
+    rr->im.buffer=NULL;
+    rr->cov=NULL;
+
+    if (window>1)
+    {
+      rr->im.buffer=pool_alloc(length*4L);
+      rr->cov=coverage_new(ima->width, ima->height);
     }
 
-    exception("", "Invalid request");
+    rr->batch=&batch;
   }
 
+  submitted=0;
+
+  for (k=0; (k<num_rasters); k++)
+  {
+    /* Each raster is only resampled where the image was not opaque when it
+       started, and the remaining ones are not started once the image is
+       completely opaque */
+
+    while ((submitted<num_rasters)&&(submitted<k+window)&&
+           (batch.cancelled==0))
+    {
+      rr=&renders[submitted%window];
+      rr->r=rasters[submitted];
+      rr->p_srs=rasters_srs[submitted];
+      rr->index=submitted;
+
+      job_group_init(&(rr->group));
+      job_submit(&(rr->group), &(rr->task), render_raster, rr);
+
+      submitted++;
+    }
+
+    if (k>=submitted) break;
+
+    rr=&renders[k%window];
+    job_group_wait(&(rr->group));
+
+    /* Puts the raster under the ones already composited, unless it was
+       put there while it was resampled */
+
+    pthread_mutex_lock(&(batch.mutex));
+
+    if (rr->ret==0)
+    {
+      if (rr->under==1) coverage_shrink(batch.cov, acc);
+      else composite_under(acc, rr->im.buffer, batch.cov);
+
+      if (coverage_complete(batch.cov)==1) batch.cancelled=1;
+    }
+
+    batch.composited=k+1;
+
+    pthread_mutex_unlock(&(batch.mutex));
+  }
+
+  if (verbose_level>1)
+    printf("image_from_layers rasters=%i rendered=%i\n", num_rasters,
+           submitted);
+
+  /* Puts the composited rasters over the background */
+
+  composite_background(ima->buffer, acc, length);
+
+  for (k=0; (k<window); k++)
+  {
+    coverage_free(renders[k].cov);
+    pool_free(renders[k].im.buffer);
+  }
+
+  pthread_mutex_destroy(&(batch.mutex));
+  coverage_free(batch.cov);
+
+  pool_free(acc);
+
+  arena_restore(mark);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int map_validator(service *Service, char *layer_names, char *str_srs,
+                  image *im, char *params, char *etag, time_t *last_modified,
+                  int *ttl)
+{
+  /* Derives the validator of a GetMap response of im. The modification
+     time is the newest one of the configuration and of the trees of the
+     requested layers, and the entity tag is a digest of the normalised
+     request parameters and of that time. For a tree with a change journal
+     only the imports that changed the tiles under im count, so that the
+     other responses stay valid. ttl is the time the image can be cached,
+     here and by the clients, the shortest CacheTTL of the layers, or 0 if
+     one of them is not cached.
+     Returns 1 if a layer is unknown */
+
+  char names[256], *layer_name, *saveptr;
+  layer *l;
+  layer_srs *ls;
+  raster *r;
+  time_t mtime, changed;
+
+  *last_modified=Service->configuration_mtime;
+  *ttl=-1;
+
+  strncpy(names, layer_names, 255);
+  names[255]=0;
+
+  layer_name=strtok_r(names, ",", &saveptr);
+
+  while (layer_name!=NULL)
+  {
+    l=seek_layer(Service, layer_name);
+    if (l==NULL) return 1;
+
+    if (l->cache==0) *ttl=0;
+    else if ((*ttl<0)||(l->cache_ttl<*ttl)) *ttl=l->cache_ttl;
+
+    ls=seek_layer_srs_entry(l, str_srs);
+
+    for (r=l->raster_list; (r!=NULL); r=(raster *)r->next)
+    {
+      gqt_journal_update(r->journal);
+
+      if ((r->journal->exists==0)||(ls==NULL))
+        mtime=gqt_mtime(r->geoquadtree);
+      else
+      {
+        mtime=r->journal->mtime;
+
+        changed=gqt_changed(r->geoquadtree, r->journal, im, ls->p_srs);
+        if (changed>mtime) mtime=changed;
+      }
+
+      if (mtime>*last_modified) *last_modified=mtime;
+    }
+
+    layer_name=strtok_r(NULL, ",", &saveptr);
+  }
+
+  if (*ttl<0) *ttl=0;
+
+  sprintf(etag, "\"%lx-%lx\"", hash_string(params),
+          (unsigned long)*last_modified);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int not_modified(wms_request *req, char *etag, time_t last_modified)
+{
+  /* Checks whether the client already has the response. If-None-Match
+     takes precedence over If-Modified-Since, which holds if the response
+     has not changed after its date. A date not understood is ignored */
+
+  time_t since;
+
+  if (req->if_none_match!=NULL)
+  {
+    if (strcmp(req->if_none_match, "*")==0) return 1;
+
+    return (strstr(req->if_none_match, etag)!=NULL);
+  }
+
+  if (req->if_modified_since!=NULL)
+  {
+    if (http_parse_date(req->if_modified_since, &since)!=0) return 0;
+
+    return (last_modified<=since);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void validator_headers(wms_request *req, char *etag, time_t last_modified,
+                       int max_age)
+{
+  char date[64];
+
+  http_date(last_modified, date);
+
+  output_printf(req->out, "ETag: %s\r\nLast-Modified: %s\r\n", etag, date);
+  output_printf(req->out, "Cache-Control: public, max-age=%i\r\n", max_age);
+}
+
+/******************************************************************************/
+
+void map_cost(service *Service, char *layer_names, char *str_srs, image *im,
+              unsigned coarsen, export_cost *cost)
+{
+  /* Estimates what rendering im coarsen levels above its own reads and
+     resamples, visiting the same rasters as image_from_layers but without
+     reading any tile. Rasters that would be hidden by the ones over them
+     are counted as well */
+
+  char names[256], *layer_name, *saveptr;
+  unsigned char *hits;
+  arena_mark mark;
+  layer *l;
+  layer_srs *ls;
+  raster *r;
+  int id, num_rasters;
+
+  cost->tiles=0;
+  cost->bytes=0;
+  cost->pixels=0;
+
+  strncpy(names, layer_names, 255);
+  names[255]=0;
+
+  num_rasters=0;
+
+  for (layer_name=strtok_r(names, ",", &saveptr); (layer_name!=NULL);
+       layer_name=strtok_r(NULL, ",", &saveptr))
+  {
+    l=seek_layer(Service, layer_name);
+    if (l==NULL) continue;
+
+    ls=seek_layer_srs_entry(l, str_srs);
+    if (ls==NULL) continue;
+
+    mark=arena_save();
+    hits=arena_alloc(l->num_rasters+1);
+
+    if (grid_query(ls->index, im->minx, im->miny, im->maxx, im->maxy, hits)!=0)
+    {
+      for (id=0; (id<l->num_rasters); id++)
+      {
+        r=l->rasters[id];
+
+        if ((hits[r->id]==1)&&(raster_in_scale(r, im, ls->p_srs)==1))
+        {
+          gqt_estimate(r->geoquadtree, im, ls->p_srs, coarsen, cost);
+          num_rasters++;
+        }
+      }
+    }
+
+    arena_restore(mark);
+  }
+
+  /* The image itself, the composited rasters and the buffers of the rasters
+     rendering at the same time, which a single raster does not need */
+
+  if (num_rasters>RENDER_PARALLEL) num_rasters=RENDER_PARALLEL;
+  if ((jobs_threads()<2)||(num_rasters<2)) num_rasters=0;
+
+  cost->bytes+=(unsigned long)im->width*im->height*4*(2+num_rasters);
+}
+
+/******************************************************************************/
+
+double map_work(export_cost *estimate, int filter)
+{
+  /* Work of rendering an image, in decoded bytes */
+
+  return estimate->bytes+
+         estimate->pixels*4.0*((filter==0)?1:BICUBIC_WEIGHT);
+}
+
+/******************************************************************************/
+
+void measure_rate(double work, struct timeval *start)
+{
+  /* Updates the work rendered per millisecond with a render that started
+     at start, giving more weight to the latest renders */
+
+  struct timeval now;
+  double ms;
+
+  gettimeofday(&now, NULL);
+
+  ms=(now.tv_sec-start->tv_sec)*1000.0+(now.tv_usec-start->tv_usec)/1000.0;
+  if ((ms<=0)||(work<=0)) return;
+
+  pthread_mutex_lock(&rate_mutex);
+
+  if (render_rate==0) render_rate=work/ms;
+  else render_rate=render_rate*0.8+(work/ms)*0.2;
+
+  pthread_mutex_unlock(&rate_mutex);
+}
+
+/******************************************************************************/
+
+int plan_map(service *Service, char *layers, char *srs, image *im,
+             export_cost *estimate, unsigned *coarsen, int *filter)
+{
+  /* Chooses how im is rendered within the budget of a request: its tiles
+     within BudgetMaxBytes, or within what is left of the admission limit
+     if the request alone exceeds it, and its work within what is
+     rendered in BudgetMaxTime. Coarser levels are tried first and the nearest filter
+     last; the most degraded rendering is used if none fits. Returns 1 if
+     the image is degraded */
+
+  unsigned long max_bytes, free_cost;
+  double max_work, rate;
+
+  *coarsen=0;
+  *filter=1;
+
+  map_cost(Service, layers, srs, im, 0, estimate);
+
+  max_bytes=(unsigned long)-1;
+  if (Service->BudgetMaxBytes>0) max_bytes=Service->BudgetMaxBytes;
+
+  /* A request that only has to wait for its turn is not degraded, nor
+     is one arriving while nothing is left, as no cost would be admitted */
+
+  if (Service->admission!=NULL)
+  {
+    free_cost=admission_free(Service->admission);
+    if ((free_cost>0)&&(free_cost<estimate->bytes)&&(free_cost<max_bytes))
+      max_bytes=free_cost;
+  }
+
+  pthread_mutex_lock(&rate_mutex);
+  rate=render_rate;
+  pthread_mutex_unlock(&rate_mutex);
+
+  max_work=-1;
+  if ((Service->BudgetMaxTime>0)&&(rate>0))
+    max_work=rate*Service->BudgetMaxTime;
+
+  while ((estimate->bytes>max_bytes)||
+         ((max_work>=0)&&(map_work(estimate, *filter)>max_work)))
+  {
+    if (*coarsen<MAX_COARSEN) (*coarsen)++;
+    else if (*filter==1) *filter=0;
+    else break;
+
+    map_cost(Service, layers, srs, im, *coarsen, estimate);
+  }
+
+  if (verbose_level>1)
+    printf("plan_map tiles=%lu bytes=%lu pixels=%lu coarsen=%u filter=%i\n",
+           estimate->tiles, estimate->bytes, estimate->pixels,
+           *coarsen, *filter);
+
+  return ((*coarsen>0)||(*filter!=1));
+}
+
+/******************************************************************************/
+
+int admit_map(service *Service, wms_request *req, export_cost *estimate,
+              unsigned long *cost)
+{
+  /* Waits until the estimated cost of rendering an image fits in what is
+     being rendered at the same time. Returns 1 if the request has been
+     answered with an exception instead; otherwise admission_leave has to
+     be called with cost once the image is rendered */
+
+  int ret;
+
+  *cost=0;
+
+  if (Service->admission==NULL) return 0;
+
+  ret=admission_enter(Service->admission, estimate->bytes);
+
+  if (ret==ADMISSION_TOO_LARGE)
+  {
+    exception(req, "", "Request too large, reduce its size or extent");
+    return 1;
+  }
+
+  if (ret==ADMISSION_TIMEOUT)
+  {
+    output_printf(req->out, "Status: 503 Service Unavailable\r\n");
+    output_printf(req->out, "Retry-After: %i\r\n", Service->QueueTimeout);
+    exception(req, "", "Server busy, try again later");
+    return 1;
+  }
+
+  *cost=estimate->bytes;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int cached_map(service *Service, wms_request *req, char *layers,
+               char *srs, image *im, char *format, char *params, char *etag,
+               time_t *last_modified, int *ttl, int *validator, int *caching)
+{
+  /* Answers a map request of im from the validators sent by the client or
+     from the response cache. Returns 1 if it has been answered, and otherwise
+     leaves what is needed to answer and to cache the rendered image.
+     params identifies the request for the validators and the cache */
+
+  int fd;
+  unsigned long cached_length;
+
+  *validator=(map_validator(Service, layers, srs, im, params, etag,
+                            last_modified, ttl)==0);
+
+  if ((*validator==1)&&(not_modified(req, etag, *last_modified)==1))
+  {
+    output_printf(req->out, "Status: 304 Not Modified\r\n");
+    validator_headers(req, etag, *last_modified, *ttl);
+    output_printf(req->out, "\r\n");
+    return 1;
+  }
+
+  /* Requests already rendered are served from the cache */
+
+  *caching=((*validator==1)&&(*ttl>0)&&(Service->cache!=NULL));
+
+  if (*caching==1)
+  {
+    fd=cache_get(Service->cache, params, *last_modified, &cached_length);
+
+    if (fd>=0)
+    {
+      output_printf(req->out, "Content-type: %s\r\n", format);
+      validator_headers(req, etag, *last_modified, *ttl);
+      output_printf(req->out, "\r\n");
+      output_file(req->out, fd, cached_length);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+palette *map_palette(service *Service, char *layers, image *im, int *owned)
+{
+  /* Returns the palette of an 8 bit PNG image of the requested layers, the
+     fixed one of the topmost layer if it has one. Otherwise the palette is
+     built for the image; when the image has more colours than fit, the
+     palette is kept for the same list of layers, up to BUILT_PALETTES
+     lists, and shared by its next images. owned is set to 1 if the caller
+     has to free the palette */
+
+  char names[256], *name, *saveptr;
+  layer *l=NULL;
+  palette *colors;
+
+  *owned=0;
+
+  strncpy(names, layers, 255);
+  names[255]=0;
+
+  for (name=strtok_r(names, ",", &saveptr); (name!=NULL);
+       name=strtok_r(NULL, ",", &saveptr))
+    l=seek_layer(Service, name);
+
+  if (l==NULL) return NULL;
+
+  if (l->colors!=NULL) return l->colors;
+
+  pthread_mutex_lock(&palette_mutex);
+  colors=NULL;
+  if (Service->palettes!=NULL) colors=hash_get(Service->palettes, layers);
+  pthread_mutex_unlock(&palette_mutex);
+
+  if (colors!=NULL) return colors;
+
+  colors=palette_octree(im->buffer, im->width*im->height, PALETTE_COLORS-1);
+
+  if (colors->num_colors<PALETTE_COLORS) { *owned=1; return colors; }
+
+  pthread_mutex_lock(&palette_mutex);
+
+  if (Service->palettes==NULL) Service->palettes=hash_new(64);
+
+  if (hash_get(Service->palettes, layers)!=NULL)
+  {
+    palette_free(colors);
+    colors=hash_get(Service->palettes, layers);
+  }
+  else if (Service->palettes->count<BUILT_PALETTES)
+    hash_put(Service->palettes, layers, colors);
+  else
+    *owned=1;
+
+  pthread_mutex_unlock(&palette_mutex);
+
+  return colors;
+}
+
+/******************************************************************************/
+
+int map_has_data(service *Service, char *layer_names, char *str_srs,
+                 image *im)
+{
+  /* Finds from the footprints of the rasters, without reading anything,
+     whether any raster of the layers would be drawn in im. Unknown layers
+     and SRSs count as data, so that they are reported when rendering */
+
+  char names[256], *layer_name, *saveptr;
+  unsigned char *hits;
+  arena_mark mark;
+  layer *l;
+  layer_srs *ls;
+  int id, found;
+
+  strncpy(names, layer_names, 255);
+  names[255]=0;
+
+  for (layer_name=strtok_r(names, ",", &saveptr); (layer_name!=NULL);
+       layer_name=strtok_r(NULL, ",", &saveptr))
+  {
+    l=seek_layer(Service, layer_name);
+    if (l==NULL) return 1;
+
+    ls=seek_layer_srs_entry(l, str_srs);
+    if (ls==NULL) return 1;
+
+    mark=arena_save();
+    hits=arena_alloc(l->num_rasters+1);
+
+    found=0;
+
+    if (grid_query(ls->index, im->minx, im->miny, im->maxx, im->maxy, hits)!=0)
+    {
+      for (id=0; ((id<l->num_rasters)&&(found==0)); id++)
+        if ((hits[id]==1)&&(raster_in_scale(l->rasters[id], im, ls->p_srs)==1))
+          found=1;
+    }
+
+    arena_restore(mark);
+
+    if (found==1) return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void blank_image(wms_request *req, unsigned long width, unsigned long height,
+                 char *format, unsigned char *background, int logo)
+{
+  /* Writes the body of an image without data, only background and the
+     logo. The first BLANK_IMAGES different ones are kept encoded until
+     the server exits, so that they are sent again without rendering or
+     encoding anything. Tiled clients ask for a few sizes, so the first
+     ones are the ones asked for again */
+
+  char key[128];
+  output_stream *encoded;
+  png_encoder *png;
+  palette *colors;
+  image im;
+  unsigned long length, i;
+
+  snprintf(key, sizeof(key), "%lux%lu %s %02x%02x%02x%02x %i", width, height,
+           format, background[0], background[1], background[2],
+           background[3], logo);
+
+  pthread_mutex_lock(&blank_mutex);
+  if (blank_images==NULL) blank_images=hash_new(BLANK_IMAGES);
+  encoded=(output_stream *)hash_get(blank_images, key);
+  pthread_mutex_unlock(&blank_mutex);
+
+  /* Images stored are never changed nor freed */
+
+  if (encoded!=NULL)
+  {
+    output_buffer(req->out, encoded->buffer, encoded->length);
+    return;
+  }
+
+  im.width=width;
+  im.height=height;
+
+  length=width*height;
+  im.buffer=malloc(length*4);
+  if (im.buffer==NULL) { fprintf(stderr, "blank_image: malloc\n"); exit(1); }
+
+  for (i=0; (i<length*4); i++) im.buffer[i]=background[i%4];
+
+  if (logo==1) add_logo(&im);
+
+  encoded=malloc(sizeof(output_stream));
+  if (encoded==NULL) { fprintf(stderr, "blank_image: malloc\n"); exit(1); }
+
+  output_init(encoded, NULL);
+
+  if (strcmp(format, "image/jpeg")==0)
+    write_jpg(&im, NULL, encoded);
+  else if (strcmp(format, FORMAT_PNG8)==0)
+  {
+    colors=palette_octree(im.buffer, length, PALETTE_COLORS-1);
+    png=png_encoder_begin(width, height, colors, encoded);
+    png_encoder_rows(png, im.buffer, height);
+    png_encoder_end(png);
+    palette_free(colors);
+  }
+  else
+    write_png(&im, NULL, encoded);
+
+  free(im.buffer);
+
+  output_buffer(req->out, encoded->buffer, encoded->length);
+
+  pthread_mutex_lock(&blank_mutex);
+
+  if ((blank_images->count<BLANK_IMAGES)&&
+      (hash_get(blank_images, key)==NULL))
+  {
+    hash_put(blank_images, key, encoded);
+    encoded=NULL;
+  }
+
+  pthread_mutex_unlock(&blank_mutex);
+
+  if (encoded!=NULL) { free(encoded->buffer); free(encoded); }
+}
+
+/******************************************************************************/
+
+void render_map(service *Service, wms_request *req, image *im, char *layers,
+                char *srs, char *format, char *params,
+                unsigned char *background, int logo)
+{
+  /* Answers with the image of the given layers over the extent and size of
+     im, filled first with background. The image is rendered and encoded in
+     strips of STRIP_ROWS rows, so that only one strip is in memory and the
+     client receives the first rows while the next ones are rendered */
+
+  char etag[64], names[256];
+  time_t last_modified;
+  int validator, ttl, caching, ret;
+  unsigned long length, i, first_row, body=0;
+  png_encoder *png=NULL;
+  jpg_encoder *jpg=NULL;
+  palette *colors=NULL;
+  int owned=0;
+  tile_cache *tiles;
+  cache_flight *flight=NULL;
+  unsigned long cost;
+  export_cost estimate;
+  unsigned coarsen;
+  int filter, degraded;
+  struct timeval start;
+  image strip;
+
+  if (cached_map(Service, req, layers, srs, im, format, params, etag,
+                 &last_modified, &ttl, &validator, &caching)==1) return;
+
+  /* Requests outside the footprints of all the rasters, or out of their
+     scale ranges, get an image without data */
+
+  if (map_has_data(Service, layers, srs, im)==0)
+  {
+    output_printf(req->out, "Content-type: %s\r\n", format);
+    if (validator==1) validator_headers(req, etag, last_modified, ttl);
+    output_printf(req->out, "\r\n");
+
+    blank_image(req, im->width, im->height, format, background, logo);
+    return;
+  }
+
+  /* Identical requests arriving meanwhile wait for this render, and are
+     then answered from the cache */
+
+  if (caching==1)
+  {
+    flight=cache_begin(Service->cache, params, last_modified);
+
+    if ((flight==NULL)&&
+        (cached_map(Service, req, layers, srs, im, format, params, etag,
+                    &last_modified, &ttl, &validator, &caching)==1)) return;
+  }
+
+  /* An image over the budget of a request is rendered from coarser
+     levels and, if needed, with the nearest filter. It is neither cached
+     nor validated, so that the next request gets the full image */
+
+  degraded=plan_map(Service, layers, srs, im, &estimate, &coarsen, &filter);
+
+  if (degraded==1) { caching=0; validator=0; }
+
+  /* Requests are served while their estimated cost fits, and the rest
+     wait or are rejected before any tile is read */
+
+  if (admit_map(Service, req, &estimate, &cost)==1)
+  {
+    if (flight!=NULL) cache_end(Service->cache, flight);
+    return;
+  }
+
+  gettimeofday(&start, NULL);
+
+  strip.width=im->width;
+  strip.minx=im->minx;
+  strip.maxx=im->maxx;
+
+  length=strip.width*((im->height<STRIP_ROWS)?im->height:STRIP_ROWS);
+  strip.buffer=pool_alloc(length*4);
+
+  /* The source tiles shared by consecutive strips are decoded once */
+
+  tiles=tile_cache_new();
+
+  for (first_row=0; (first_row<im->height); first_row+=strip.height)
+  {
+    strip.height=im->height-first_row;
+    if (strip.height>STRIP_ROWS) strip.height=STRIP_ROWS;
+
+    strip.maxy=im->maxy-first_row*(im->maxy-im->miny)/im->height;
+    strip.miny=im->maxy-(first_row+strip.height)*(im->maxy-im->miny)/im->height;
+
+    length=strip.width*strip.height;
+    for (i=0; (i<length*4); i++) strip.buffer[i]=background[i%4];
+
+    strncpy(names, layers, 255);
+    names[255]=0;
+
+    tile_cache_next(tiles);
+
+    ret=image_from_layers(Service, req, &strip, names, srs, filter, coarsen,
+                          tiles);
+
+    /* Invalid requests are found in the first strip, before anything of
+       the image has been written */
+
+    if (first_row==0)
+    {
+      if (ret!=0) break;
+
+      output_printf(req->out, "Content-type: %s\r\n", format);
+      if (validator==1) validator_headers(req, etag, last_modified, ttl);
+      if (degraded==1)
+        output_printf(req->out, "X-GeoQuadTree-Degraded: levels=%u%s\r\n",
+                      coarsen, (filter==0)?", filter=nearest":"");
+      output_printf(req->out, "\r\n");
+
+      body=req->out->length;
+
+      if (strcmp(format, "image/jpeg")==0)
+        jpg=jpg_encoder_begin(im->width, im->height, req->out);
+      else if (strcmp(format, FORMAT_PNG8)==0)
+      {
+        colors=map_palette(Service, layers, &strip, &owned);
+        png=png_encoder_begin(im->width, im->height, colors, req->out);
+      }
+      else
+        png=png_encoder_begin(im->width, im->height, NULL, req->out);
+    }
+
+    if (logo==1) add_logo_rows(&strip, im->height, first_row);
+
+    if (jpg!=NULL) jpg_encoder_rows(jpg, strip.buffer, strip.height);
+    else png_encoder_rows(png, strip.buffer, strip.height);
+
+    /* An image to be cached is kept whole in the response buffer */
+
+    if (caching==0) output_flush(req->out);
+  }
+
+  tile_cache_free(tiles);
+  pool_free(strip.buffer);
+
+  if (jpg!=NULL) jpg_encoder_end(jpg);
+  if (png!=NULL) png_encoder_end(png);
+
+  if (owned==1) palette_free(colors);
+
+  if ((caching==1)&&((jpg!=NULL)||(png!=NULL)))
+    cache_put(Service->cache, params, last_modified, ttl,
+              req->out->buffer+body, req->out->length-body);
+
+  if ((jpg!=NULL)||(png!=NULL))
+    measure_rate(map_work(&estimate, filter), &start);
+
+  if (cost>0) admission_leave(Service->admission, cost);
+
+  if (flight!=NULL) cache_end(Service->cache, flight);
+}
+
+/******************************************************************************/
+
+layer_srs *metatile_grid(service *Service, char *layers, char *srs,
+                         double *bbox, int *size, long *col, long *row)
+{
+  /* Finds whether a GetMap request is a tile of the grid of its SRS, the
+     one of the first requested layer, and its column and row in that grid.
+     Returns NULL if it is not, or if metatiles are not rendered */
+
+  char names[256], *name, *saveptr;
+  layer *l;
+  layer_srs *ls;
+  double x, y;
+
+  if ((Service->MetaTile<=1)||(Service->cache==NULL)) return NULL;
+
+  if ((size[0]*Service->MetaTile>Service->MaxWidth)||
+      (size[1]*Service->MetaTile>Service->MaxHeight)) return NULL;
+
+  strncpy(names, layers, 255);
+  names[255]=0;
+
+  name=strtok_r(names, ",", &saveptr);
+  if (name==NULL) return NULL;
+
+  l=seek_layer(Service, name);
+  if (l==NULL) return NULL;
+
+  ls=seek_layer_srs_entry(l, srs);
+  if ((ls==NULL)||(ls->tile_grid==0)) return NULL;
+
+  if ((bbox[2]<=bbox[0])||(bbox[3]<=bbox[1])) return NULL;
+
+  x=(bbox[0]-ls->tile_origin[0])/(bbox[2]-bbox[0]);
+  y=(ls->tile_origin[1]-bbox[3])/(bbox[3]-bbox[1]);
+
+  *col=(long)floor(x+0.5);
+  *row=(long)floor(y+0.5);
+
+  if ((fabs(x-*col)>METATILE_TOLERANCE)||(fabs(y-*row)>METATILE_TOLERANCE))
+    return NULL;
+
+  return ls;
+}
+
+/******************************************************************************/
+
+void render_metatile(service *Service, wms_request *req, image *im,
+                     char *layers, char *srs, char *format, char *head,
+                     char *tail, double *origin, long col, long row,
+                     unsigned char *background)
+{
+  /* Answers a tile of a grid rendering at once the block of MetaTile x
+     MetaTile tiles around it, so that the source tiles and their decoding
+     are shared by the whole block, and each raster is resampled with a
+     single coordinate transformation instead of one per tile. Every tile
+     of the block is cached, and params of each one is head, its column
+     and row, and tail */
+
+  char params[2048], block[2048], etag[64], tile_etag[64], names[256];
+  time_t last_modified, tile_modified;
+  int validator, ttl, caching, tile_ttl;
+  cache_flight *flight=NULL;
+  long n, mcol, mrow, i, j, y;
+  unsigned long length, k, cost;
+  unsigned coarsen;
+  int filter;
+  export_cost estimate;
+  double sizex, sizey;
+  image meta, tile;
+  output_stream encoded, answer;
+  palette *colors=NULL;
+  png_encoder *png;
+  int owned=0;
+
+  snprintf(params, sizeof(params), "%s&%ld,%ld%s", head, col, row, tail);
+
+  if (cached_map(Service, req, layers, srs, im, format, params, etag,
+                 &last_modified, &ttl, &validator, &caching)==1) return;
+
+  if (map_has_data(Service, layers, srs, im)==0)
+  {
+    output_printf(req->out, "Content-type: %s\r\n", format);
+    if (validator==1) validator_headers(req, etag, last_modified, ttl);
+    output_printf(req->out, "\r\n");
+
+    blank_image(req, im->width, im->height, format, background, 1);
+    return;
+  }
+
+  /* Without the cache, the other tiles of the block would be lost */
+
+  n=(caching==1)?Service->MetaTile:1;
+
+  mcol=col-(((col%n)+n)%n);
+  mrow=row-(((row%n)+n)%n);
+
+  /* Requests for any tile of the block wait for the one rendering it,
+     which holds the flight of the first tile of the block */
+
+  if (caching==1)
+  {
+    snprintf(block, sizeof(block), "%s&%ld,%ld%s", head, mcol, mrow, tail);
+
+    flight=cache_begin(Service->cache, block, last_modified);
+
+    if ((flight==NULL)&&
+        (cached_map(Service, req, layers, srs, im, format, params, etag,
+                    &last_modified, &ttl, &validator, &caching)==1)) return;
+  }
+
+  sizex=im->maxx-im->minx;
+  sizey=im->maxy-im->miny;
+
+  meta.width=n*im->width;
+  meta.height=n*im->height;
+
+  meta.minx=origin[0]+mcol*sizex;
+  meta.maxx=meta.minx+n*sizex;
+  meta.maxy=origin[1]-mrow*sizey;
+  meta.miny=meta.maxy-n*sizey;
+
+  /* A block over the budget of a request, or that cannot be admitted at
+     once, is not degraded nor waited for. The tile is rendered alone
+     instead, as any other map */
+
+  cost=0;
+
+  if ((plan_map(Service, layers, srs, &meta, &estimate, &coarsen,
+                &filter)==1)||
+      ((Service->admission!=NULL)&&
+       (admission_try(Service->admission, estimate.bytes)==0)))
+  {
+    if (flight!=NULL) cache_end(Service->cache, flight);
+
+    render_map(Service, req, im, layers, srs, format, params, background, 1);
+    return;
+  }
+
+  if (Service->admission!=NULL) cost=estimate.bytes;
+
+  length=meta.width*meta.height;
+  meta.buffer=pool_alloc(length*4);
+
+  for (k=0; (k<length*4); k++) meta.buffer[k]=background[k%4];
+
+  strncpy(names, layers, 255);
+  names[255]=0;
+
+  if (image_from_layers(Service, req, &meta, names, srs, 1, 0, NULL)!=0)
+  {
+    pool_free(meta.buffer);
+    if (cost>0) admission_leave(Service->admission, cost);
+    if (flight!=NULL) cache_end(Service->cache, flight);
+    return;
+  }
+
+  if (strcmp(format, FORMAT_PNG8)==0)
+    colors=map_palette(Service, layers, &meta, &owned);
+
+  tile.width=im->width;
+  tile.height=im->height;
+  tile.buffer=pool_alloc(tile.width*tile.height*4);
+
+  answer.buffer=NULL;
+
+  for (j=0; (j<n); j++)
+  {
+    for (i=0; (i<n); i++)
+    {
+      for (y=0; (y<tile.height); y++)
+        memcpy(tile.buffer+y*tile.width*4,
+               meta.buffer+((j*tile.height+y)*meta.width+i*tile.width)*4,
+               tile.width*4);
+
+      tile.minx=meta.minx+i*sizex;
+      tile.maxx=tile.minx+sizex;
+      tile.maxy=meta.maxy-j*sizey;
+      tile.miny=tile.maxy-sizey;
+
+      add_logo(&tile);
+
+      output_init(&encoded, NULL);
+
+      if (strcmp(format, "image/jpeg")==0)
+        write_jpg(&tile, NULL, &encoded);
+      else if (colors!=NULL)
+      {
+        png=png_encoder_begin(tile.width, tile.height, colors, &encoded);
+        png_encoder_rows(png, tile.buffer, tile.height);
+        png_encoder_end(png);
+      }
+      else
+        write_png(&tile, NULL, &encoded);
+
+      if (caching==1)
+      {
+        snprintf(params, sizeof(params), "%s&%ld,%ld%s",
+                 head, mcol+i, mrow+j, tail);
+
+        /* Each tile is cached with its own validator, as imports may
+           have changed only some tiles of the block */
+
+        map_validator(Service, layers, srs, &tile, params, tile_etag,
+                      &tile_modified, &tile_ttl);
+
+        cache_put(Service->cache, params, tile_modified, tile_ttl,
+                  encoded.buffer, encoded.length);
+      }
+
+      if ((mcol+i==col)&&(mrow+j==row)) answer=encoded;
+      else free(encoded.buffer);
+    }
+  }
+
+  pool_free(tile.buffer);
+  pool_free(meta.buffer);
+
+  if (owned==1) palette_free(colors);
+
+  if (cost>0) admission_leave(Service->admission, cost);
+
+  if (flight!=NULL) cache_end(Service->cache, flight);
+
+  output_printf(req->out, "Content-type: %s\r\n", format);
+  if (validator==1) validator_headers(req, etag, last_modified, ttl);
+  output_printf(req->out, "\r\n");
+
+  output_buffer(req->out, answer.buffer, answer.length);
+  free(answer.buffer);
+}
+
+/******************************************************************************/
+
+void handle_request(service *Service, wms_request *req)
+{
+  /* Answers a WMS request. Everything that depends on the request is kept
+     in req and in local variables, so that several threads can run this
+     function at the same time over the same Service */
+
+  char query_string[1024], *pch, *saveptr;
+  char version[256], request[256], layers[256], format[256];
+  char sbbox[256], swidth[256], sheight[256], styles[256], srs[256];
+  char transparent[256], bgcolor[256], updatesequence[256], str[256];
+  char wmts[256], tile_layer[256], tilematrix[256], tilerow[256], tilecol[256];
+  char params[2048], head[1024], tail[512];
+  unsigned char background[4];
+  layer_srs *ls;
+  long col, row;
+  int red, green, blue;
+  double bbox[4];
+  int size[2];
+  unsigned long i;
+  image im;
+
+  if (wmts_path(Service, req)==0) return;
+
+  if (req->query_string==NULL) strcpy(query_string, "");
+  else strncpy(query_string, req->query_string, 1023);
+  query_string[1023]=0;
+
+  req->version=10300;
+
+  strcpy(version, " ");
+  strcpy(request, " ");
+  strcpy(layers, " ");
+  strcpy(styles, " ");
+  strcpy(srs, " ");
+  strcpy(sbbox, " ");
+  strcpy(swidth, " ");
+  strcpy(sheight, " ");
+  strcpy(format, " ");
+  strcpy(transparent, " ");
+  strcpy(bgcolor, " ");
+  strcpy(updatesequence, " ");
+  strcpy(wmts, " ");
+  strcpy(tile_layer, " ");
+  strcpy(tilematrix, " ");
+  strcpy(tilerow, " ");
+  strcpy(tilecol, " ");
+
+  pch=strtok_r(query_string, "&", &saveptr);
+  while (pch!=NULL)
+  {
+    if (strncasecmp(pch, "VERSION=",      8)==0)
+      strncpy(version,     &pch[ 8], 256);
+
+    if (strncasecmp(pch, "REQUEST=",      8)==0)
+      strncpy(request,     &pch[ 8], 256);
+
+    if (strncasecmp(pch, "LAYERS=",       7)==0)
+      strncpy(layers,      &pch[ 7], 256);
+
+    if (strncasecmp(pch, "STYLES=",       7)==0)
+      strncpy(styles,      &pch[ 7], 256);
+
+    if (strncasecmp(pch, "SRS=",          4)==0)
+      strncpy(srs,         &pch[ 4], 256);
+
+    if (strncasecmp(pch, "BBOX=",         5)==0)
+      strncpy(sbbox,       &pch[ 5], 256);
+
+    if (strncasecmp(pch, "WIDTH=",        6)==0)
+      strncpy(swidth,      &pch[ 6], 256);
+
+    if (strncasecmp(pch, "HEIGHT=",       7)==0)
+      strncpy(sheight,     &pch[ 7], 256);
+
+    if (strncasecmp(pch, "FORMAT=",       7)==0)
+      strncpy(format,      &pch[ 7], 256);
+
+    if (strncasecmp(pch, "TRANSPARENT=", 12)==0)
+      strncpy(transparent, &pch[12], 256);
+
+    if (strncasecmp(pch, "BGCOLOR=",      8)==0)
+      strncpy(bgcolor,     &pch[ 8], 256);
+
+    if (strncasecmp(pch, "UPDATESEQUENCE=",     15)==0)
+      strncpy(updatesequence, &pch[15], 256);
+
+    if (strncasecmp(pch, "SERVICE=",      8)==0)
+      strncpy(wmts,        &pch[ 8], 256);
+
+    if (strncasecmp(pch, "LAYER=",        6)==0)
+      strncpy(tile_layer,  &pch[ 6], 256);
+
+    if (strncasecmp(pch, "TILEMATRIX=",  11)==0)
+      strncpy(tilematrix,  &pch[11], 256);
+
+    if (strncasecmp(pch, "TILEROW=",      8)==0)
+      strncpy(tilerow,     &pch[ 8], 256);
+
+    if (strncasecmp(pch, "TILECOL=",      8)==0)
+      strncpy(tilecol,     &pch[ 8], 256);
+
+    pch=strtok_r(NULL, "&", &saveptr);
+  }
+
+  if (strlen(request)==0)
+  {
+    exception(req, "", "Missing parameter: REQUEST");
+    return;
+  }
+
+  /* WMTS requests in KVP encoding address the same tiles as the paths */
+
+  if (strcasecmp(wmts, "WMTS")==0)
+  {
+    if (strcmp(request, "GetCapabilities")==0)
+      write_capabilities(req, &(Service->capabilities_wmts));
+    else if (strcmp(request, "GetTile")==0)
+    {
+      if ((strcmp(tile_layer, " ")==0)||(strcmp(tilematrix, " ")==0)||
+          (strcmp(tilerow, " ")==0)||(strcmp(tilecol, " ")==0))
+      { exception(req, "MissingParameterValue", "Missing parameter: LAYER, TILEMATRIX, TILEROW or TILECOL"); return; }
+
+      wmts_get_tile(Service, req, tile_layer, atoi(tilematrix),
+                    atol(tilecol), atol(tilerow));
+    }
+    else
+      exception(req, "OperationNotSupported", "Invalid request");
+
+    return;
+  }
+
+  if ((strcmp(request, "GetCapabilities")==0)||
+      (strcmp(request, "capabilities")==0))
+  {
+    if (strcmp(updatesequence, " ")!=0)
+    {
+      if (strcmp(updatesequence, Service->update_sequence)==0)
+      {
+        exception(req, "CurrentUpdateSequence", "Capabilities have not changed");
+        return;
+      }
+
+      if (strcmp(updatesequence, Service->update_sequence)>0)
+      {
+        exception(req, "InvalidUpdateSequence", "Capabilities older than requested");
+        return;
+      }
+    }
+
+    /* In response to a GetCapabilities request that does not specify a
+       version number, the server shall respond with the highest version
+       it supports */
+
+    if (strcmp(version, " ")==0) strcpy(version, "1.3.0");
+
+    req->version=version2numeric(req, version);
+
+    /*
+       This server supports WMS versions 1.1.1 and 1.3.0
+
+       If the requested version is greater than or equal to 1.3.0,
+       then the server will send 1.3.0
+
+       If the requested version is less than 1.3.0,
+       then the server will send 1.1.1
+    */
+
+    if (req->version>0)
+    {
+      if (req->version>=10300)
+      {
+        req->version=10300;
+        write_capabilities(req, &(Service->capabilities_1_3_0));
+      }
+      else
+      {
+        req->version=10101;
+        write_capabilities(req, &(Service->capabilities_1_1_1));
+      }
+    }
+
+    return;
+  }
+  else if (strcmp(request, "GetMap")==0)
+  {
+    /* The VERSION parameter is madatory in requests
+       other than GetCapabilities */
+
+    if (strlen(version)==0)
+    { exception(req, "VersionNotDefined", "Missing parameter: VERSION"); return; }
+
+    req->version=version2numeric(req, version);
+    if (req->version==0) return;
+
+    if ((req->version!=10101)&&(req->version!=10300))
+    { exception(req, "", "Version not supported"); return; }
+    
+    if (strcmp(layers,  " ")==0)
+    { exception(req, "LayerNotDefined", "Missing parameter: LAYERS"); return; }
+
+    if (strcmp(styles,  " ")==0)
+    { exception(req, "StyleNotDefined", "Missing parameter: STYLES"); return; }
+
+    if (strcmp(srs,     " ")==0)
+    { exception(req, "CRSNotDefined", "Missing parameter: CRS"); return; }
+
+    if (strcmp(sbbox,   " ")==0)
+    { exception(req, "", "Missing parameter: SBBOX"); return; }
+
+    if (strcmp(swidth,  " ")==0)
+    { exception(req, "", "Missing parameter: WIDTH");  return; }
+
+    if (strcmp(sheight, " ")==0)
+    { exception(req, "", "Missing parameter: HEIGHT"); return; }
+
+    if (strcmp(format,  " ")==0)
+    { exception(req, "InvalidFormat", "Missing parameter: FORMAT"); return; }
+
+    if (strcmp(transparent, " ")==0)
+    { strcpy(transparent, "FALSE"); }
+
+    if (strcmp(bgcolor, " ")==0)
+    { strcpy(bgcolor, "0xFFFFFF"); }
+
+    pch=strtok_r(sbbox, ",", &saveptr);
+    for (i=0; ((i<4)&&(pch!=NULL)); i++)
+    {
+      bbox[i]=atof(pch);
+      pch=strtok_r(NULL, ",", &saveptr);
+    }
+
+    if (i<4)
+    { exception(req, "", "Invalid bounding box"); return; }
+
+    size[0]=atoi(swidth);
+    size[1]=atoi(sheight);
+
+    if (size[0]<=0)
+    { exception(req, "", "Invalid width: must be positive"); return; }
+
+    if (size[1]<=0)
+    { exception(req, "", "Invalid height: must be positive"); return; }
+
+    if (size[0]>Service->MaxWidth)
+    {
+      sprintf(str, "Invalid width %i: cannot be more than MaxWidth (%i)",
+              size[0], Service->MaxWidth);
+      exception(req, "", str);
+      return;
+    }
+
+    if (size[1]>Service->MaxHeight)
+    {
+      sprintf(str, "Invalid width %i: cannot be more than MaxHeight (%i)",
+              size[1], Service->MaxHeight);
+      exception(req, "", str);
+      return;
+    }
+
+    if (bbox[0]>bbox[2])
+    { exception(req, "", "Invalid bounding box (xmin>xmax)"); return; }
+
+    if (bbox[1]>bbox[3])
+    { exception(req, "", "Invalid bounding box (ymin<ymax)"); return; }
+
+    strlwr(format); /* Converts format to lowercase */
+    if ((strcmp(format, "jpeg")==0)||(strcmp(format, "image/jpeg")==0)||
+        (strcmp(format, "jpg")==0)||(strcmp(format, "image/jpg")==0))
+    { strcpy(format, "image/jpeg"); }
+    else if ((strcmp(format, "png8")==0)||(strcmp(format, "image/png8")==0)||
+             ((strncmp(format, "image/png", 9)==0)&&(strstr(format, "8bit")!=NULL)))
+    { strcpy(format, FORMAT_PNG8); }
+    else if ((strcmp(format, "png")==0)||(strcmp(format, "image/png")==0))
+    { strcpy(format, "image/png"); }
+    else
+    { exception(req, "", "Invalid image format"); return; }
+
+    /* A client that already has the image of an identical request over
+       unchanged trees is answered without rendering it again. The
+       parameters are normalised so that equivalent requests share the
+       validator and the cached image */
+
+    strncpy(str, srs, 255);
+    str[255]=0;
+    for (i=0; (i<strlen(str)); i++) str[i]=toupper(str[i]);
+
+    snprintf(params, sizeof(params),
+             "%i&%s&%s&%s&%.10g,%.10g,%.10g,%.10g&%i&%i&%s&%s",
+             req->version, layers, styles, str,
+             bbox[0], bbox[1], bbox[2], bbox[3], size[0], size[1], format,
+             (strcmp(transparent, "FALSE")==0)?bgcolor:"TRUE");
+
+    /* The tiles of a metatile are identified by their position in the
+       grid instead of by their bounding box */
+
+    ls=metatile_grid(Service, layers, srs, bbox, size, &col, &row);
+
+    if (ls!=NULL)
+    {
+      snprintf(head, sizeof(head), "%i&%s&%s&%s&%.10g,%.10g",
+               req->version, layers, styles, str,
+               bbox[2]-bbox[0], bbox[3]-bbox[1]);
+
+      snprintf(tail, sizeof(tail), "&%i&%i&%s&%s", size[0], size[1], format,
+               (strcmp(transparent, "FALSE")==0)?bgcolor:"TRUE");
+    }
+
+    if (strcmp(transparent, "FALSE")==0)
+    {
+      str[0]=bgcolor[2]; str[1]=bgcolor[3]; str[2]=0; sscanf(str, "%x", &red);
+      str[0]=bgcolor[4]; str[1]=bgcolor[5]; str[2]=0; sscanf(str, "%x", &green);
+      str[0]=bgcolor[6]; str[1]=bgcolor[7]; str[2]=0; sscanf(str, "%x", &blue);
+
+      background[0]=red;
+      background[1]=green;
+      background[2]=blue;
+      background[3]=255;
+    }
+    else
+    {
+      background[0]=background[1]=background[2]=background[3]=0;
+    }
+
+    im.width=size[0];
+    im.height=size[1];
+
+    im.minx=bbox[0];
+    im.miny=bbox[1];
+    im.maxx=bbox[2];
+    im.maxy=bbox[3];
+
+    if (ls!=NULL)
+      render_metatile(Service, req, &im, layers, srs, format, head, tail,
+                      ls->tile_origin, col, row, background);
+    else
+      render_map(Service, req, &im, layers, srs, format, params, background, 1);
+
+    return;
+  }
+
+  exception(req, "", "Invalid request");
+}
+
+/******************************************************************************/
+
+void *worker(void *arg)
+{
+  /* Accepts and answers FastCGI requests until the web server closes the
+     connection. The requests are accepted one at a time, but served
+     concurrently by all the workers, each one with the configuration
+     current when it arrived */
+
+  service *Service;
+  FCGX_Request fcgi;
+  output_stream out;
+  wms_request req;
+  int ret;
+
+  if (FCGX_InitRequest(&fcgi, 0, 0)!=0)
+  { fprintf(stderr, "worker: FCGX_InitRequest\n"); return NULL; }
+
+  /* The responses are assembled in a buffer reused by all the requests
+     of the worker */
+
+  output_init(&out, NULL);
+
+  while (1)
+  {
+    pthread_mutex_lock(&accept_mutex);
+    ret=FCGX_Accept_r(&fcgi);
+    pthread_mutex_unlock(&accept_mutex);
+
+    if (ret<0) break;
+
+    output_reset(&out, fcgi.out);
+
+    req.query_string=FCGX_GetParam("QUERY_STRING", fcgi.envp);
+    req.http_host=FCGX_GetParam("HTTP_HOST", fcgi.envp);
+    req.request_uri=FCGX_GetParam("REQUEST_URI", fcgi.envp);
+    req.path_info=FCGX_GetParam("PATH_INFO", fcgi.envp);
+    req.if_none_match=FCGX_GetParam("HTTP_IF_NONE_MATCH", fcgi.envp);
+    req.if_modified_since=FCGX_GetParam("HTTP_IF_MODIFIED_SINCE", fcgi.envp);
+    req.out=&out;
+
+    Service=service_acquire();
+    handle_request(Service, &req);
+    service_release(Service);
+
+    /* Temporaries left by a request that failed are dropped */
+
+    arena_reset();
+
+    output_finish(&out);
+
+    FCGX_Finish_r(&fcgi);
+  }
+
+  free(out.buffer);
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+void usage(char *program)
+{
+  printf("Usage: %s Serves WMS requests from a FastCGI enabled web server\n", program);
+  printf("          -c path_configuration_file (optional)\n");
+  printf("\n");
+
+  printf("Usage: %s -p Serves WMS requests over HTTP without a web server\n", program);
+  printf("          -p port\n");
+  printf("          -f number_of_processes (default 1)\n");
+  printf("          -c path_configuration_file (optional)\n");
+  printf("\n");
+}
+
+/******************************************************************************/
+
+int main(int argc, char *argv[])
+{
+  /* This is the main function of the WMS service */  
+
+  service *Service;
+  pthread_t *threads, reload_thread;
+  int port, processes, num_threads, max_connections, decode_threads;
+  int i, c;
+
+  strcpy(configuration_file, "/etc/geoquadtree/geoquadtreeserver.xml");
+
+  port=0;
+  processes=1;
+
+  while ((c=getopt(argc, argv, "?c:f:hp:"))>0)
+  {
+    switch (c)
+    {
+      case 'c': strncpy(configuration_file, optarg, 1023); break;
+
+      case 'f': processes=atoi(optarg); break;
+
+      case 'p': port=atoi(optarg); break;
+
+      default: usage(argv[0]); return 0;
+    }
+  }
+
+  init_resample();
+  srs_import(&p_srs_84, "EPSG", "EPSG:4326");
+
+  Service=load_service(configuration_file, NULL);
+  if (Service==NULL) exit(1);
+
+  list_configuration(Service, "/tmp/geoquadtree.log");
+  init_logo(Service);
+
+  /* The cache and admission budgets are shared by the processes */
+
+  if (Service->CachePath!=NULL)
+    Service->cache=cache_new(Service->CachePath,
+                          Service->CacheMaxBytes/((processes>0)?processes:1));
+
+  if (Service->AdmissionMaxBytes>0)
+    Service->admission=admission_new(
+      Service->AdmissionMaxBytes/((processes>0)?processes:1),
+      Service->QueueTimeout);
+
+  current_service=Service;
+
+  /* The first configuration is freed once replaced */
+
+  num_threads=Service->Threads;
+  max_connections=Service->MaxConnections;
+
+  decode_threads=Service->DecodeThreads;
+  if (decode_threads==0)
+    decode_threads=sysconf(_SC_NPROCESSORS_ONLN)/((processes>0)?processes:1);
+
+  /* From here on, the logo and the resampling tables are only read, and
+     the configuration is only replaced by the reloader of each process.
+     The main thread serves requests as one of the workers */
+
+  if (port>0)
+  {
+    /* Standalone HTTP server. The processes share the port */
+
+    for (i=1; (i<processes); i++)
+    {
+      if (fork()==0) break;
+    }
+
+    /* The threads are started once the processes have been forked */
+
+    jobs_init(decode_threads);
+
+    if (pthread_create(&reload_thread, NULL, reloader, NULL)!=0)
+    { fprintf(stderr, "main: pthread_create\n"); exit(1); }
+
+    return http_serve(num_threads, max_connections, port);
+  }
+
+  if (FCGX_Init()!=0) { fprintf(stderr, "FCGX_Init\n"); return 1; }
+
+  jobs_init(decode_threads);
+
+  if (pthread_create(&reload_thread, NULL, reloader, NULL)!=0)
+  { fprintf(stderr, "main: pthread_create\n"); exit(1); }
+
+  threads=malloc(num_threads*sizeof(pthread_t));
+  if (threads==NULL) { fprintf(stderr, "main: malloc\n"); exit(1); }
+
+  for (i=1; (i<num_threads); i++)
+    if (pthread_create(&threads[i], NULL, worker, NULL)!=0)
+    { fprintf(stderr, "main: pthread_create\n"); exit(1); }
+
+  worker(NULL);
+
+  for (i=1; (i<num_threads); i++) pthread_join(threads[i], NULL);
+
+  free(threads);
+
   return 0;
 }
 
@@ -26,13 +26,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #define __WMS__
 
+#include <libxml/tree.h>
+
 #include "geoquadtree.h"
 #include "proj.h"
+#include "grid.h"
+#include "hash.h"
+#include "fcgi.h"
+#include "cache.h"
+#include "quantize.h"
+#include "admission.h"
+
+#define CACHE_TTL 3600  /* Default seconds a rendered image is cached */
+#define ONLINE_RESOURCE "@ONLINE_RESOURCE@"
 
 typedef struct
 {
   gqt *geoquadtree;
   double minresx, minresy, maxresx, maxresy;
+  int id;  /* Position in the raster list of the layer */
+  time_t mtime;  /* Of the tree when it was loaded */
+  gqt_journal *journal;  /* Imports into the tree since it was loaded */
   struct raster *next;
 } raster;
 
@@ -40,6 +54,10 @@ typedef struct
 {
   char *name;
   srs p_srs;  
+  grid *index;  /* Footprints of the rasters of the layer in this SRS */
+  double bbox[4];  /* Bounding box of the layer in this SRS */
+  int tile_grid;   /* 1 if tiled requests are aligned to tile_origin */
+  double tile_origin[2];  /* Top left corner of the tile grid */
   struct layer_srs *next;
 } layer_srs;
 
@@ -48,10 +66,28 @@ typedef struct
   char *name;
   char *title;
   layer_srs *layer_srs_list;
+  hash_table *srs_hash;  /* layer_srs indexed by name */
   raster *raster_list;
+  int num_rasters;
+  raster **rasters;  /* Rasters indexed by id, from bottom to top */
+  double gbb[4];  /* Geographic bounding box (EPSG:4326) */
+  layer_srs *tile_srs;  /* SRS of the tiles of its first raster, or NULL */
+  int cache;      /* 1 if its images can be cached */
+  int cache_ttl;  /* Seconds its images are kept in the cache */
+  palette *colors;  /* Fixed palette of its 8 bit PNG images, or NULL if
+                       one is built for them */
   struct layer *next;
 } layer;
 
+typedef struct
+{
+  char *buffer;     /* Serialised GetCapabilities document */
+  char *content_type;
+  int length;
+  int num_urls;     /* Places where the online resource URL is inserted */
+  int *url_offset;
+} capabilities;
+
 typedef struct
 {
   char *Title;
@@ -73,9 +109,94 @@ typedef struct
   int MaxWidth;
   int MaxHeight;
   char *Logo;
+  int Threads;             /* Requests served concurrently */
+  int DecodeThreads;       /* Threads decoding tiles for them, 0 to use
+                              the processors shared by the processes */
+  int MaxConnections;      /* Open HTTP connections per process */
+  char *CachePath;         /* Directory of the GetMap cache, or NULL */
+  unsigned long CacheMaxBytes;
+  int MetaTile;            /* Tiles per side rendered at once, 1 if off */
+  unsigned long AdmissionMaxBytes;  /* Cost of the GetMap requests served
+                                       at once, 0 if unlimited */
+  int QueueTimeout;        /* Seconds a GetMap request waits to be served */
+  unsigned long BudgetMaxBytes;  /* Estimated bytes of the tiles of a GetMap
+                                    request read without degrading it */
+  int BudgetMaxTime;       /* Estimated milliseconds of a GetMap request
+                              rendered without degrading it */
+  response_cache *cache;   /* Shared by the reloaded configurations */
+  admission *admission;
+  time_t configuration_mtime;  /* Of the configuration file when read */
+  char update_sequence[128];   /* Time of the newest configuration or tree */
+  int refs;                /* Requests using the configuration, plus one
+                              while it is the current one */
   layer *layer_list;
+  hash_table *layer_hash;  /* layers indexed by name */
+  hash_table *palettes;    /* Built palettes indexed by LAYERS */
+  capabilities capabilities_1_1_1;
+  capabilities capabilities_1_3_0;
+  capabilities capabilities_wmts;
 } service;
 
+typedef struct
+{
+  char *query_string;   /* CGI parameters of the request */
+  char *http_host;
+  char *request_uri;
+  char *path_info;      /* Path after the program name, or NULL */
+  char *if_none_match;  /* Validators sent by the client, or NULL */
+  char *if_modified_since;
+  output_stream *out;   /* Where the response is written */
+  int version;          /* WMS version of the response */
+} wms_request;
+
+typedef struct
+{
+  int filter;
+  unsigned coarsen;
+  tile_cache *tiles;
+  unsigned char *acc;     /* Rasters composited so far (premultiplied) */
+  coverage *cov;          /* Opaque area of acc */
+  int composited;         /* Number of rasters composited into acc */
+  int cancelled;          /* 1 once the image is completely opaque */
+  pthread_mutex_t mutex;  /* Protects cov, composited and cancelled */
+} render_batch;
+
+typedef struct
+{
+  raster *r;
+  srs *p_srs;
+  int index;              /* Position of the raster from the topmost one */
+  image im;               /* The raster resampled alone */
+  coverage *cov;          /* Copy of the batch coverage when it started */
+  int under;              /* 1 if it was put directly under acc instead */
+  int ret;                /* Of gqt_export, -1 if it was not started */
+  render_batch *batch;
+  job_group group;
+  job task;
+} raster_render;
+
+void exception(wms_request *, char *, char *);
+
+void store_capabilities(xmlChar *, int, char *, capabilities *);
+
+void write_capabilities(wms_request *, capabilities *);
+
+int not_modified(wms_request *, char *, time_t);
+
+void validator_headers(wms_request *, char *, time_t, int);
+
+void blank_image(wms_request *, unsigned long, unsigned long, char *,
+                 unsigned char *, int);
+
+void render_map(service *, wms_request *, image *, char *, char *, char *,
+                char *, unsigned char *, int);
+
+void handle_request(service *, wms_request *);
+
+service *service_acquire(void);
+
+void service_release(service *);
+
 #endif
 
 /******************************************************************************/
@@ -0,0 +1,365 @@
+/*
+
+wmts.c - GeoQuadTree OGC WMTS and XYZ tiles
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libxml/tree.h>
+
+#include "geoquadtree.h"
+#include "wms.h"
+#include "xml.h"
+#include "png.h"
+#include "fcgi.h"
+#include "wmts.h"
+
+extern int verbose_level;
+
+/******************************************************************************/
+
+char *wmts_format(layer *l)
+{
+  /* Stored tiles keep the format of the tree, composited ones are PNG */
+
+  char *ext;
+
+  if (l->num_rasters!=1) return "image/png";
+
+  ext=strrchr(l->rasters[0]->geoquadtree->name, '.');
+  if ((ext!=NULL)&&((strcasecmp(ext, ".jpg")==0)||(strcasecmp(ext, ".jpeg")==0)))
+    return "image/jpeg";
+
+  return "image/png";
+}
+
+/******************************************************************************/
+
+void wmts_crs(char *name, char *crs)
+{
+  /* Writes the URN of a CRS given as AUTHORITY:CODE */
+
+  char *code;
+
+  code=strchr(name, ':');
+  if (code==NULL) { strcpy(crs, name); return; }
+
+  sprintf(crs, "urn:ogc:def:crs:%.*s::%s", (int)(code-name), name, code+1);
+}
+
+/******************************************************************************/
+
+void wmts_operation(xmlNodePtr n_metadata, char *name, char *url)
+{
+  xmlNodePtr n_operation, n_dcp, n_http, n_get, n_constraint, n_allowed;
+
+  n_operation=xmlNewChild(n_metadata, NULL, (xmlChar *)"ows:Operation", NULL);
+  xmlNewProp(n_operation, (xmlChar *)"name", (xmlChar *)name);
+  n_dcp=xmlNewChild(n_operation, NULL, (xmlChar *)"ows:DCP", NULL);
+  n_http=xmlNewChild(n_dcp, NULL, (xmlChar *)"ows:HTTP", NULL);
+  n_get=xmlNewChild(n_http, NULL, (xmlChar *)"ows:Get", NULL);
+  xmlNewProp(n_get, (xmlChar *)"xlink:href", (xmlChar *)url);
+  n_constraint=xmlNewChild(n_get, NULL, (xmlChar *)"ows:Constraint", NULL);
+  xmlNewProp(n_constraint, (xmlChar *)"name", (xmlChar *)"GetEncoding");
+  n_allowed=xmlNewChild(n_constraint, NULL, (xmlChar *)"ows:AllowedValues", NULL);
+  xmlNewChild(n_allowed, NULL, (xmlChar *)"ows:Value", (xmlChar *)"KVP");
+}
+
+/******************************************************************************/
+
+int build_wmts_capabilities(service *Service, capabilities *c)
+{
+  /* Serialises once the WMTS capabilities. Every layer whose first raster
+     is offered in its own SRS has a tile matrix set with the native grid
+     of that raster, from its root tile down to its finest level */
+
+  xmlDocPtr doc;
+  xmlNodePtr n_root, n_service, n_metadata, n_contents, n_layer, n_bbox;
+  xmlNodePtr n_style, n_link, n_url, n_set, n_matrix;
+  xmlChar *buffer;
+  int length, z;
+  char url[256], str[256];
+  layer *l;
+  gqt *g;
+  double xmax, ymax, metres, res;
+
+  doc=xmlNewDoc((xmlChar *)"1.0");
+
+  n_root=xmlNewNode(NULL, (xmlChar *)"Capabilities");
+  xmlDocSetRootElement(doc, n_root);
+  xmlNewProp(n_root, (xmlChar *)"xmlns", (xmlChar *)"http://www.opengis.net/wmts/1.0");
+  xmlNewProp(n_root, (xmlChar *)"xmlns:ows", (xmlChar *)"http://www.opengis.net/ows/1.1");
+  xmlNewProp(n_root, (xmlChar *)"xmlns:xlink", (xmlChar *)"http://www.w3.org/1999/xlink");
+  xmlNewProp(n_root, (xmlChar *)"version", (xmlChar *)"1.0.0");
+
+  n_service=xmlNewChild(n_root, NULL, (xmlChar *)"ows:ServiceIdentification", NULL);
+  xmlNewChild(n_service, NULL, (xmlChar *)"ows:Title", (xmlChar *)Service->Title);
+  xmlNewChild(n_service, NULL, (xmlChar *)"ows:Abstract", (xmlChar *)Service->Abstract);
+  xmlNewChild(n_service, NULL, (xmlChar *)"ows:ServiceType", (xmlChar *)"OGC WMTS");
+  xmlNewChild(n_service, NULL, (xmlChar *)"ows:ServiceTypeVersion", (xmlChar *)"1.0.0");
+
+  sprintf(url, "%s?", ONLINE_RESOURCE);
+
+  n_metadata=xmlNewChild(n_root, NULL, (xmlChar *)"ows:OperationsMetadata", NULL);
+  wmts_operation(n_metadata, "GetCapabilities", url);
+  wmts_operation(n_metadata, "GetTile", url);
+
+  n_contents=xmlNewChild(n_root, NULL, (xmlChar *)"Contents", NULL);
+
+  for (l=Service->layer_list; (l!=NULL); l=(layer *)(l->next))
+  {
+    if (l->tile_srs==NULL) continue;
+
+    n_layer=xmlNewChild(n_contents, NULL, (xmlChar *)"Layer", NULL);
+    xmlNewChild(n_layer, NULL, (xmlChar *)"ows:Title", (xmlChar *)l->title);
+
+    n_bbox=xmlNewChild(n_layer, NULL, (xmlChar *)"ows:WGS84BoundingBox", NULL);
+    sprintf(str, "%f %f", l->gbb[0], l->gbb[1]);
+    xmlNewChild(n_bbox, NULL, (xmlChar *)"ows:LowerCorner", (xmlChar *)str);
+    sprintf(str, "%f %f", l->gbb[2], l->gbb[3]);
+    xmlNewChild(n_bbox, NULL, (xmlChar *)"ows:UpperCorner", (xmlChar *)str);
+
+    xmlNewChild(n_layer, NULL, (xmlChar *)"ows:Identifier", (xmlChar *)l->name);
+
+    n_style=xmlNewChild(n_layer, NULL, (xmlChar *)"Style", NULL);
+    xmlNewProp(n_style, (xmlChar *)"isDefault", (xmlChar *)"true");
+    xmlNewChild(n_style, NULL, (xmlChar *)"ows:Identifier", (xmlChar *)"default");
+
+    xmlNewChild(n_layer, NULL, (xmlChar *)"Format", (xmlChar *)wmts_format(l));
+
+    n_link=xmlNewChild(n_layer, NULL, (xmlChar *)"TileMatrixSetLink", NULL);
+    xmlNewChild(n_link, NULL, (xmlChar *)"TileMatrixSet", (xmlChar *)l->name);
+
+    snprintf(url, 256, "%s/%s/{TileMatrix}/{TileCol}/{TileRow}.%s",
+             ONLINE_RESOURCE, l->name,
+             (strcmp(wmts_format(l), "image/jpeg")==0)?"jpg":"png");
+
+    n_url=xmlNewChild(n_layer, NULL, (xmlChar *)"ResourceURL", NULL);
+    xmlNewProp(n_url, (xmlChar *)"format", (xmlChar *)wmts_format(l));
+    xmlNewProp(n_url, (xmlChar *)"resourceType", (xmlChar *)"tile");
+    xmlNewProp(n_url, (xmlChar *)"template", (xmlChar *)url);
+  }
+
+  for (l=Service->layer_list; (l!=NULL); l=(layer *)(l->next))
+  {
+    if (l->tile_srs==NULL) continue;
+
+    g=l->rasters[0]->geoquadtree;
+
+    n_set=xmlNewChild(n_contents, NULL, (xmlChar *)"TileMatrixSet", NULL);
+    xmlNewChild(n_set, NULL, (xmlChar *)"ows:Identifier", (xmlChar *)l->name);
+    wmts_crs(l->tile_srs->name, str);
+    xmlNewChild(n_set, NULL, (xmlChar *)"ows:SupportedCRS", (xmlChar *)str);
+
+    if (OSRIsGeographic(g->p_srs)) metres=WMTS_METRES_PER_DEGREE;
+    else metres=OSRGetLinearUnits(g->p_srs, NULL);
+
+    xmax=g->resx*g->tilesizex*(1<<(g->levels-1));
+    ymax=g->resy*g->tilesizey*(1<<(g->levels-1));
+
+    for (z=0; (z<=g->levels); z++)
+    {
+      res=g->resx*(1<<(g->levels-z));
+
+      n_matrix=xmlNewChild(n_set, NULL, (xmlChar *)"TileMatrix", NULL);
+      sprintf(str, "%i", z);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"ows:Identifier", (xmlChar *)str);
+      sprintf(str, "%.10g", res*metres/WMTS_PIXEL_SIZE);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"ScaleDenominator", (xmlChar *)str);
+
+      /* Geographic CRS of the EPSG list their latitude first */
+
+      if (OSRIsGeographic(g->p_srs)) sprintf(str, "%.10g %.10g", ymax, -xmax);
+      else sprintf(str, "%.10g %.10g", -xmax, ymax);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"TopLeftCorner", (xmlChar *)str);
+
+      sprintf(str, "%u", g->tilesizex);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"TileWidth", (xmlChar *)str);
+      sprintf(str, "%u", g->tilesizey);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"TileHeight", (xmlChar *)str);
+      sprintf(str, "%lu", 1UL<<z);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"MatrixWidth", (xmlChar *)str);
+      xmlNewChild(n_matrix, NULL, (xmlChar *)"MatrixHeight", (xmlChar *)str);
+    }
+  }
+
+  xmlDocDumpFormatMemory(doc, &buffer, &length, 1);
+
+  xmlFreeDoc(doc);
+
+  store_capabilities(buffer, length, "text/xml", c);
+
+  xmlFree(buffer);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void wmts_not_found(wms_request *req)
+{
+  output_printf(req->out, "Status: 404 Not Found\r\n");
+  output_printf(req->out, "Content-type: text/plain\r\n\r\n");
+  output_printf(req->out, "Tile not found\n");
+}
+
+/******************************************************************************/
+
+void wmts_blank_tile(wms_request *req, layer *l, gqt *g)
+{
+  /* Tiles the tree has no file for are empty. They change when an import
+     writes them, so their validator is the modification time of the tree */
+
+  char etag[64];
+  time_t last_modified;
+  unsigned char transparent[4]={0, 0, 0, 0};
+
+  last_modified=gqt_mtime(g);
+  sprintf(etag, "\"blank-%lx\"", (unsigned long)last_modified);
+
+  if (not_modified(req, etag, last_modified)==1)
+  {
+    output_printf(req->out, "Status: 304 Not Modified\r\n");
+    validator_headers(req, etag, last_modified, l->cache_ttl);
+    output_printf(req->out, "\r\n");
+    return;
+  }
+
+  output_printf(req->out, "Content-type: image/png\r\n");
+  validator_headers(req, etag, last_modified, l->cache_ttl);
+  output_printf(req->out, "\r\n");
+
+  blank_image(req, g->tilesizex, g->tilesizey, "image/png", transparent, 0);
+}
+
+/******************************************************************************/
+
+void wmts_get_tile(service *Service, wms_request *req, char *layer_name,
+                   int z, long x, long y)
+{
+  /* Answers a tile of the native grid of a layer. With a single raster the
+     stored file is sent as it is, without decoding it; the tiles of layers
+     with several rasters are composited like a GetMap */
+
+  char path[1024], etag[64], params[512], names[256];
+  unsigned char background[4];
+  struct stat st;
+  layer *l;
+  gqt *g;
+  image im;
+  int fd;
+
+  l=seek_layer(Service, layer_name);
+  if ((l==NULL)||(l->tile_srs==NULL)) { wmts_not_found(req); return; }
+
+  g=l->rasters[0]->geoquadtree;
+
+  if (gqt_tile_path(g, z, x, y, path)!=0) { wmts_not_found(req); return; }
+
+  if (verbose_level>1) printf("wmts_get_tile %s %i %ld %ld %s\n", l->name, z, x, y, path);
+
+  if (l->num_rasters>1)
+  {
+    gqt_tile_bbox(g, z, x, y, &im);
+
+    snprintf(params, sizeof(params), "tile&%s&%i&%ld&%ld", l->name, z, x, y);
+
+    strncpy(names, l->name, 255);
+    names[255]=0;
+
+    background[0]=background[1]=background[2]=background[3]=0;
+
+    render_map(Service, req, &im, names, l->tile_srs->name, "image/png",
+               params, background, 0);
+    return;
+  }
+
+  fd=open(path, O_RDONLY);
+
+  if ((fd<0)||(fstat(fd, &st)!=0))
+  {
+    if (fd>=0) close(fd);
+    wmts_blank_tile(req, l, g);
+    return;
+  }
+
+  sprintf(etag, "\"%lx-%lx-%lx\"", (unsigned long)st.st_ino,
+          (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+
+  if (not_modified(req, etag, st.st_mtime)==1)
+  {
+    close(fd);
+
+    output_printf(req->out, "Status: 304 Not Modified\r\n");
+    validator_headers(req, etag, st.st_mtime, l->cache_ttl);
+    output_printf(req->out, "\r\n");
+    return;
+  }
+
+  output_printf(req->out, "Content-type: %s\r\n", wmts_format(l));
+  validator_headers(req, etag, st.st_mtime, l->cache_ttl);
+  output_printf(req->out, "\r\n");
+
+  output_file(req->out, fd, st.st_size);
+}
+
+/******************************************************************************/
+
+int wmts_path(service *Service, wms_request *req)
+{
+  /* Answers the requests addressed by their path: the WMTS capabilities
+     at /1.0.0/WMTSCapabilities.xml and the tiles at /layer/z/x/y.ext.
+     Returns 1 if the path is not one of them */
+
+  char *p, layer_name[256], ext[16];
+  int z, slashes;
+  long x, y;
+
+  if ((req->path_info==NULL)||(strlen(req->path_info)<=1)) return 1;
+
+  if (strcmp(req->path_info, "/1.0.0/WMTSCapabilities.xml")==0)
+  {
+    write_capabilities(req, &(Service->capabilities_wmts));
+    return 0;
+  }
+
+  /* The tile is addressed by the last four segments of the path */
+
+  slashes=0;
+  for (p=req->path_info+strlen(req->path_info); (p>req->path_info); p--)
+    if ((*p=='/')&&(++slashes==4)) break;
+
+  if (sscanf(p, "/%255[^/]/%d/%ld/%ld.%15s", layer_name, &z, &x, &y, ext)!=5)
+    return 1;
+
+  wmts_get_tile(Service, req, layer_name, z, x, y);
+
+  return 0;
+}
+
+/******************************************************************************/
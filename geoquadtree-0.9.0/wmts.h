@@ -0,0 +1,43 @@
+/*
+
+wmts.h - GeoQuadTree OGC WMTS and XYZ tiles
+
+Copyright (C) 2006  Jordi Gilabert Vall <geoquadtree at gmail com>
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+*/
+
+/******************************************************************************/
+
+#if !defined(__WMTS__)
+
+#define __WMTS__
+
+#include "geoquadtree.h"
+#include "wms.h"
+
+#define WMTS_PIXEL_SIZE 0.00028  /* Metres per pixel of the WMTS scale */
+#define WMTS_METRES_PER_DEGREE 111319.49
+
+int build_wmts_capabilities(service *, capabilities *);
+
+void wmts_get_tile(service *, wms_request *, char *, int, long, long);
+
+int wmts_path(service *, wms_request *);
+
+#endif
+
+/******************************************************************************/
@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <libxml/xinclude.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -144,44 +145,71 @@ int gqt_write_metadata(char *geoquadtree_xml, gqt *g)
 
 /******************************************************************************/
 
-void gqt_read_metadata(char *geoquadtree_xml, gqt *g)
+int gqt_read_metadata(char *geoquadtree_xml, gqt *g)
 {
+  /* Returns 1 if the metadata or the projection of the tree cannot be
+     read, so that a server reloading its configuration can keep the
+     previous one */
+
   xmlParserCtxtPtr ctxt;
   xmlDocPtr doc;
   xmlNodePtr cur;
-  char *str;
+  char *str, *levels, *resx, *resy, *tilesizex, *tilesizey;
   char *geoquadtree_prj=NULL;
-  int i;
+  int i, ret;
 
   ctxt = xmlNewParserCtxt();
   if (ctxt == NULL)
-  { fprintf(stderr, "Failed to allocate parser context\n"); exit(1); }
+  { fprintf(stderr, "Failed to allocate parser context\n"); return 1; }
 
   doc = xmlCtxtReadFile(ctxt, geoquadtree_xml, NULL, 0);
-  if (doc == NULL)
-  { fprintf(stderr, "Failed to parse %s\n", geoquadtree_xml); exit(1); }
-
   xmlFreeParserCtxt(ctxt);
 
+  if (doc == NULL)
+  { fprintf(stderr, "Failed to parse %s\n", geoquadtree_xml); return 1; }
+
   cur = xmlDocGetRootElement(doc);
   if (cur == NULL)
-  { fprintf(stderr,"Empty document\n"); xmlFreeDoc(doc); return; }
+  { fprintf(stderr,"Empty document\n"); xmlFreeDoc(doc); return 1; }
 
   if (xmlStrcmp(cur->name, (const xmlChar *)"GeoQuadTree"))
   {
-    printf("get_read_metadata: not a valid GeoQuadTree image");
+    fprintf(stderr, "gqt_read_metadata: not a valid GeoQuadTree image\n");
     xmlFreeDoc(doc);
-    return;
+    return 1;
+  }
+
+  levels=NULL; resx=NULL; resy=NULL; tilesizex=NULL; tilesizey=NULL;
+
+  ret=xmlprop(cur, (xmlChar *)"levels", &levels);
+  ret|=xmlprop(cur, (xmlChar *)"resx", &resx);
+  ret|=xmlprop(cur, (xmlChar *)"resy", &resy);
+  ret|=xmlprop(cur, (xmlChar *)"tilesizex", &tilesizex);
+  ret|=xmlprop(cur, (xmlChar *)"tilesizey", &tilesizey);
+
+  if (ret==0)
+  {
+    g->levels=atoi(levels);
+    g->resx=atof(resx);
+    g->resy=atof(resy);
+    g->tilesizex=atoi(tilesizex);
+    g->tilesizey=atoi(tilesizey);
+
+    if ((g->tilesizex<=0)||(g->tilesizey<=0)) ret=1;
   }
 
-  xmlprop(cur, (xmlChar *)"name", &(g->name));
-  xmlprop(cur, (xmlChar *)"levels", &str); g->levels=atoi(str); free(str);
-  xmlprop(cur, (xmlChar *)"resx", &str); g->resx=atof(str); free(str);
-  xmlprop(cur, (xmlChar *)"resy", &str); g->resy=atof(str); free(str);
-  xmlprop(cur, (xmlChar *)"tilesizex", &str); g->tilesizex=atoi(str); free(str);
-  xmlprop(cur, (xmlChar *)"tilesizey", &str); g->tilesizey=atoi(str); free(str);
+  free(levels); free(resx); free(resy); free(tilesizex); free(tilesizey);
+
+  if ((ret!=0)||(xmlprop(cur, (xmlChar *)"name", &(g->name))!=0))
+  {
+    fprintf(stderr, "gqt_read_metadata: %s is incomplete\n",
+            geoquadtree_xml);
+    xmlFreeDoc(doc);
+    return 1;
+  }
 
   g->bounding_box=1;
+  g->trusted=0;
 
   if (xmlprop(cur, (xmlChar *)"minx", &str)==1) g->bounding_box=0;
   else { g->minx=atof(str); free(str); }
@@ -205,12 +233,26 @@ void gqt_read_metadata(char *geoquadtree_xml, gqt *g)
   geoquadtree_prj[i]=0;
   strcat(geoquadtree_prj, ".prj"); 
 
-  srs_import_file(&(g->p_srs), geoquadtree_prj);
+  ret=srs_import_file(&(g->p_srs), geoquadtree_prj);
+  free(geoquadtree_prj);
+
+  if (ret!=0)
+  {
+    fprintf(stderr, "gqt_read_metadata: no projection for %s\n",
+            geoquadtree_xml);
+    free(g->name);
+    return 1;
+  }
 
   for (i=strlen(geoquadtree_xml)-1; ((i>=0)&&(geoquadtree_xml[i]!='/')); i--);
   g->path=malloc(i+1);
   strncpy(g->path, geoquadtree_xml, i);
   g->path[i]=0;
+
+  g->metadata=malloc(strlen(geoquadtree_xml)+1);
+  strcpy(g->metadata, geoquadtree_xml);
+
+  return 0;
 }
 
 /******************************************************************************/
@@ -218,7 +260,10 @@ void gqt_read_metadata(char *geoquadtree_xml, gqt *g)
 void parse_service(service *Service, xmlDocPtr doc, xmlNodePtr cur)
 {
   xmlNodePtr cur2, cur3;
-  char *maxwidth, *maxheight;
+  char *maxwidth, *maxheight, *threads=NULL, *maxconnections=NULL;
+  char *decodethreads=NULL;
+  char *metatile=NULL;
+  char *str;
 
   cur=cur->xmlChildrenNode;
 
@@ -241,6 +286,16 @@ void parse_service(service *Service, xmlDocPtr doc, xmlNodePtr cur)
   Service->MaxWidth=2048;
   Service->MaxHeight=2048;
   Service->Logo=NULL;
+  Service->Threads=1;
+  Service->DecodeThreads=0;
+  Service->MaxConnections=1024;
+  Service->CachePath=NULL;
+  Service->CacheMaxBytes=256*1024*1024;
+  Service->MetaTile=1;
+  Service->AdmissionMaxBytes=0;
+  Service->QueueTimeout=10;
+  Service->BudgetMaxBytes=0;
+  Service->BudgetMaxTime=0;
 
   while (cur!=NULL)
   {
@@ -251,6 +306,36 @@ void parse_service(service *Service, xmlDocPtr doc, xmlNodePtr cur)
     xmlvalue(cur, (xmlChar *)"MaxWidth", &maxwidth);
     xmlvalue(cur, (xmlChar *)"MaxHeight", &maxheight);
     xmlvalue(cur, (xmlChar *)"Logo", &(Service->Logo));
+    xmlvalue(cur, (xmlChar *)"Threads", &threads);
+    xmlvalue(cur, (xmlChar *)"DecodeThreads", &decodethreads);
+    xmlvalue(cur, (xmlChar *)"MaxConnections", &maxconnections);
+    xmlvalue(cur, (xmlChar *)"MetaTile", &metatile);
+
+    if ((!xmlStrcmp(cur->name, (const xmlChar *)"Cache")))
+    {
+      xmlprop(cur, (xmlChar *)"Path", &(Service->CachePath));
+
+      if (xmlprop(cur, (xmlChar *)"MaxBytes", &str)==0)
+      { Service->CacheMaxBytes=strtoul(str, NULL, 10); free(str); }
+    }
+
+    if ((!xmlStrcmp(cur->name, (const xmlChar *)"Admission")))
+    {
+      if (xmlprop(cur, (xmlChar *)"MaxBytes", &str)==0)
+      { Service->AdmissionMaxBytes=strtoul(str, NULL, 10); free(str); }
+
+      if (xmlprop(cur, (xmlChar *)"QueueTimeout", &str)==0)
+      { Service->QueueTimeout=atoi(str); free(str); }
+    }
+
+    if ((!xmlStrcmp(cur->name, (const xmlChar *)"Budget")))
+    {
+      if (xmlprop(cur, (xmlChar *)"MaxBytes", &str)==0)
+      { Service->BudgetMaxBytes=strtoul(str, NULL, 10); free(str); }
+
+      if (xmlprop(cur, (xmlChar *)"MaxTime", &str)==0)
+      { Service->BudgetMaxTime=atoi(str); free(str); }
+    }
 
     if ((!xmlStrcmp(cur->name, (const xmlChar *)"ContactInformation")))
     {
@@ -302,6 +387,30 @@ void parse_service(service *Service, xmlDocPtr doc, xmlNodePtr cur)
 
   if (strlen(maxwidth)>0) Service->MaxWidth=atoi(maxwidth);
   if (strlen(maxheight)>0) Service->MaxHeight=atoi(maxheight);
+
+  if (threads!=NULL)
+  {
+    if (atoi(threads)>0) Service->Threads=atoi(threads);
+    free(threads);
+  }
+
+  if (decodethreads!=NULL)
+  {
+    if (atoi(decodethreads)>0) Service->DecodeThreads=atoi(decodethreads);
+    free(decodethreads);
+  }
+
+  if (maxconnections!=NULL)
+  {
+    if (atoi(maxconnections)>0) Service->MaxConnections=atoi(maxconnections);
+    free(maxconnections);
+  }
+
+  if (metatile!=NULL)
+  {
+    if (atoi(metatile)>0) Service->MetaTile=atoi(metatile);
+    free(metatile);
+  }
 }
 
 /******************************************************************************/
@@ -316,10 +425,21 @@ layer *add_layer(service *Service, char *name, char *title)
   l->name=malloc(strlen(name)+1); strcpy(l->name, name);
   l->title=malloc(strlen(title)+1); strcpy(l->title, title);
   l->layer_srs_list=NULL;
+  l->srs_hash=hash_new(16);
   l->raster_list=NULL;
+  l->num_rasters=0;
+  l->rasters=NULL;
+  l->tile_srs=NULL;
+  l->gbb[0]=0; l->gbb[1]=0; l->gbb[2]=0; l->gbb[3]=0;
+  l->cache=1;
+  l->cache_ttl=CACHE_TTL;
+  l->colors=NULL;
   l->next=(struct layer *)Service->layer_list;
   Service->layer_list=l;
 
+  if (Service->layer_hash==NULL) Service->layer_hash=hash_new(64);
+  hash_put(Service->layer_hash, l->name, l);
+
   return l;
 }
 
@@ -329,6 +449,9 @@ layer *seek_layer(service *Service, char *name)
 {
   layer *l;
 
+  if (Service->layer_hash!=NULL)
+    return (layer *)hash_get(Service->layer_hash, name);
+
   l=Service->layer_list;
   while (l!=NULL)
   {
@@ -341,23 +464,30 @@ layer *seek_layer(service *Service, char *name)
 
 /******************************************************************************/
 
-void add_raster(layer *l, char *path,
-                double minresx, double minresy, double maxresx, double maxresy)
+int add_raster(layer *l, char *path,
+               double minresx, double minresy, double maxresx, double maxresy,
+               int trusted)
 {
+  /* Returns 1 if the tree cannot be read */
+
   raster *r;
   gqt *g;
 
   if (l==NULL) { printf("add_raster: layer is null\n"); exit(1); }
 
-  r=malloc(sizeof(raster));
-  if (r==NULL) { printf("add_raster: malloc\n"); exit(1); }
-
   g=malloc(sizeof(gqt));
   if (g==NULL) { printf("add_raster: malloc\n"); exit(1); }
 
-  gqt_read_metadata(path, g);
+  if (gqt_read_metadata(path, g)!=0) { free(g); return 1; }
+
+  r=malloc(sizeof(raster));
+  if (r==NULL) { printf("add_raster: malloc\n"); exit(1); }
+
+  g->trusted=trusted;
 
   r->geoquadtree=g;
+  r->mtime=gqt_mtime(g);
+  r->journal=gqt_journal_open(g);
 
   r->minresx=minresx;
   r->minresy=minresy;
@@ -366,13 +496,24 @@ void add_raster(layer *l, char *path,
 
   r->next=(struct raster *)(l->raster_list);
   l->raster_list=r;
+
+  return 0;
 }
 
 /******************************************************************************/
 
-void add_layer_srs(layer *l, char *name, char *path)
+layer_srs *add_layer_srs(layer *l, char *name, char *path)
 {
+  /* Returns NULL if the SRS cannot be read */
+
   layer_srs *ls;
+  srs p_srs;
+
+  if (srs_import_file(&p_srs, path)!=0)
+  {
+    fprintf(stderr, "add_layer_srs: cannot read %s\n", path);
+    return NULL;
+  }
 
   ls=malloc(sizeof(layer_srs));
   if (ls==NULL) { fprintf(stderr, "add_layer_srs malloc"); exit(1); }
@@ -381,23 +522,33 @@ void add_layer_srs(layer *l, char *name, char *path)
   if (ls->name==NULL) { fprintf(stderr, "add_layer_srs malloc"); exit(1); }
   strcpy(ls->name, name);
 
-  srs_import_file(&(ls->p_srs), path);
+  ls->p_srs=p_srs;
+
+  ls->index=NULL;
+  ls->bbox[0]=0; ls->bbox[1]=0; ls->bbox[2]=0; ls->bbox[3]=0;
+  ls->tile_grid=0;
 
   ls->next=(struct layer_srs *)l->layer_srs_list;
   l->layer_srs_list=ls;
+
+  hash_put(l->srs_hash, ls->name, ls);
+
+  return ls;
 }
 
 /******************************************************************************/
 
-srs *seek_layer_srs(layer *l, char *srs)
+layer_srs *seek_layer_srs_entry(layer *l, char *srs)
 {
   layer_srs *ls;
 
+  if (l->srs_hash!=NULL) return (layer_srs *)hash_get(l->srs_hash, srs);
+
   ls=l->layer_srs_list;
 
   while (ls!=NULL)
   {
-    if (strcmp(ls->name, srs)==0) return ls->p_srs;
+    if (strcmp(ls->name, srs)==0) return ls;
     ls=(layer_srs *)ls->next;
   }
 
@@ -406,11 +557,98 @@ srs *seek_layer_srs(layer *l, char *srs)
 
 /******************************************************************************/
 
-void parse_layer(service *Service, xmlDocPtr doc, xmlNodePtr cur)
+srs *seek_layer_srs(layer *l, char *srs)
 {
+  layer_srs *ls;
+
+  ls=seek_layer_srs_entry(l, srs);
+  if (ls==NULL) return NULL;
+
+  return ls->p_srs;
+}
+
+/******************************************************************************/
+
+void index_layer(layer *l)
+{
+  /* Numbers the rasters of the layer, and builds for every SRS offered by
+     the layer the spatial index of the footprints of its rasters */
+
+  layer_srs *ls;
+  raster *r;
+  double bbox[4];
+
+  l->num_rasters=0;
+
+  r=l->raster_list;
+  while (r!=NULL)
+  {
+    r->id=l->num_rasters++;
+    r=(raster *)r->next;
+  }
+
+  l->rasters=realloc(l->rasters, (l->num_rasters+1)*sizeof(raster *));
+  if (l->rasters==NULL) { fprintf(stderr, "index_layer: malloc\n"); exit(1); }
+
+  r=l->raster_list;
+  while (r!=NULL)
+  {
+    l->rasters[r->id]=r;
+    r=(raster *)r->next;
+  }
+
+  ls=l->layer_srs_list;
+  while (ls!=NULL)
+  {
+    grid_free(ls->index);
+    ls->index=grid_new(l->num_rasters);
+
+    r=l->raster_list;
+    while (r!=NULL)
+    {
+      if (gqt_footprint(r->geoquadtree, ls->p_srs, bbox)==0)
+        grid_set(ls->index, r->id, bbox);
+      else
+        grid_set(ls->index, r->id, NULL);
+
+      r=(raster *)r->next;
+    }
+
+    grid_build(ls->index);
+
+    ls=(layer_srs *)ls->next;
+  }
+
+  /* The stored tiles can be served as they are in the SRS of the first
+     raster, when the layer offers it */
+
+  l->tile_srs=NULL;
+
+  if (l->num_rasters>0)
+  {
+    ls=l->layer_srs_list;
+    while ((ls!=NULL)&&(l->tile_srs==NULL))
+    {
+      if (OSRIsSame(ls->p_srs, l->rasters[0]->geoquadtree->p_srs))
+        l->tile_srs=ls;
+
+      ls=(layer_srs *)ls->next;
+    }
+  }
+}
+
+/******************************************************************************/
+
+int parse_layer(service *Service, xmlDocPtr doc, xmlNodePtr cur)
+{
+  /* Returns 1 if a SRS or a tree of the layer cannot be read */
+
   layer *l;
-  char *Name, *Title, *Path;
+  char *Name, *Title, *Path, *TileOriginX, *TileOriginY;
+  layer_srs *ls;
   char *MinResX, *MinResY, *MaxResX, *MaxResY;
+  char *Cache, *CacheTTL, *Palette, *Trusted;
+  int trusted, ret;
 
   xmlprop(cur, (xmlChar *)"Name", &Name);
   xmlprop(cur, (xmlChar *)"Title", &Title);
@@ -420,6 +658,24 @@ void parse_layer(service *Service, xmlDocPtr doc, xmlNodePtr cur)
   free(Name);
   free(Title);
 
+  if (xmlprop(cur, (xmlChar *)"Cache", &Cache)==0)
+  {
+    if (strcasecmp(Cache, "false")==0) l->cache=0;
+    free(Cache);
+  }
+
+  if (xmlprop(cur, (xmlChar *)"CacheTTL", &CacheTTL)==0)
+  {
+    l->cache_ttl=atoi(CacheTTL);
+    free(CacheTTL);
+  }
+
+  if (xmlprop(cur, (xmlChar *)"Palette", &Palette)==0)
+  {
+    l->colors=palette_read(Palette);
+    free(Palette);
+  }
+
   cur=cur->xmlChildrenNode;
 
   while (cur != NULL)
@@ -429,10 +685,24 @@ void parse_layer(service *Service, xmlDocPtr doc, xmlNodePtr cur)
       xmlprop(cur, (xmlChar *)"Name", &Name);
       xmlprop(cur, (xmlChar *)"Path", &Path);
 
-      add_layer_srs(l, Name, Path);
+      ls=add_layer_srs(l, Name, Path);
 
       free(Name);
       free(Path);
+
+      if (ls==NULL) return 1;
+
+      /* Requests of tiled clients are aligned to a grid from this origin */
+
+      if ((xmlprop(cur, (xmlChar *)"TileOriginX", &TileOriginX)==0)&&
+          (xmlprop(cur, (xmlChar *)"TileOriginY", &TileOriginY)==0))
+      {
+        ls->tile_grid=1;
+        ls->tile_origin[0]=atof(TileOriginX);
+        ls->tile_origin[1]=atof(TileOriginY);
+        free(TileOriginX);
+        free(TileOriginY);
+      }
     }
 
     if ((!xmlStrcmp(cur->name, (const xmlChar *)"GeoQuadTree")))
@@ -443,19 +713,33 @@ void parse_layer(service *Service, xmlDocPtr doc, xmlNodePtr cur)
       xmlprop(cur, (xmlChar *)"MaxResX", &MaxResX);
       xmlprop(cur, (xmlChar *)"MinResY", &MinResY);
       xmlprop(cur, (xmlChar *)"MaxResY", &MaxResY);
+
+      trusted=0;
+      if (xmlprop(cur, (xmlChar *)"Trusted", &Trusted)==0)
+      {
+        if (strcasecmp(Trusted, "true")==0) trusted=1;
+        free(Trusted);
+      }
         
-      add_raster(l, Path,
-                 atof(MinResX), atof(MinResY), atof(MaxResX), atof(MaxResY));
+      ret=add_raster(l, Path,
+                     atof(MinResX), atof(MinResY), atof(MaxResX), atof(MaxResY),
+                     trusted);
 
       free(Path);
       free(MinResX);
       free(MinResY);
       free(MaxResX);
       free(MaxResY);
+
+      if (ret!=0) return 1;
     }
 
     cur = cur->next;
   }
+
+  index_layer(l);
+
+  return 0;
 }
 
 /******************************************************************************/
@@ -474,12 +758,18 @@ int read_configuration(service *Service, const char *filename)
   }
 
   doc=xmlCtxtReadFile(ctxt, filename, NULL, XML_PARSE_DTDVALID);
-  if (doc==NULL) { fprintf(stderr, "Failed to parse %s\n", filename); exit(1); }
+  if (doc==NULL)
+  {
+    fprintf(stderr, "Failed to parse %s\n", filename);
+    xmlFreeParserCtxt(ctxt);
+    return 1;
+  }
   else
   {
     if (ctxt->valid==0)
     {
       fprintf(stderr, "read_configuration: Failed to validate %s\n", filename);
+      xmlFreeParserCtxt(ctxt);
       xmlFreeDoc(doc);
       return 1;
     }
@@ -524,8 +814,13 @@ int read_configuration(service *Service, const char *filename)
 
   while (cur != NULL)
   {
-    if ((!xmlStrcmp(cur->name, (const xmlChar *)"Layer")))
-      parse_layer(Service, doc, cur);
+    if ((!xmlStrcmp(cur->name, (const xmlChar *)"Layer"))&&
+        (parse_layer(Service, doc, cur)!=0))
+    {
+      fprintf(stderr, "read_configuration: invalid layer in %s\n", filename);
+      xmlFreeDoc(doc);
+      return 1;
+    }
 
     cur=cur->next;
   }
@@ -569,6 +864,16 @@ int list_configuration(service *Service, char *filename)
   fprintf(fp, "\tMaxWidth: %i\n", Service->MaxWidth);
   fprintf(fp, "\tMaxHeight: %i\n", Service->MaxHeight);
   fprintf(fp, "\tLogo: %s\n", Service->Logo);
+  fprintf(fp, "\tThreads: %i\n", Service->Threads);
+  fprintf(fp, "\tDecodeThreads: %i\n", Service->DecodeThreads);
+  fprintf(fp, "\tMaxConnections: %i\n", Service->MaxConnections);
+  fprintf(fp, "\tCache: %s (%lu bytes)\n", Service->CachePath,
+          Service->CacheMaxBytes);
+  fprintf(fp, "\tMetaTile: %i\n", Service->MetaTile);
+  fprintf(fp, "\tAdmission: %lu bytes (%i s)\n", Service->AdmissionMaxBytes,
+          Service->QueueTimeout);
+  fprintf(fp, "\tBudget: %lu bytes (%i ms)\n", Service->BudgetMaxBytes,
+          Service->BudgetMaxTime);
 
   l=Service->layer_list;
   while (l!=NULL)
@@ -576,11 +881,17 @@ int list_configuration(service *Service, char *filename)
     fprintf(fp, "Layer\n");
     fprintf(fp, "\tname: %s\n", l->name);
     fprintf(fp, "\ttitle: %s\n", l->title);
+    fprintf(fp, "\tcache: %i (%i s)\n", l->cache, l->cache_ttl);
+    if (l->colors!=NULL)
+      fprintf(fp, "\tpalette: %i colours\n", l->colors->num_colors-1);
 
     ls=l->layer_srs_list;
     while (ls!=NULL)
     {
       fprintf(fp, "\tsrs: %s\n", ls->name);
+      if (ls->tile_grid==1)
+        fprintf(fp, "\t\ttile origin: %f %f\n",
+                ls->tile_origin[0], ls->tile_origin[1]);
       ls=(layer_srs *)ls->next;
     }
 
@@ -598,6 +909,8 @@ int list_configuration(service *Service, char *filename)
       fprintf(fp, "\t        tilesizex=%i tilesizey=%i bounding_box=%i\n",
               g->tilesizex, g->tilesizey, g->bounding_box);
 
+      fprintf(fp, "\t        trusted=%i\n", g->trusted);
+
       fprintf(fp, "\t        minx=%f miny=%f maxx=%f maxy=%f\n",
               g->minx, g->miny, g->maxx, g->maxy);
 
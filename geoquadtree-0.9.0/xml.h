@@ -40,7 +40,7 @@ void xmlvalue(xmlNodePtr, xmlChar *, char **);
 
 int gqt_write_metadata(char *, gqt *);
 
-void gqt_read_metadata(char *, gqt *);
+int gqt_read_metadata(char *, gqt *);
 
 int read_configuration(service *, const char *);
 
@@ -50,6 +50,10 @@ layer *seek_layer(service *, char *);
 
 srs *seek_layer_srs(layer *, char *);
 
+layer_srs *seek_layer_srs_entry(layer *, char *);
+
+void index_layer(layer *);
+
 gqt *seek_gqt(char *);
 
 #endif